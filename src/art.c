@@ -8,7 +8,18 @@
 #include "art.h"
 #include "artInternal.h"
 
-#if __SSE__
+#include <time.h>
+
+#include <pthread.h>
+#include <sched.h>
+
+#if ART_COMPRESSED_POINTERS
+#include <sys/mman.h>
+#endif
+
+#if __AVX2__
+#include <immintrin.h>
+#elif __SSE__
 #include <emmintrin.h>
 #endif
 
@@ -16,6 +27,12 @@
 #define ART_USE_IMPLICIT_KEY_NULL_TERMINIATOR_PROTECTION 1
 #endif
 
+/* Binary keys keep keys ending at a node in its end slot instead */
+#if ART_BINARY_KEYS
+#undef ART_USE_IMPLICIT_KEY_NULL_TERMINIATOR_PROTECTION
+#define ART_USE_IMPLICIT_KEY_NULL_TERMINIATOR_PROTECTION 0
+#endif
+
 /**
  * Macros to manipulate pointer tags
  */
@@ -23,40 +40,715 @@
 #define SET_LEAF(x) ((void *)((uintptr_t)x | 1))
 #define LEAF_RAW(x) ((artLeaf *)((void *)((uintptr_t)x & ~1ULL)))
 
+/**
+ * Macros to maintain per-node leaf counts (no-ops without subtree counts)
+ */
+#if ART_SUBTREE_COUNTS
+#define LEAF_COUNT_SET(n, v) ((n)->leafCount = (v))
+#define LEAF_COUNT_ADD(n, d) ((n)->leafCount += (d))
+#else
+#define LEAF_COUNT_SET(n, v) ((void)0)
+#define LEAF_COUNT_ADD(n, d) ((void)0)
+#endif
+
+/**
+ * Macros to reach the end slot of binary key nodes (always empty otherwise)
+ */
+#define END_KEY -1 /* key "byte" of the end slot, before every child */
+#if ART_BINARY_KEYS
+#define NODE_END(n) REF_PTR((n)->end)
+#define NODE_END_SET(n, v) ((n)->end = PTR_REF(v))
+#else
+#define NODE_END(n) ((artNode *)NULL)
+#define NODE_END_SET(n, v) ((void)0)
+#endif
+
+/**
+ * Macros to record hot path metrics (no-ops without ART_METRICS).
+ * Counters are bumped with relaxed atomics through a cast, so read-only
+ * operations on a const tree can record too.
+ */
+#if ART_METRICS
+#define METRIC_ADD(t, field, v)                                                \
+    __atomic_fetch_add(&((art *)(t))->metrics.field, (v), __ATOMIC_RELAXED)
+#define METRIC_INC(t, field) METRIC_ADD(t, field, 1)
+#define METRIC_CLOCK(start) const uint64_t start = metricsNow()
+#define METRIC_LATENCY(t, hist, start)                                         \
+    metricsRecord(&((art *)(t))->metrics.hist, metricsNow() - (start))
+
+static uint64_t metricsNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Bucket of 'ns': exact below 8, then eight buckets per power of two
+static int latencyBucket(const uint64_t ns) {
+    if (ns < 8) {
+        return ns;
+    }
+
+    const int exp = 63 - __builtin_clzll(ns);
+    const int bucket = (exp - 2) * 8 + ((ns >> (exp - 3)) & 7);
+    return bucket < ART_METRICS_LATENCY_BUCKETS
+               ? bucket
+               : ART_METRICS_LATENCY_BUCKETS - 1;
+}
+
+static void metricsRecord(artLatencyHistogram *h, const uint64_t ns) {
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->totalNs, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->buckets[latencyBucket(ns)], 1, __ATOMIC_RELAXED);
+}
+#else
+#define METRIC_ADD(t, field, v) ((void)0)
+#define METRIC_INC(t, field) ((void)0)
+#define METRIC_CLOCK(start) ((void)0)
+#define METRIC_LATENCY(t, hist, start) ((void)0)
+#endif
+
+/**
+ * Zeroed node allocation. Aligned node types are padded to whole cache
+ * lines, as aligned_alloc() requires.
+ */
+#if ART_CACHE_ALIGNED_NODES
+static void *alignedCalloc(const size_t size) {
+    void *p = aligned_alloc(ART_CACHE_LINE, size);
+    return p ? memset(p, 0, size) : NULL;
+}
+
+#define NODE_CALLOC(size) alignedCalloc(size)
+#elif !ART_COMPRESSED_POINTERS
+#define NODE_CALLOC(size) calloc(1, size)
+#endif
+
+#if ART_COMPRESSED_POINTERS
+/* =================================================
+ * Node arena for 32-bit child references
+ * ================================================ */
+/* Nodes and leaves live in one reserved region, so a child reference is
+ * its offset into the region. Blocks are multiples of 16 bytes, letting
+ * the offset be stored in 8 byte units with bit 0 left for the leaf tag.
+ * Freed blocks up to ARENA_SMALL_MAX bytes go on exact-size free lists
+ * (every node type fits); larger ones (leaves with long keys) go on a
+ * first-fit list and are split on reuse. */
+#define ARENA_RESERVE (32ULL << 30)
+#define ARENA_GRANULE 16
+#define ARENA_SMALL_MAX 4096
+
+typedef struct arenaBlock {
+    struct arenaBlock *next;
+    size_t size;
+} arenaBlock;
+
+static struct {
+    uint8_t *base;
+    size_t used;
+    arenaBlock *small[ARENA_SMALL_MAX / ARENA_GRANULE + 1];
+    arenaBlock *large;
+    pthread_mutex_t lock;
+    pthread_once_t once;
+} arena = {.lock = PTHREAD_MUTEX_INITIALIZER, .once = PTHREAD_ONCE_INIT};
+
+#if ART_HUGE_PAGES
+#define ARENA_HUGE_PAGE (2ULL << 20)
+#else
+#define ARENA_HUGE_PAGE 0ULL
+#endif
+
+/* With ART_HUGE_PAGES a hugetlb mapping is tried first. Without
+ * MAP_NORESERVE it claims its pages from the pool up front, so a short
+ * pool fails here instead of faulting later. The normal mapping is then
+ * over-reserved by a huge page to start on the 2 MB boundary transparent
+ * huge pages need. */
+static uint8_t *arenaMap(void) {
+#if ART_HUGE_PAGES && defined(MAP_HUGETLB)
+    void *huge = mmap(NULL, ARENA_RESERVE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (huge != MAP_FAILED) {
+        return huge;
+    }
+#endif
+
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+    flags |= MAP_NORESERVE;
+#endif
+    void *base = mmap(NULL, ARENA_RESERVE + ARENA_HUGE_PAGE,
+                      PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+#if ART_HUGE_PAGES
+    base = (void *)(((uintptr_t)base + ARENA_HUGE_PAGE - 1) &
+                    ~(uintptr_t)(ARENA_HUGE_PAGE - 1));
+#ifdef MADV_HUGEPAGE
+    madvise(base, ARENA_RESERVE, MADV_HUGEPAGE); /* advice, may be ignored */
+#endif
+#endif
+
+    return base;
+}
+
+static void arenaReserve(void) {
+    uint8_t *base = arenaMap();
+    if (base) {
+        arena.base = base;
+        arena.used = ARENA_GRANULE; /* offset 0 stays NULL */
+    }
+}
+
+static void arenaFreeLocked(void *ptr, size_t size) {
+    arenaBlock *b = ptr;
+    b->size = size;
+    if (size <= ARENA_SMALL_MAX) {
+        b->next = arena.small[size / ARENA_GRANULE];
+        arena.small[size / ARENA_GRANULE] = b;
+    } else {
+        b->next = arena.large;
+        arena.large = b;
+    }
+}
+
+static void arenaFree(void *ptr, size_t size) {
+    size = (size + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+    pthread_mutex_lock(&arena.lock);
+    arenaFreeLocked(ptr, size);
+    pthread_mutex_unlock(&arena.lock);
+}
+
+// Returns 'size' zeroed bytes from the arena, or NULL once it is exhausted
+static void *arenaCalloc(size_t size) {
+    pthread_once(&arena.once, arenaReserve);
+    size = (size + ARENA_GRANULE - 1) & ~(size_t)(ARENA_GRANULE - 1);
+
+    void *ptr = NULL;
+    pthread_mutex_lock(&arena.lock);
+    if (size <= ARENA_SMALL_MAX && arena.small[size / ARENA_GRANULE]) {
+        arenaBlock *b = arena.small[size / ARENA_GRANULE];
+        arena.small[size / ARENA_GRANULE] = b->next;
+        ptr = b;
+    } else if (size > ARENA_SMALL_MAX) {
+        for (arenaBlock **b = &arena.large; *b; b = &(*b)->next) {
+            if ((*b)->size >= size) {
+                arenaBlock *found = *b;
+                *b = found->next;
+                if (found->size > size) {
+                    arenaFreeLocked((uint8_t *)found + size,
+                                    found->size - size);
+                }
+
+                ptr = found;
+                break;
+            }
+        }
+    }
+
+    if (ptr) {
+        memset(ptr, 0, size);
+    } else if (arena.base && arena.used + size <= ARENA_RESERVE) {
+        /* Untouched pages of the reservation are already zero */
+        ptr = arena.base + arena.used;
+        arena.used += size;
+    }
+
+    pthread_mutex_unlock(&arena.lock);
+    return ptr;
+}
+
+static inline artNode *refPtr(const artRef r) {
+    if (!r) {
+        return NULL;
+    }
+
+    return (artNode *)(arena.base + ((uintptr_t)(r & ~1U) << 3) + (r & 1));
+}
+
+static inline artRef ptrRef(const void *p) {
+    if (!p) {
+        return 0;
+    }
+
+    const uintptr_t off = (uintptr_t)p - (uintptr_t)arena.base;
+    return (artRef)(off >> 3 | (off & 1));
+}
+
+#define REF_PTR(r) refPtr(r)
+#define PTR_REF(p) ptrRef(p)
+#define NODE_CALLOC(size) arenaCalloc(size)
+#define NODE_FREE(n, size) arenaFree(n, size)
+#define LEAF_CALLOC(size) arenaCalloc(size)
+#define LEAF_FREE(l, size) arenaFree(l, size)
+#else
+/**
+ * Child references are plain pointers
+ */
+#define REF_PTR(r) (r)
+#define PTR_REF(p) ((artNode *)(p))
+#define NODE_FREE(n, size) free(n)
+#define LEAF_CALLOC(size) calloc(1, size)
+#define LEAF_FREE(l, size) free(l)
+#endif
+
+/**
+ * Inserts can't back out of a half-made change, so a node or leaf that
+ * can't be allocated ends the process with a message instead of a NULL
+ * dereference deep inside the insert.
+ */
+__attribute__((noreturn, cold)) static void outOfMemory(const size_t size) {
+#if ART_COMPRESSED_POINTERS
+    fprintf(stderr, "art arena exhausted allocating %zu bytes\n", size);
+#else
+    fprintf(stderr, "art out of memory allocating %zu bytes\n", size);
+#endif
+    abort();
+}
+
+/* =================================================
+ * RCU: copy-on-write with epoch-based reclamation
+ * ================================================ */
+/* The global epoch only moves forward, starting at 1. A reader records
+ * the epoch it started in, or 0 between read sections. Memory a write
+ * unlinks is stamped with the epoch of that write and freed once every
+ * reader in a section started in a later epoch, since it loaded the root
+ * after the write published it. Reclamation runs once
+ * ART_RCU_RECLAIM_BATCH blocks are waiting. */
+#define ART_RCU_RECLAIM_BATCH 256
+
+typedef struct artRetired {
+    void *p;
+    uint64_t epoch;
+    uint32_t size;
+    bool leaf;
+} artRetired;
+
+struct artRcuReader {
+    uint64_t epoch;
+    struct artRcuReader *next;
+    struct artRcu *rcu;
+};
+
+typedef struct artRcu {
+    uint64_t epoch;
+    pthread_mutex_t lock; /* guards 'readers' */
+    artRcuReader *readers;
+    artRetired *retired;
+    size_t retiredCount;
+    size_t retiredCap;
+    size_t published; /* leading 'retired' entries of published writes */
+} artRcu;
+
+static void rcu_release(const artRetired *r) {
+    if (r->leaf) {
+        LEAF_FREE(r->p, r->size);
+    } else {
+        NODE_FREE(r->p, r->size);
+    }
+}
+
+/* Frees what was retired before 'epoch' and no reader can still see.
+ * Returns how much of that is left; later entries are kept as they are. */
+static size_t rcu_release_before(artRcu *rcu, const uint64_t epoch) {
+    uint64_t oldest = epoch;
+    pthread_mutex_lock(&rcu->lock);
+    for (artRcuReader *r = rcu->readers; r; r = r->next) {
+        const uint64_t e = __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE);
+        if (e && e < oldest) {
+            oldest = e;
+        }
+    }
+    pthread_mutex_unlock(&rcu->lock);
+
+    size_t kept = 0;
+    size_t waiting = 0;
+    for (size_t i = 0; i < rcu->retiredCount; i++) {
+        if (rcu->retired[i].epoch < oldest) {
+            rcu_release(&rcu->retired[i]);
+        } else {
+            waiting += rcu->retired[i].epoch < epoch;
+            rcu->retired[kept++] = rcu->retired[i];
+        }
+    }
+
+    rcu->retiredCount = kept;
+    return waiting;
+}
+
+static void rcu_retire(art *t, void *p, size_t size, bool leaf) {
+    artRcu *rcu = t->rcu;
+    uint64_t epoch = __atomic_load_n(&rcu->epoch, __ATOMIC_RELAXED);
+    if (rcu->retiredCount == rcu->retiredCap) {
+        const size_t cap = rcu->retiredCap ? rcu->retiredCap * 2 : 64;
+        artRetired *retired =
+            realloc(rcu->retired, cap * sizeof(*rcu->retired));
+        if (retired) {
+            rcu->retired = retired;
+            rcu->retiredCap = cap;
+        } else {
+            // Out of memory: start a new epoch and free the published
+            // writes' garbage that no reader holds. Readers starting now
+            // still see this write's, so it moves to the new epoch. This
+            // doesn't wait, as the writer may hold a read lock itself.
+            epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            for (size_t i = rcu->published; i < rcu->retiredCount; i++) {
+                rcu->retired[i].epoch = epoch;
+            }
+
+            rcu->published = rcu_release_before(rcu, epoch);
+        }
+    }
+
+    // Nothing could be freed: leak 'p' rather than free it under a reader
+    if (rcu->retiredCount == rcu->retiredCap) {
+        return;
+    }
+
+    rcu->retired[rcu->retiredCount++] = (artRetired){
+        .p = p,
+        .epoch = epoch,
+        .size = size,
+        .leaf = leaf,
+    };
+}
+
+// Frees what no reader can still see, returning how much is left
+static size_t rcu_reclaim(art *t) {
+    artRcu *rcu = t->rcu;
+
+    // Readers that start after this see the published root. The fence
+    // pairs with the one in artRcuReadLock(): either we see a reader's
+    // epoch, or it sees the root the last write published.
+    __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    rcu_release_before(rcu, UINT64_MAX);
+
+    // Only called between writes, so all that is left was published
+    rcu->published = rcu->retiredCount;
+    return rcu->retiredCount;
+}
+
+/**
+ * Switches 't' to single-writer RCU mode. Call it before any reader
+ * starts; the mode lasts until the tree is freed.
+ * @return false if the bookkeeping could not be allocated.
+ */
+bool artRcuEnable(art *t) {
+    if (t->rcu) {
+        return true;
+    }
+
+    artRcu *rcu = calloc(1, sizeof(*rcu));
+    if (!rcu) {
+        return false;
+    }
+
+    rcu->epoch = 1;
+    pthread_mutex_init(&rcu->lock, NULL);
+    t->rcu = rcu;
+    return true;
+}
+
+artRcuReader *artRcuRegister(art *t) {
+    assert(t->rcu);
+    artRcuReader *r = calloc(1, sizeof(*r));
+    if (!r) {
+        return NULL;
+    }
+
+    r->rcu = t->rcu;
+    pthread_mutex_lock(&r->rcu->lock);
+    r->next = r->rcu->readers;
+    r->rcu->readers = r;
+    pthread_mutex_unlock(&r->rcu->lock);
+    return r;
+}
+
+void artRcuUnregister(artRcuReader *r) {
+    assert(!r->epoch);
+    pthread_mutex_lock(&r->rcu->lock);
+    artRcuReader **p = &r->rcu->readers;
+    while (*p != r) {
+        p = &(*p)->next;
+    }
+    *p = r->next;
+    pthread_mutex_unlock(&r->rcu->lock);
+    free(r);
+}
+
+void artRcuReadLock(artRcuReader *r) {
+    assert(!r->epoch);
+    const uint64_t e = __atomic_load_n(&r->rcu->epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&r->epoch, e, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void artRcuReadUnlock(artRcuReader *r) {
+    __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits until every reader has left the sections that might see memory
+ * the writes so far replaced, then frees all of it. Writer side only.
+ */
+void artRcuSynchronize(art *t) {
+    if (!t->rcu) {
+        return;
+    }
+
+    while (rcu_reclaim(t)) {
+        sched_yield();
+    }
+}
+
+// Tears down RCU state once no readers are left
+static void rcu_destroy(art *t) {
+    artRcu *rcu = t->rcu;
+    assert(!rcu->readers);
+    for (size_t i = 0; i < rcu->retiredCount; i++) {
+        rcu_release(&rcu->retired[i]);
+    }
+
+    pthread_mutex_destroy(&rcu->lock);
+    free(rcu->retired);
+    free(rcu);
+    t->rcu = NULL;
+}
+
+/**
+ * Loads the root for a read. In RCU mode the writer may be publishing a
+ * new one, and the acquire makes the nodes under it visible as well.
+ */
+static inline artNode *load_root(const art *t) {
+    return REF_PTR(__atomic_load_n(&t->root, __ATOMIC_ACQUIRE));
+}
+
+/**
+ * Stores the root a write built. In RCU mode this publishes it, so it is
+ * a release store and is followed by reclaiming what readers can no
+ * longer see.
+ */
+static void publish_root(art *t, artRef root) {
+    __atomic_store_n(&t->root, root, __ATOMIC_RELEASE);
+    if (t->rcu && t->rcu->retiredCount >= ART_RCU_RECLAIM_BATCH) {
+        rcu_reclaim(t);
+    } else if (t->rcu) {
+        t->rcu->published = t->rcu->retiredCount;
+    }
+}
+
+// Allocation size of each node type, indexed by 'artType'
+static const size_t nodeSizes[] = {
+    [NODE4] = sizeof(artNode4),   [NODE16] = sizeof(artNode16),
+    [NODE32] = sizeof(artNode32), [NODE48] = sizeof(artNode48),
+    [NODE256] = sizeof(artNode256),
+};
+
+static inline void presentSet(uint64_t *present, const uint8_t c) {
+    present[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline void presentClear(uint64_t *present, const uint8_t c) {
+    present[c >> 6] &= ~(1ULL << (c & 63));
+}
+
+// The first key byte at or after 'from' with a child, or 256 if none
+static inline int presentNext(const uint64_t *present, const int from) {
+    if (from >= 256) {
+        return 256;
+    }
+
+    int word = from >> 6;
+    uint64_t bits = present[word] & (~0ULL << (from & 63));
+    while (!bits) {
+        if (++word == 4) {
+            return 256;
+        }
+
+        bits = present[word];
+    }
+
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+// The last key byte with a child, or -1 if none
+static inline int presentLast(const uint64_t *present) {
+    for (int word = 3; word >= 0; word--) {
+        if (present[word]) {
+            return word * 64 + 63 - __builtin_clzll(present[word]);
+        }
+    }
+
+    return -1;
+}
+
+// Iterates 'c' over the key bytes set in 'present', in order
+#define PRESENT_FOREACH(present, c)                                            \
+    for (int c = presentNext(present, 0); c < 256;                             \
+         c = presentNext(present, c + 1))
+
 /**
  * Allocates a node of the given type,
  * initializes to zero and sets the type.
+ * Every allocation and free is counted in 't' so artBytes() and
+ * artNodes() never have to walk the tree.
  */
-static artNode *alloc_node(artType type) {
+static artNode *alloc_node(art *t, artType type) {
     artNode *n;
     switch (type) {
     case NODE4:
-        n = (artNode *)calloc(1, sizeof(artNode4));
+        n = (artNode *)NODE_CALLOC(sizeof(artNode4));
         break;
     case NODE16:
-        n = (artNode *)calloc(1, sizeof(artNode16));
+        n = (artNode *)NODE_CALLOC(sizeof(artNode16));
+        break;
+    case NODE32:
+        n = (artNode *)NODE_CALLOC(sizeof(artNode32));
         break;
     case NODE48:
-        n = (artNode *)calloc(1, sizeof(artNode48));
+        n = (artNode *)NODE_CALLOC(sizeof(artNode48));
         break;
     case NODE256:
-        n = (artNode *)calloc(1, sizeof(artNode256));
+        n = (artNode *)NODE_CALLOC(sizeof(artNode256));
         break;
     default:
         assert(NULL && "Bad type?");
         __builtin_unreachable();
     }
 
+    if (!n) {
+        outOfMemory(nodeSizes[type]);
+    }
+
     n->type = type;
+    t->nodes++;
+    t->bytes += nodeSizes[type];
     return n;
 }
 
+// In RCU mode readers may still be inside, so the free waits for them
+static void free_node(art *t, artNode *n) {
+    t->nodes--;
+    t->bytes -= nodeSizes[n->type];
+    if (t->rcu) {
+        rcu_retire(t, n, nodeSizes[n->type], false);
+        return;
+    }
+
+    NODE_FREE(n, nodeSizes[n->type]);
+}
+
+// Zeroed leaf allocation of 'bytes', counted like alloc_node()
+static artLeaf *alloc_leaf(art *t, const size_t bytes) {
+    artLeaf *l = (artLeaf *)LEAF_CALLOC(bytes);
+    if (!l) {
+        outOfMemory(bytes);
+    }
+
+    t->bytes += bytes;
+    return l;
+}
+
+static void free_leaf(art *t, artLeaf *l) {
+    t->bytes -= LEAF_BYTES(l);
+    if (t->rcu) {
+        rcu_retire(t, l, LEAF_BYTES(l), true);
+        return;
+    }
+
+    LEAF_FREE(l, LEAF_BYTES(l));
+}
+
+/* Progress of an incremental compaction. Every key below 'resume' has
+ * been moved. Memory a step unlinks is kept until the step ends, so its
+ * new allocations are not handed the holes it is leaving behind. */
+typedef struct artCompaction {
+    uint8_t *resume;
+    uint32_t resumeLen;
+    uint32_t resumeCap;
+    uint8_t *next; /* where the running step stopped, swapped into resume */
+    uint32_t nextLen;
+    uint32_t nextCap;
+    uint64_t deadline; /* monotonic ns, or 0 for no limit */
+    uint32_t sinceCheck;
+    bool stopped;
+    artRetired *garbage;
+    size_t garbageCount;
+    size_t garbageCap;
+} artCompaction;
+
+static void compaction_discard(art *t, void *p, size_t size, bool leaf) {
+    if (t->rcu) {
+        rcu_retire(t, p, size, leaf);
+        return;
+    }
+
+    artCompaction *c = t->compaction;
+    if (c->garbageCount == c->garbageCap) {
+        const size_t cap = c->garbageCap ? c->garbageCap * 2 : 256;
+        artRetired *garbage = realloc(c->garbage, cap * sizeof(*c->garbage));
+        if (!garbage) {
+            // Free it now; the step may just reuse the hole
+            const artRetired r = {.p = p, .size = size, .leaf = leaf};
+            rcu_release(&r);
+            return;
+        }
+
+        c->garbage = garbage;
+        c->garbageCap = cap;
+    }
+
+    c->garbage[c->garbageCount++] =
+        (artRetired){.p = p, .size = size, .leaf = leaf};
+}
+
+// Like free_node() and free_leaf(), but the memory outlives the step
+static void compaction_free_node(art *t, artNode *n) {
+    t->nodes--;
+    t->bytes -= nodeSizes[n->type];
+    compaction_discard(t, n, nodeSizes[n->type], false);
+}
+
+static void compaction_free_leaf(art *t, artLeaf *l) {
+    t->bytes -= LEAF_BYTES(l);
+    compaction_discard(t, l, LEAF_BYTES(l), true);
+}
+
+static void compaction_drain(artCompaction *c) {
+    for (size_t i = 0; i < c->garbageCount; i++) {
+        rcu_release(&c->garbage[i]);
+    }
+
+    c->garbageCount = 0;
+}
+
+static void compaction_free(art *t) {
+    artCompaction *c = t->compaction;
+    if (!c) {
+        return;
+    }
+
+    compaction_drain(c);
+    free(c->garbage);
+    free(c->resume);
+    free(c->next);
+    free(c);
+    t->compaction = NULL;
+}
+
 /**
  * Initializes an ART tree
  */
 void artInit(art *t) {
-    t->root = NULL;
+    t->root = 0;
     t->count = 0;
+    t->nodes = 0;
+    t->bytes = 0;
+    t->fixedKeyLen = 0;
+    t->rcu = NULL;
+    t->compaction = NULL;
+    artMetricsReset(t);
 }
 
 art *artNew(void) {
@@ -65,55 +757,81 @@ art *artNew(void) {
     return t;
 }
 
-// Recursively destroys the tree
-static void destroy_node(artNode *n) {
+/**
+ * Initializes an ART tree where every key is 'keyLen' bytes long.
+ * Lookups and updates then skip the key length checks and compare
+ * leaves with fixed-size loads. Lookups, inserts and deletes of any
+ * other key length find nothing and change nothing.
+ */
+void artInitFixed(art *t, uint32_t keyLen) {
+    assert(keyLen);
+    artInit(t);
+    t->fixedKeyLen = keyLen;
+}
+
+art *artNewFixed(uint32_t keyLen) {
+    art *t = artNew();
+    artInitFixed(t, keyLen);
+    return t;
+}
+
+// Whether 'keyLen' fits 't'; a fixed-length tree takes just its one length
+static inline bool keyLenFits(const art *t, const uint_fast32_t keyLen) {
+    return !t->fixedKeyLen || keyLen == t->fixedKeyLen;
+}
+
+// Recursively destroys the tree, returning the number of leaves freed
+static uint64_t destroy_node(art *t, artNode *n) {
     if (!n) {
-        return;
+        return 0;
     }
 
     // Special case leafs
     if (IS_LEAF(n)) {
-        free(LEAF_RAW(n));
-        return;
+        free_leaf(t, LEAF_RAW(n));
+        return 1;
     }
 
     // Handle each node type
     union {
         artNode4 *p1;
         artNode16 *p2;
+        artNode32 *p32;
         artNode48 *p3;
         artNode256 *p4;
         void *any;
     } p = {.any = n};
+    uint64_t leaves = destroy_node(t, NODE_END(n));
 
     switch (n->type) {
     case NODE4:
         for (size_t i = 0; i < n->childrenCount; i++) {
-            destroy_node(p.p1->children[i]);
+            leaves += destroy_node(t, REF_PTR(p.p1->children[i]));
         }
 
         break;
     case NODE16:
         for (size_t i = 0; i < n->childrenCount; i++) {
-            destroy_node(p.p2->children[i]);
+            leaves += destroy_node(t, REF_PTR(p.p2->children[i]));
+        }
+
+        break;
+    case NODE32:
+        for (size_t i = 0; i < n->childrenCount; i++) {
+            leaves += destroy_node(t, REF_PTR(p.p32->children[i]));
         }
 
         break;
     case NODE48:
-        for (size_t i = 0; i < 256; i++) {
-            size_t idx = ((artNode48 *)n)->keys[i];
-            if (!idx) {
-                continue;
-            }
-            destroy_node(p.p3->children[idx - 1]);
+        PRESENT_FOREACH(p.p3->present, c) {
+            const size_t idx = p.p3->keys[c];
+            leaves += destroy_node(t, REF_PTR(p.p3->children[idx - 1]));
         }
 
         break;
     case NODE256:
-        for (size_t i = 0; i < 256; i++) {
-            if (p.p4->children[i]) {
-                destroy_node(p.p4->children[i]);
-            }
+        PRESENT_FOREACH(p.p4->present, c) {
+            leaves += destroy_node(t, REF_PTR(p.p4->children[c]));
         }
 
         break;
@@ -122,14 +840,22 @@ static void destroy_node(artNode *n) {
     }
 
     // Free ourself on the way up
-    free(n);
+    free_node(t, n);
+    return leaves;
 }
 
 /**
  * Destroys an ART tree
  */
 void artFreeInner(art *t) {
-    destroy_node(t->root);
+    compaction_free(t);
+    artRcu *rcu = t->rcu;
+    t->rcu = NULL;
+    destroy_node(t, REF_PTR(t->root));
+    if (rcu) {
+        t->rcu = rcu;
+        rcu_destroy(t);
+    }
 }
 
 void artFree(art *t) {
@@ -137,138 +863,13 @@ void artFree(art *t) {
     free(t);
 }
 
-static size_t countNodes(const artNode *n) {
-    if (!n) {
-        return 0;
-    }
-
-    // Special case leafs
-    if (IS_LEAF(n)) {
-        return 1;
-    }
-
-    // Handle each node type
-    int i, idx;
-    union {
-        const artNode4 *p1;
-        const artNode16 *p2;
-        const artNode48 *p3;
-        const artNode256 *p4;
-        const void *any;
-    } p = {.any = n};
-    size_t total = 0;
-
-    switch (n->type) {
-    case NODE4:
-        for (i = 0; i < n->childrenCount; i++) {
-            total += countNodes(p.p1->children[i]);
-        }
-
-        break;
-
-    case NODE16:
-        for (i = 0; i < n->childrenCount; i++) {
-            total += countNodes(p.p2->children[i]);
-        }
-
-        break;
-
-    case NODE48:
-        for (i = 0; i < 256; i++) {
-            idx = ((artNode48 *)n)->keys[i];
-            if (!idx) {
-                continue;
-            }
-            total += countNodes(p.p3->children[idx - 1]);
-        }
-
-        break;
-
-    case NODE256:
-        for (i = 0; i < 256; i++) {
-            if (p.p4->children[i]) {
-                total += countNodes(p.p4->children[i]);
-            }
-        }
-
-        break;
-
-    default:
-        __builtin_unreachable();
-    }
-
-    return total + 1;
-}
-
-size_t artNodes(const art *t) {
-    return countNodes(t->root);
-}
-
-static size_t countBytes(const artNode *n) {
-    if (!n) {
-        return 0;
-    }
-
-    // Special case leafs
-    if (IS_LEAF(n)) {
-        return sizeof(artLeaf) + LEAF_RAW(n)->keyLen;
-    }
-
-    // Handle each node type
-    int i, idx;
-    union {
-        const artNode4 *p1;
-        const artNode16 *p2;
-        const artNode48 *p3;
-        const artNode256 *p4;
-        const void *any;
-    } p = {.any = n};
-    size_t total = 0;
-
-    switch (n->type) {
-    case NODE4:
-        for (i = 0; i < n->childrenCount; i++) {
-            total += countBytes(p.p1->children[i]);
-        }
-
-        break;
-
-    case NODE16:
-        for (i = 0; i < n->childrenCount; i++) {
-            total += countBytes(p.p2->children[i]);
-        }
-
-        break;
-
-    case NODE48:
-        for (i = 0; i < 256; i++) {
-            idx = ((artNode48 *)n)->keys[i];
-            if (!idx) {
-                continue;
-            }
-            total += countBytes(p.p3->children[idx - 1]);
-        }
-
-        break;
-
-    case NODE256:
-        for (i = 0; i < 256; i++) {
-            if (p.p4->children[i]) {
-                total += countBytes(p.p4->children[i]);
-            }
-        }
-
-        break;
-
-    default:
-        __builtin_unreachable();
-    }
-
-    return total + sizeof(*n);
-}
+// Inner nodes plus leaves
+size_t artNodes(const art *t) {
+    return t->nodes + t->count;
+}
 
 size_t artBytes(const art *t) {
-    return countBytes(t->root);
+    return t->bytes;
 }
 
 uint64_t artCount(const art *t) {
@@ -297,13 +898,15 @@ uint64_t artCount(const art *t) {
 //
 // Note that if the keys contain NUL bytes earlier in the string this will
 // break down and won't give correct iteration search results.
+// Build with ART_BINARY_KEYS to store such keys correctly instead.
 //
 // @param key pointer to the key bytes
 // @param key_len the size of the byte, in bytes
 // @param idx the index into the key
 // @return the value of the key at the supplied index.
 #if ART_USE_IMPLICIT_KEY_NULL_TERMINIATOR_PROTECTION
-#define keyAt(key, len, idx) ((idx) == (len) ? '\0' : (key)[idx])
+#define keyAt(key, len, idx)                                                  \
+    ((uint_fast32_t)(idx) == (len) ? '\0' : (key)[idx])
 #else /* You KNOW none of your keys are full prefixes of each other. */
 #define keyAt(key, len, idx) (key)[idx]
 #endif
@@ -311,10 +914,19 @@ uint64_t artCount(const art *t) {
 // A helper for looking at the key value at given index, in a leaf
 #define leafKeyAt(leaf, idx) keyAt((leaf)->key, (leaf)->keyLen, idx)
 
-static artNode **find_child(artNode *n, uint8_t c) {
+// Internal paths pass a non-zero 'fixedLen' when every key in the tree has
+// that length. No key can then be a prefix of another, so there is never a
+// terminator to synthesize.
+#define keyAtFixed(key, len, idx, fixedLen)                                    \
+    ((fixedLen) ? (key)[idx] : keyAt(key, len, idx))
+#define leafKeyAtFixed(leaf, idx, fixedLen)                                    \
+    keyAtFixed((leaf)->key, (leaf)->keyLen, idx, fixedLen)
+
+static artRef *find_child(artNode *n, uint8_t c) {
     union {
         artNode4 *p1;
         artNode16 *p2;
+        artNode32 *p32;
         artNode48 *p3;
         artNode256 *p4;
         void *any;
@@ -364,6 +976,37 @@ static artNode **find_child(artNode *n, uint8_t c) {
         break;
     }
 
+    case NODE32: {
+#if __AVX2__
+        // Compare the key to all 32 stored keys at once
+        const __m256i cmp = _mm256_cmpeq_epi8(
+            _mm256_set1_epi8(c), _mm256_loadu_si256((__m256i *)p.p32->keys));
+        uint64_t bitfield = (uint32_t)_mm256_movemask_epi8(cmp);
+#elif __SSE__
+        // Compare the key to both halves of the stored keys
+        const __m128i key = _mm_set1_epi8(c);
+        const uint64_t lo = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            key, _mm_loadu_si128((__m128i *)p.p32->keys)));
+        const uint64_t hi = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            key, _mm_loadu_si128((__m128i *)(p.p32->keys + 16))));
+        uint64_t bitfield = lo | hi << 16;
+#else
+        uint64_t bitfield = 0;
+        for (int_fast32_t i = 0; i < 32; ++i) {
+            if (p.p32->keys[i] == c)
+                bitfield |= (1ULL << i);
+        }
+#endif
+
+        // Use a mask to ignore children that don't exist
+        bitfield &= (1ULL << n->childrenCount) - 1;
+        if (bitfield) {
+            return &p.p32->children[__builtin_ctzll(bitfield)];
+        }
+
+        break;
+    }
+
     case NODE48: {
         const int_fast32_t i = p.p3->keys[c];
         if (i) {
@@ -387,6 +1030,151 @@ static artNode **find_child(artNode *n, uint8_t c) {
     return NULL;
 }
 
+/**
+ * Returns the next child of 'n' in key order at or after position '*pos',
+ * stores its key byte in 'c', and advances '*pos' past it. A leaf in the
+ * end slot comes first, with 'c' set to END_KEY.
+ * Start iteration with '*pos' set to zero.
+ * @return pointer to the child slot, or NULL when no children remain.
+ */
+static artRef *next_child(artNode *n, int *pos, int *c) {
+    union {
+        artNode4 *p1;
+        artNode16 *p2;
+        artNode32 *p32;
+        artNode48 *p3;
+        artNode256 *p4;
+        void *any;
+    } p = {.any = n};
+
+#if ART_BINARY_KEYS
+    // Position zero is the end slot, so children sit one position later
+    if (*pos == 0) {
+        *pos = 1;
+        if (n->end) {
+            *c = END_KEY;
+            return &n->end;
+        }
+    }
+
+    int at = *pos - 1;
+#else
+    int at = *pos;
+#endif
+
+    switch (n->type) {
+    case NODE4:
+        if (at < n->childrenCount) {
+            *c = p.p1->keys[at];
+            *pos = at + 1 + ART_BINARY_KEYS;
+            return &p.p1->children[at];
+        }
+
+        break;
+
+    case NODE16:
+        if (at < n->childrenCount) {
+            *c = p.p2->keys[at];
+            *pos = at + 1 + ART_BINARY_KEYS;
+            return &p.p2->children[at];
+        }
+
+        break;
+
+    case NODE32:
+        if (at < n->childrenCount) {
+            *c = p.p32->keys[at];
+            *pos = at + 1 + ART_BINARY_KEYS;
+            return &p.p32->children[at];
+        }
+
+        break;
+
+    case NODE48:
+        at = presentNext(p.p3->present, at);
+        if (at < 256) {
+            *c = at;
+            *pos = at + 1 + ART_BINARY_KEYS;
+            return &p.p3->children[p.p3->keys[at] - 1];
+        }
+
+        break;
+
+    case NODE256:
+        at = presentNext(p.p4->present, at);
+        if (at < 256) {
+            *c = at;
+            *pos = at + 1 + ART_BINARY_KEYS;
+            return &p.p4->children[at];
+        }
+
+        break;
+
+    default:
+        __builtin_unreachable();
+    }
+
+    return NULL;
+}
+
+// Counts the leaves below a node
+static uint64_t countLeaves(artNode *n) {
+    if (!n) {
+        return 0;
+    }
+
+    if (IS_LEAF(n)) {
+        return 1;
+    }
+
+    uint64_t total = 0;
+    int pos = 0;
+    int c;
+    artRef *child;
+    while ((child = next_child(n, &pos, &c))) {
+        total += countLeaves(REF_PTR(*child));
+    }
+
+    return total;
+}
+
+/**
+ * Returns the number of leaves below 'n'.
+ * Constant time with subtree counts, otherwise a walk of the subtree.
+ */
+static uint64_t subtreeLeaves(artNode *n) {
+#if ART_SUBTREE_COUNTS
+    if (n && !IS_LEAF(n)) {
+        return n->leafCount;
+    }
+#endif
+
+    return countLeaves(n);
+}
+
+// Adds the leaves, inner nodes and bytes below a node to the totals
+static void countSubtree(artNode *n, uint64_t *leaves, uint64_t *nodes,
+                         uint64_t *bytes) {
+    if (!n) {
+        return;
+    }
+
+    if (IS_LEAF(n)) {
+        (*leaves)++;
+        *bytes += LEAF_BYTES(LEAF_RAW(n));
+        return;
+    }
+
+    (*nodes)++;
+    *bytes += nodeSizes[n->type];
+    int pos = 0;
+    int c;
+    artRef *child;
+    while ((child = next_child(n, &pos, &c))) {
+        countSubtree(REF_PTR(*child), leaves, nodes, bytes);
+    }
+}
+
 // Simple inlined if
 static inline int min(int a, int b) {
     return (a < b) ? a : b;
@@ -424,67 +1212,146 @@ static inline bool leafNodeIsExactKey(const artLeaf *restrict const n,
     return memcmp(n->key, key, keyLen) == 0;
 }
 
-/**
- * Searches for a value in the ART tree
- * @arg t The tree
- * @arg key The key
- * @arg keyLen The length of the key
- * @arg value value of key
- * @return 'true' if item found, 'false' if not found.
- *
- */
-bool artSearch(const art *t, const void *key_, const uint_fast32_t keyLen,
-               void **value) {
-    artNode **child;
-    artNode *n = t->root;
+// Leaves in a fixed length tree are all 'fixedLen' long, so skip that check
+#define leafMatches(n, key, keyLen, fixedLen)                                  \
+    ((fixedLen) ? memcmp((n)->key, key, fixedLen) == 0                         \
+                : leafNodeIsExactKey(n, key, keyLen))
+
+// With a constant 'fixedLen' the compiler drops the key length checks below
+// and turns the leaf comparison into a few wide loads. Returns the leaf
+// found, or NULL.
+static inline __attribute__((always_inline)) artLeaf *
+search(const art *t, const uint8_t *restrict key, const uint_fast32_t keyLen,
+       void **value, const uint_fast32_t fixedLen) {
+    METRIC_CLOCK(start);
+    artRef *child;
+    artNode *n = load_root(t);
     int prefixLen;
-    int depth = 0;
+    uint_fast32_t depth = 0;
+    int visited = 0;
+    artLeaf *found = NULL;
 
-    const uint8_t *restrict key = key_;
     while (n) {
         if (IS_LEAF(n)) {
             artLeaf *leaf = LEAF_RAW(n);
 
             // Check if the expanded path matches
-            if (leafNodeIsExactKey(leaf, key, keyLen)) {
+            if (leafMatches(leaf, key, keyLen, fixedLen)) {
                 if (value) {
                     *value = leaf->value.ptr;
                 }
 
-                return true;
+                found = leaf;
             }
 
-            return false;
+            break;
         }
 
+        visited++;
+
         // Bail if the prefix does not match
         if (n->partialLen) {
             prefixLen = checkPrefix(n, key, keyLen, depth);
             if (prefixLen != min(MAX_PREFIX_LEN, n->partialLen)) {
-                return NULL;
+                break;
             }
 
             depth = depth + n->partialLen;
         }
 
-        if (depth > keyLen) {
-            /* Key in tree is longer than input key.
-             * Match impossible. */
-            return NULL;
-        }
+        // Inner nodes of a fixed length tree always end before the key does
+        if (!fixedLen) {
+            if (depth > keyLen) {
+                /* Key in tree is longer than input key.
+                 * Match impossible. */
+                break;
+            }
 
-        // Don't overflow the key buffer if we go too deep
-        if (depth >= keyLen) {
-            return NULL;
+            // Don't overflow the key buffer if we go too deep
+            if (depth >= keyLen) {
+#if ART_BINARY_KEYS
+                // The key ends at this node, so only the end slot can match
+                n = NODE_END(n);
+                continue;
+#else
+                break;
+#endif
+            }
         }
 
         // Recursively search
-        child = find_child(n, keyAt(key, keyLen, depth));
-        n = (child) ? *child : NULL;
+        child = find_child(n, keyAtFixed(key, keyLen, depth, fixedLen));
+        n = (child) ? REF_PTR(*child) : NULL;
         depth++;
     }
 
-    return NULL;
+    METRIC_INC(t, searchDepth[min(visited, ART_STATS_MAX_DEPTH - 1)]);
+    METRIC_LATENCY(t, searchNs, start);
+    (void)visited; /* only read by the metrics */
+    return found;
+}
+
+static artLeaf *searchFixed(const art *t, const uint8_t *key,
+                            void **value) {
+    switch (t->fixedKeyLen) {
+    case 8:
+        return search(t, key, 8, value, 8);
+    case 16:
+        return search(t, key, 16, value, 16);
+    default:
+        return search(t, key, t->fixedKeyLen, value, t->fixedKeyLen);
+    }
+}
+
+/**
+ * Searches for a value in the ART tree
+ * @arg t The tree
+ * @arg key The key
+ * @arg keyLen The length of the key
+ * @arg value value of key
+ * @return 'true' if item found, 'false' if not found.
+ *
+ */
+bool artSearch(const art *t, const void *key, const uint_fast32_t keyLen,
+               void **value) {
+    return artSearchLeaf(t, key, keyLen, value);
+}
+
+/**
+ * Finds the inline value of 'key' stored by artInsertBlob().
+ * @arg value Set to the stored bytes, which stay valid until 'key' is
+ * written again or deleted.
+ * @arg valueLen Set to their length.
+ * @return 'true' if item found, 'false' if not found.
+ */
+bool artSearchBlob(const art *t, const void *key, const uint_fast32_t keyLen,
+                   const void **value, uint32_t *valueLen) {
+    const artLeaf *l = artSearchLeaf(t, key, keyLen, NULL);
+    if (!l) {
+        return false;
+    }
+
+    if (value) {
+        *value = l->value.ptr;
+    }
+
+    if (valueLen) {
+        *valueLen = l->valueLen;
+    }
+
+    return true;
+}
+
+/**
+ * Searches like artSearch() but returns the leaf holding 'key', or NULL.
+ */
+artLeaf *artSearchLeaf(const art *t, const void *key,
+                       const uint_fast32_t keyLen, void **value) {
+    if (t->fixedKeyLen) {
+        return keyLen == t->fixedKeyLen ? searchFixed(t, key, value) : NULL;
+    }
+
+    return search(t, key, keyLen, value, 0);
 }
 
 // Find the minimum leaf under a node
@@ -498,27 +1365,26 @@ static artLeaf *minimum(const artNode *n) {
         return LEAF_RAW(n);
     }
 
+    // A key ending at this node sorts before all of its children
+    if (NODE_END(n)) {
+        return LEAF_RAW(NODE_END(n));
+    }
+
     int idx;
     switch (n->type) {
     case NODE4:
-        return minimum(((const artNode4 *)n)->children[0]);
+        return minimum(REF_PTR(((const artNode4 *)n)->children[0]));
     case NODE16:
-        return minimum(((const artNode16 *)n)->children[0]);
+        return minimum(REF_PTR(((const artNode16 *)n)->children[0]));
+    case NODE32:
+        return minimum(REF_PTR(((const artNode32 *)n)->children[0]));
     case NODE48:
-        idx = 0;
-        while (!((const artNode48 *)n)->keys[idx]) {
-            idx++;
-        }
-
+        idx = presentNext(((const artNode48 *)n)->present, 0);
         idx = ((const artNode48 *)n)->keys[idx] - 1;
-        return minimum(((const artNode48 *)n)->children[idx]);
+        return minimum(REF_PTR(((const artNode48 *)n)->children[idx]));
     case NODE256:
-        idx = 0;
-        while (!((const artNode256 *)n)->children[idx]) {
-            idx++;
-        }
-
-        return minimum(((const artNode256 *)n)->children[idx]);
+        idx = presentNext(((const artNode256 *)n)->present, 0);
+        return minimum(REF_PTR(((const artNode256 *)n)->children[idx]));
     default:
         __builtin_unreachable();
     }
@@ -538,24 +1404,21 @@ static artLeaf *maximum(const artNode *n) {
     int idx;
     switch (n->type) {
     case NODE4:
-        return maximum(((artNode4 *)n)->children[n->childrenCount - 1]);
+        return maximum(
+            REF_PTR(((artNode4 *)n)->children[n->childrenCount - 1]));
     case NODE16:
-        return maximum(((artNode16 *)n)->children[n->childrenCount - 1]);
+        return maximum(
+            REF_PTR(((artNode16 *)n)->children[n->childrenCount - 1]));
+    case NODE32:
+        return maximum(
+            REF_PTR(((artNode32 *)n)->children[n->childrenCount - 1]));
     case NODE48:
-        idx = 255;
-        while (!((const artNode48 *)n)->keys[idx]) {
-            idx--;
-        }
-
+        idx = presentLast(((const artNode48 *)n)->present);
         idx = ((const artNode48 *)n)->keys[idx] - 1;
-        return maximum(((const artNode48 *)n)->children[idx]);
+        return maximum(REF_PTR(((const artNode48 *)n)->children[idx]));
     case NODE256:
-        idx = 255;
-        while (!((const artNode256 *)n)->children[idx]) {
-            idx--;
-        }
-
-        return maximum(((const artNode256 *)n)->children[idx]);
+        idx = presentLast(((const artNode256 *)n)->present);
+        return maximum(REF_PTR(((const artNode256 *)n)->children[idx]));
     default:
         __builtin_unreachable();
     }
@@ -565,14 +1428,14 @@ static artLeaf *maximum(const artNode *n) {
  * Returns the minimum valued leaf
  */
 artLeaf *artMinimum(art *t) {
-    return minimum((artNode *)t->root);
+    return minimum(load_root(t));
 }
 
 /**
  * Returns the maximum valued leaf
  */
 artLeaf *artMaximum(art *t) {
-    return maximum((artNode *)t->root);
+    return maximum(load_root(t));
 }
 
 void *artLeafValue(artLeaf *l) {
@@ -588,23 +1451,144 @@ void *artLeafKeyOnly(artLeaf *l) {
     return l->key;
 }
 
-static artLeaf *make_leaf(const void *key, const uint_fast32_t keyLen,
-                          const artValue *value) {
-    artLeaf *l = (artLeaf *)calloc(1, sizeof(artLeaf) + keyLen);
-    l->value = *value;
-    l->keyLen = keyLen;
-    memcpy(l->key, key, keyLen);
-    return l;
+void **artLeafValueSlot(artLeaf *l) {
+    return &l->value.ptr;
 }
 
-static int longest_commonPrefix(artLeaf *l1, artLeaf *l2, int depth) {
-    int max_cmp = min(l1->keyLen, l2->keyLen) - depth;
-    int idx;
-    for (idx = 0; idx < max_cmp; idx++) {
-        if (l1->key[depth + idx] != l2->key[depth + idx]) {
-            return idx;
-        }
-    }
+/* recursive_insert() mode of artInsertBlob(): 'value->ptr' is an artBlob
+ * whose bytes are stored inline in the leaf. */
+#define ART_INSERT_BLOB ((artIncrementDesc)(ART_INCREMENT_B + 1))
+
+typedef struct artBlob {
+    const void *bytes;
+    uint32_t len;
+} artBlob;
+
+/* recursive_insert() mode of artUpsert(): 'value->ptr' is an artUpsertCall
+ * whose callback decides at the leaf what happens to the key. */
+#define ART_INSERT_UPSERT ((artIncrementDesc)(ART_INCREMENT_B + 2))
+
+typedef struct artUpsertCall {
+    artUpsertFn fn;
+    void *ctx;
+    void *value; /* what the callback built for a missing key */
+    artUpsertOp op;
+    bool decided;     /* 'op' for a missing key was asked up front */
+    artLeaf *removed; /* the key's leaf, once ART_UPSERT_DELETE unlinked it */
+} artUpsertCall;
+
+/**
+ * Asks an upsert callback whether to create the missing key, keeping what
+ * it built for make_leaf(). Other modes always create.
+ */
+static bool creates_leaf(const artValue *value, const artIncrementDesc desc) {
+    if (desc != ART_INSERT_UPSERT) {
+        return true;
+    }
+
+    artUpsertCall *call = value->ptr;
+    if (!call->decided) {
+        call->value = NULL;
+        call->op = call->fn(call->ctx, &call->value, false);
+    }
+
+    return call->op == ART_UPSERT_STORE;
+}
+
+// Whether an upsert below has just unlinked the leaf of its key
+static bool upsert_removed(const artValue *value,
+                           const artIncrementDesc desc) {
+    return desc == ART_INSERT_UPSERT &&
+           ((const artUpsertCall *)value->ptr)->removed;
+}
+
+// What an empty inline value points at, as it has no bytes in the leaf
+static const uint8_t emptyBlob[1];
+
+// Copies 'blob' into 'l', which must be sized for it
+static void set_blob(artLeaf *l, const artBlob *blob) {
+    l->valueLen = blob->len;
+    l->value.ptr = blob->len ? LEAF_BLOB(l) : (void *)emptyBlob;
+    memcpy(LEAF_BLOB(l), blob->bytes, blob->len);
+}
+
+static artLeaf *make_leaf(art *t, const void *key, const uint_fast32_t keyLen,
+                          const artValue *value, const artIncrementDesc desc) {
+    const artBlob *blob = desc == ART_INSERT_BLOB ? value->ptr : NULL;
+    const size_t bytes = leafBytes(keyLen, blob ? blob->len : 0);
+    artLeaf *l = alloc_leaf(t, bytes);
+    l->keyLen = keyLen;
+    memcpy(l->key, key, keyLen);
+    if (blob) {
+        set_blob(l, blob);
+    } else if (desc == ART_INSERT_UPSERT) {
+        l->value.ptr = ((const artUpsertCall *)value->ptr)->value;
+    } else if (value) {
+        l->value = *value;
+    }
+
+    return l;
+}
+
+/**
+ * Returns 'n' ready to be modified. In RCU mode readers may be inside it,
+ * so a private copy takes its place and the original is retired; the
+ * caller links the copy into its (already private) parent.
+ */
+static artNode *writable_node(art *t, artNode *n) {
+    if (!t->rcu || IS_LEAF(n)) {
+        return n;
+    }
+
+    artNode *copy = alloc_node(t, n->type);
+    memcpy(copy, n, nodeSizes[n->type]);
+    free_node(t, n);
+    return copy;
+}
+
+// A fresh allocation of 'l', pointing at its own copy of an inline blob
+static artLeaf *copy_leaf(art *t, const artLeaf *l) {
+    const size_t bytes = LEAF_BYTES(l);
+    artLeaf *copy = alloc_leaf(t, bytes);
+    memcpy(copy, l, bytes);
+    if (l->valueLen) {
+        copy->value.ptr = LEAF_BLOB(copy);
+    }
+
+    return copy;
+}
+
+/**
+ * Returns 'l' moved to an allocation without room for its inline value,
+ * which a plain write has just replaced. The old leaf is released.
+ */
+static artLeaf *drop_blob(art *t, artLeaf *l) {
+    const size_t bytes = leafBytes(l->keyLen, 0);
+    artLeaf *plain = alloc_leaf(t, bytes);
+    memcpy(plain, l, bytes);
+    plain->valueLen = 0;
+    free_leaf(t, l);
+    return plain;
+}
+
+static artLeaf *writable_leaf(art *t, artLeaf *l) {
+    if (!t->rcu) {
+        return l;
+    }
+
+    artLeaf *copy = copy_leaf(t, l);
+    free_leaf(t, l);
+    return copy;
+}
+
+static int longest_commonPrefix(artLeaf *l1, artLeaf *l2, int depth) {
+    int max_cmp = min(l1->keyLen, l2->keyLen) - depth;
+    int idx;
+    for (idx = 0; idx < max_cmp; idx++) {
+        if (l1->key[depth + idx] != l2->key[depth + idx]) {
+            return idx;
+        }
+    }
 
     return idx;
 }
@@ -613,49 +1597,123 @@ static void copy_header(artNode *restrict dest, artNode *restrict src) {
     dest->childrenCount = src->childrenCount;
     dest->partialLen = src->partialLen;
     memcpy(dest->partial, src->partial, min(MAX_PREFIX_LEN, src->partialLen));
+    LEAF_COUNT_SET(dest, src->leafCount);
+    NODE_END_SET(dest, NODE_END(src));
 }
 
-static void add_child256(artNode256 *n, artNode **ref, uint8_t c, void *child) {
+static void add_child256(art *t, artNode256 *n, artRef *ref, uint8_t c,
+                         void *child) {
+    (void)t;
     (void)ref;
     n->n.childrenCount++;
-    n->children[c] = (artNode *)child;
+    n->children[c] = PTR_REF(child);
+    presentSet(n->present, c);
 }
 
-static void add_child48(artNode48 *n, artNode **ref, uint8_t c, void *child) {
+static void add_child48(art *t, artNode48 *n, artRef *ref, uint8_t c,
+                        void *child) {
     if (n->n.childrenCount < 48) {
         int pos = 0;
         while (n->children[pos]) {
             pos++;
         }
 
-        n->children[pos] = (artNode *)child;
+        n->children[pos] = PTR_REF(child);
         n->keys[c] = pos + 1;
+        presentSet(n->present, c);
         n->n.childrenCount++;
     } else {
-        artNode256 *new_node = (artNode256 *)alloc_node(NODE256);
-        for (int i = 0; i < 256; i++) {
-            if (n->keys[i]) {
-                new_node->children[i] = n->children[n->keys[i] - 1];
-            }
+        METRIC_INC(t, grows[NODE48]);
+        artNode256 *new_node = (artNode256 *)alloc_node(t, NODE256);
+        PRESENT_FOREACH(n->present, i) {
+            new_node->children[i] = n->children[n->keys[i] - 1];
         }
 
+        memcpy(new_node->present, n->present, sizeof(n->present));
+
         copy_header((artNode *)new_node, (artNode *)n);
-        *ref = (artNode *)new_node;
+        *ref = PTR_REF(new_node);
+
+        free_node(t, (artNode *)n);
+
+        add_child256(t, new_node, ref, c, child);
+    }
+}
+
+static void add_child32(art *t, artNode32 *n, artRef *ref, uint8_t c,
+                        void *child) {
+    if (n->n.childrenCount < 32) {
+        const uint64_t mask = (1ULL << n->n.childrenCount) - 1;
+
+#if __SSE__
+        // Find the keys greater than 'c' in both halves of the stored keys
+        // (SSE2 only compares signed bytes, so flip the sign bits first
+        //  to get unsigned ordering)
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128i key = _mm_xor_si128(_mm_set1_epi8(c), bias);
+        const uint64_t lo = _mm_movemask_epi8(_mm_cmplt_epi8(
+            key, _mm_xor_si128(_mm_loadu_si128((__m128i *)n->keys), bias)));
+        const uint64_t hi = _mm_movemask_epi8(_mm_cmplt_epi8(
+            key,
+            _mm_xor_si128(_mm_loadu_si128((__m128i *)(n->keys + 16)), bias)));
+        const uint64_t bitfield = (lo | hi << 16) & mask;
+#else
+        uint64_t bitfield = 0;
+        for (short i = 0; i < 32; ++i) {
+            if (c < n->keys[i])
+                bitfield |= (1ULL << i);
+        }
+
+        bitfield &= mask;
+#endif
+
+        // Check if less than any
+        uint_fast32_t idx;
+        if (bitfield) {
+            idx = __builtin_ctzll(bitfield);
+            memmove(n->keys + idx + 1, n->keys + idx, n->n.childrenCount - idx);
+            memmove(n->children + idx + 1, n->children + idx,
+                    (n->n.childrenCount - idx) * sizeof(artRef));
+        } else {
+            idx = n->n.childrenCount;
+        }
+
+        // Set the child
+        n->keys[idx] = c;
+        n->children[idx] = PTR_REF(child);
+        n->n.childrenCount++;
+    } else {
+        METRIC_INC(t, grows[NODE32]);
+        artNode48 *new_node = (artNode48 *)alloc_node(t, NODE48);
 
-        free(n);
+        // Copy the child pointers and populate the key map
+        memcpy(new_node->children, n->children,
+               sizeof(artRef) * n->n.childrenCount);
+        for (int_fast32_t i = 0; i < n->n.childrenCount; i++) {
+            new_node->keys[n->keys[i]] = i + 1;
+            presentSet(new_node->present, n->keys[i]);
+        }
 
-        add_child256(new_node, ref, c, child);
+        copy_header((artNode *)new_node, (artNode *)n);
+        *ref = PTR_REF(new_node);
+        free_node(t, (artNode *)n);
+        add_child48(t, new_node, ref, c, child);
     }
 }
 
-static void add_child16(artNode16 *n, artNode **ref, uint8_t c, void *child) {
+static void add_child16(art *t, artNode16 *n, artRef *ref, uint8_t c,
+                        void *child) {
     if (n->n.childrenCount < 16) {
         const uint_fast32_t mask = (1 << n->n.childrenCount) - 1;
 
 #if __SSE__
         // Compare the key to all 16 stored keys
-        const __m128i cmp = _mm_cmplt_epi8(_mm_set1_epi8(c),
-                                           _mm_loadu_si128((__m128i *)n->keys));
+        // (SSE2 only compares signed bytes, so flip the sign bits first
+        //  to get unsigned ordering)
+        const __m128i bias = _mm_set1_epi8((char)0x80);
+        const __m128i cmp = _mm_cmplt_epi8(
+            _mm_xor_si128(_mm_set1_epi8(c), bias),
+            _mm_xor_si128(_mm_loadu_si128((__m128i *)n->keys), bias));
 
         // Use a mask to ignore children that don't exist
         const uint_fast32_t bitfield = _mm_movemask_epi8(cmp) & mask;
@@ -677,33 +1735,32 @@ static void add_child16(artNode16 *n, artNode **ref, uint8_t c, void *child) {
             idx = __builtin_ctz(bitfield);
             memmove(n->keys + idx + 1, n->keys + idx, n->n.childrenCount - idx);
             memmove(n->children + idx + 1, n->children + idx,
-                    (n->n.childrenCount - idx) * sizeof(void *));
+                    (n->n.childrenCount - idx) * sizeof(artRef));
         } else {
             idx = n->n.childrenCount;
         }
 
         // Set the child
         n->keys[idx] = c;
-        n->children[idx] = (artNode *)child;
+        n->children[idx] = PTR_REF(child);
         n->n.childrenCount++;
     } else {
-        artNode48 *new_node = (artNode48 *)alloc_node(NODE48);
+        METRIC_INC(t, grows[NODE16]);
+        artNode32 *new_node = (artNode32 *)alloc_node(t, NODE32);
 
-        // Copy the child pointers and populate the key map
+        // Copy the child pointers and the key map
         memcpy(new_node->children, n->children,
-               sizeof(void *) * n->n.childrenCount);
-        for (int_fast32_t i = 0; i < n->n.childrenCount; i++) {
-            new_node->keys[n->keys[i]] = i + 1;
-        }
-
+               sizeof(artRef) * n->n.childrenCount);
+        memcpy(new_node->keys, n->keys, sizeof(uint8_t) * n->n.childrenCount);
         copy_header((artNode *)new_node, (artNode *)n);
-        *ref = (artNode *)new_node;
-        free(n);
-        add_child48(new_node, ref, c, child);
+        *ref = PTR_REF(new_node);
+        free_node(t, (artNode *)n);
+        add_child32(t, new_node, ref, c, child);
     }
 }
 
-static void add_child4(artNode4 *n, artNode **ref, uint8_t c, void *child) {
+static void add_child4(art *t, artNode4 *n, artRef *ref, uint8_t c,
+                       void *child) {
     if (n->n.childrenCount < 4) {
         int idx;
         for (idx = 0; idx < n->n.childrenCount; idx++) {
@@ -715,39 +1772,43 @@ static void add_child4(artNode4 *n, artNode **ref, uint8_t c, void *child) {
         // Shift to make room
         memmove(n->keys + idx + 1, n->keys + idx, n->n.childrenCount - idx);
         memmove(n->children + idx + 1, n->children + idx,
-                (n->n.childrenCount - idx) * sizeof(void *));
+                (n->n.childrenCount - idx) * sizeof(artRef));
 
         // Insert element
         n->keys[idx] = c;
-        n->children[idx] = (artNode *)child;
+        n->children[idx] = PTR_REF(child);
         n->n.childrenCount++;
     } else {
-        artNode16 *new_node = (artNode16 *)alloc_node(NODE16);
+        METRIC_INC(t, grows[NODE4]);
+        artNode16 *new_node = (artNode16 *)alloc_node(t, NODE16);
 
         // Copy the child pointers and the key map
         memcpy(new_node->children, n->children,
-               sizeof(void *) * n->n.childrenCount);
+               sizeof(artRef) * n->n.childrenCount);
         memcpy(new_node->keys, n->keys, sizeof(uint8_t) * n->n.childrenCount);
         copy_header((artNode *)new_node, (artNode *)n);
-        *ref = (artNode *)new_node;
-        free(n);
-        add_child16(new_node, ref, c, child);
+        *ref = PTR_REF(new_node);
+        free_node(t, (artNode *)n);
+        add_child16(t, new_node, ref, c, child);
     }
 }
 
-static void add_child(artNode *n, artNode **ref, uint8_t c, void *child) {
+static void add_child(art *t, artNode *n, artRef *ref, uint8_t c, void *child) {
     switch (n->type) {
     case NODE4:
-        add_child4((artNode4 *)n, ref, c, child);
+        add_child4(t, (artNode4 *)n, ref, c, child);
         break;
     case NODE16:
-        add_child16((artNode16 *)n, ref, c, child);
+        add_child16(t, (artNode16 *)n, ref, c, child);
+        break;
+    case NODE32:
+        add_child32(t, (artNode32 *)n, ref, c, child);
         break;
     case NODE48:
-        add_child48((artNode48 *)n, ref, c, child);
+        add_child48(t, (artNode48 *)n, ref, c, child);
         break;
     case NODE256:
-        add_child256((artNode256 *)n, ref, c, child);
+        add_child256(t, (artNode256 *)n, ref, c, child);
         break;
     default:
         __builtin_unreachable();
@@ -757,9 +1818,18 @@ static void add_child(artNode *n, artNode **ref, uint8_t c, void *child) {
 /**
  * Calculates the index at which the prefixes mismatch
  */
-static size_t prefix_mismatch(const artNode *n, const void *key_,
-                              const uint_fast32_t keyLen, int depth) {
-    int max_cmp = min(min(MAX_PREFIX_LEN, n->partialLen), keyLen - depth);
+static size_t prefix_mismatch(const art *t, const artNode *n,
+                              const void *key_, const uint_fast32_t keyLen,
+                              const uint_fast32_t depth) {
+#if !ART_METRICS
+    (void)t;
+#endif
+    const uint_fast32_t rest = keyLen > depth ? keyLen - depth : 0;
+    size_t max_cmp = min(MAX_PREFIX_LEN, n->partialLen);
+    if (max_cmp > rest) {
+        max_cmp = rest;
+    }
+
     size_t idx;
     const uint8_t *restrict key = key_;
     for (idx = 0; idx < max_cmp; idx++) {
@@ -771,8 +1841,10 @@ static size_t prefix_mismatch(const artNode *n, const void *key_,
     // If the prefix is short we can avoid finding a leaf
     if (n->partialLen > MAX_PREFIX_LEN) {
         // Prefix is longer than what we've checked, find a leaf
+        METRIC_INC(t, leafFallbacks);
         artLeaf *l = minimum(n);
-        max_cmp = min(l->keyLen, keyLen) - depth;
+        const uint_fast32_t common = l->keyLen < keyLen ? l->keyLen : keyLen;
+        max_cmp = common > depth ? common - depth : 0;
         for (; idx < max_cmp; idx++) {
             if (l->key[idx + depth] != key[depth + idx]) {
                 return idx;
@@ -783,21 +1855,224 @@ static size_t prefix_mismatch(const artNode *n, const void *key_,
     return idx;
 }
 
-static void *recursive_insert(artNode *restrict const n, artNode **ref,
+/**
+ * Returns 'child' ready to replace its single-child parent 'n', where 'c' is
+ * the key byte 'child' was stored under. Inner nodes absorb the parent's
+ * prefix and key byte into their own prefix. 'n' itself is not modified.
+ */
+static artNode *collapse_child(const artNode *n, uint8_t c, artNode *child) {
+    if (IS_LEAF(child)) {
+        return child;
+    }
+
+    // Concatenate the prefixes
+    uint8_t partial[MAX_PREFIX_LEN];
+    int prefix = min(n->partialLen, MAX_PREFIX_LEN);
+    memcpy(partial, n->partial, prefix);
+    if (prefix < MAX_PREFIX_LEN) {
+        partial[prefix] = c;
+        prefix++;
+    }
+
+    if (prefix < MAX_PREFIX_LEN) {
+        const int subPrefix = min(child->partialLen, MAX_PREFIX_LEN - prefix);
+        memcpy(partial + prefix, child->partial, subPrefix);
+        prefix += subPrefix;
+    }
+
+    // Store the prefix in the child
+    memcpy(child->partial, partial, prefix);
+    child->partialLen += n->partialLen + 1;
+    return child;
+}
+
+static void remove_child256(art *t, artNode256 *n, artRef *ref, uint8_t c) {
+    n->children[c] = 0;
+    presentClear(n->present, c);
+    n->n.childrenCount--;
+
+    // Resize to a node48 on underflow, not immediately to prevent
+    // trashing if we sit on the 48/49 boundary
+    if (n->n.childrenCount == 37) {
+        METRIC_INC(t, shrinks[NODE256]);
+        artNode48 *new_node = (artNode48 *)alloc_node(t, NODE48);
+        *ref = PTR_REF(new_node);
+        copy_header((artNode *)new_node, (artNode *)n);
+
+        int pos = 0;
+        PRESENT_FOREACH(n->present, i) {
+            new_node->children[pos] = n->children[i];
+            new_node->keys[i] = pos + 1;
+            pos++;
+        }
+
+        memcpy(new_node->present, n->present, sizeof(n->present));
+
+        free_node(t, (artNode *)n);
+    }
+}
+
+static void remove_child48(art *t, artNode48 *n, artRef *ref, uint8_t c) {
+    int pos = n->keys[c];
+    n->keys[c] = 0;
+    n->children[pos - 1] = 0;
+    presentClear(n->present, c);
+    n->n.childrenCount--;
+
+    if (n->n.childrenCount == 24) {
+        METRIC_INC(t, shrinks[NODE48]);
+        artNode32 *new_node = (artNode32 *)alloc_node(t, NODE32);
+        *ref = PTR_REF(new_node);
+        copy_header((artNode *)new_node, (artNode *)n);
+
+        int child = 0;
+        PRESENT_FOREACH(n->present, i) {
+            new_node->keys[child] = i;
+            new_node->children[child] = n->children[n->keys[i] - 1];
+            child++;
+        }
+
+        free_node(t, (artNode *)n);
+    }
+}
+
+static void remove_child32(art *t, artNode32 *n, artRef *ref, artRef *l) {
+    int pos = l - n->children;
+    memmove(n->keys + pos, n->keys + pos + 1, n->n.childrenCount - 1 - pos);
+    memmove(n->children + pos, n->children + pos + 1,
+            (n->n.childrenCount - 1 - pos) * sizeof(artRef));
+    n->n.childrenCount--;
+
+    if (n->n.childrenCount == 12) {
+        METRIC_INC(t, shrinks[NODE32]);
+        artNode16 *new_node = (artNode16 *)alloc_node(t, NODE16);
+        *ref = PTR_REF(new_node);
+        copy_header((artNode *)new_node, (artNode *)n);
+        memcpy(new_node->keys, n->keys, 12);
+        memcpy(new_node->children, n->children, 12 * sizeof(artRef));
+        free_node(t, (artNode *)n);
+    }
+}
+
+static void remove_child16(art *t, artNode16 *n, artRef *ref, artRef *l) {
+    int pos = l - n->children;
+    memmove(n->keys + pos, n->keys + pos + 1, n->n.childrenCount - 1 - pos);
+    memmove(n->children + pos, n->children + pos + 1,
+            (n->n.childrenCount - 1 - pos) * sizeof(artRef));
+    n->n.childrenCount--;
+
+    if (n->n.childrenCount == 3) {
+        METRIC_INC(t, shrinks[NODE16]);
+        artNode4 *new_node = (artNode4 *)alloc_node(t, NODE4);
+        *ref = PTR_REF(new_node);
+        copy_header((artNode *)new_node, (artNode *)n);
+        memcpy(new_node->keys, n->keys, 4);
+        memcpy(new_node->children, n->children, 4 * sizeof(artRef));
+        free_node(t, (artNode *)n);
+    }
+}
+
+static void remove_child4(art *t, artNode4 *n, artRef *ref, artRef *l) {
+    int pos = l - n->children;
+    memmove(n->keys + pos, n->keys + pos + 1, n->n.childrenCount - 1 - pos);
+    memmove(n->children + pos, n->children + pos + 1,
+            (n->n.childrenCount - 1 - pos) * sizeof(artRef));
+    n->n.childrenCount--;
+
+    // Remove nodes with only a single child
+    if (n->n.childrenCount == 1 && !NODE_END(&n->n)) {
+        METRIC_INC(t, shrinks[NODE4]);
+        artNode *only = writable_node(t, REF_PTR(n->children[0]));
+        *ref = PTR_REF(collapse_child(&n->n, n->keys[0], only));
+        free_node(t, (artNode *)n);
+        return;
+    }
+
+#if ART_BINARY_KEYS
+    // Only the end slot is left, so its leaf replaces us
+    if (n->n.childrenCount == 0) {
+        METRIC_INC(t, shrinks[NODE4]);
+        *ref = n->n.end;
+        free_node(t, (artNode *)n);
+    }
+#endif
+}
+
+static void remove_child(art *t, artNode *n, artRef *ref, uint8_t c,
+                         artRef *l) {
+    switch (n->type) {
+    case NODE4:
+        remove_child4(t, (artNode4 *)n, ref, l);
+        break;
+    case NODE16:
+        remove_child16(t, (artNode16 *)n, ref, l);
+        break;
+    case NODE32:
+        remove_child32(t, (artNode32 *)n, ref, l);
+        break;
+    case NODE48:
+        remove_child48(t, (artNode48 *)n, ref, c);
+        break;
+    case NODE256:
+        remove_child256(t, (artNode256 *)n, ref, c);
+        break;
+    default:
+        __builtin_unreachable();
+    }
+}
+
+#if ART_BINARY_KEYS
+// Once the end slot of 'n' is emptied, a node4 left with a single child
+// collapses into it
+static void end_removed(art *t, artNode *n, artRef *ref) {
+    if (n->type == NODE4 && n->childrenCount == 1) {
+        METRIC_INC(t, shrinks[NODE4]);
+        artNode4 *n4 = (artNode4 *)n;
+        artNode *only = writable_node(t, REF_PTR(n4->children[0]));
+        *ref = PTR_REF(collapse_child(n, n4->keys[0], only));
+        free_node(t, n);
+    }
+}
+#endif
+
+/**
+ * Adds leaf 'l' to the new node 'n' whose children branch at key index
+ * 'depth'. With binary keys a leaf ending at 'depth' takes the end slot.
+ */
+static void add_leaf4(art *t, artNode4 *n, artRef *ref, artLeaf *l, int depth,
+                      const uint_fast32_t fixedLen) {
+#if ART_BINARY_KEYS
+    if (l->keyLen == (uint32_t)depth) {
+        NODE_END_SET(&n->n, SET_LEAF(l));
+        return;
+    }
+#endif
+
+    add_child4(t, n, ref, leafKeyAtFixed(l, depth, fixedLen), SET_LEAF(l));
+}
+
+static void *recursive_insert(art *t, artNode *restrict n, artRef *ref,
                               const void *key_, const uint_fast32_t keyLen,
                               const artValue *const value, int depth,
                               bool *restrict const replaced,
-                              const artIncrementDesc desc, artLeaf **usedLeaf) {
+                              const artIncrementDesc desc, artLeaf **usedLeaf,
+                              const uint_fast32_t fixedLen) {
     const uint8_t *restrict key = key_;
 
     // If we are at a NULL node, inject a leaf
     if (!n) {
-        artLeaf *restrict const l = make_leaf(key, keyLen, value);
+        // A declined upsert counts as 'replaced' so no leaf count changes
+        if (!creates_leaf(value, desc)) {
+            *replaced = true;
+            return NULL;
+        }
+
+        artLeaf *restrict const l = make_leaf(t, key, keyLen, value, desc);
         if (usedLeaf) {
             *usedLeaf = l;
         }
 
-        *ref = (artNode *)SET_LEAF(l);
+        *ref = PTR_REF(SET_LEAF(l));
         return NULL;
     }
 
@@ -809,123 +2084,231 @@ static void *recursive_insert(artNode *restrict const n, artNode **ref,
         }
 
         // Check if we are updating an existing value
-        if (leafNodeIsExactKey(l, key, keyLen)) {
+        if (leafMatches(l, key, keyLen, fixedLen)) {
             *replaced = true;
+            if (t->rcu) {
+                l = writable_leaf(t, l);
+                *ref = PTR_REF(SET_LEAF(l));
+                if (usedLeaf) {
+                    *usedLeaf = l;
+                }
+            }
             void *const old_val = l->value.ptr;
 
-            switch (desc) {
-            case ART_INCREMENT_WHOLE:
-                l->value.u++;
-                break;
-            case ART_INCREMENT_A:
-                l->value.su.a++;
-                break;
-            case ART_INCREMENT_B:
-                l->value.su.b++;
-                break;
-            default:
-                l->value = *value;
+            if (desc == ART_INSERT_BLOB) {
+                // Only an inline value of the same size class has room
+                const artBlob *blob = value->ptr;
+                if (leafBytes(l->keyLen, blob->len) == LEAF_BYTES(l)) {
+                    set_blob(l, blob);
+                    return NULL;
+                }
+
+                // Another size class takes a new leaf
+                artLeaf *resized = make_leaf(t, key, keyLen, value, desc);
+                *ref = PTR_REF(SET_LEAF(resized));
+                if (usedLeaf) {
+                    *usedLeaf = resized;
+                }
+
+                free_leaf(t, l);
+                return NULL;
+            }
+
+            if (desc == ART_INSERT_UPSERT) {
+                artUpsertCall *call = value->ptr;
+                call->op = call->fn(call->ctx, &l->value.ptr, true);
+
+                // Unlinked here; the parent removes the slot on the way up
+                if (call->op == ART_UPSERT_DELETE) {
+                    call->removed = l;
+                    *ref = 0;
+                    return old_val;
+                }
+            } else {
+                switch (desc) {
+                case ART_INCREMENT_WHOLE:
+                    l->value.u++;
+                    break;
+                case ART_INCREMENT_A:
+                    l->value.su.a++;
+                    break;
+                case ART_INCREMENT_B:
+                    l->value.su.b++;
+                    break;
+                default:
+                    // No value keeps the existing one, see artInsertLeaf()
+                    if (value) {
+                        l->value = *value;
+                    }
+                }
+            }
+
+            // A plain value written over an inline one takes its place
+            if (l->valueLen && l->value.ptr != LEAF_BLOB(l)) {
+                l = drop_blob(t, l);
+                *ref = PTR_REF(SET_LEAF(l));
+                if (usedLeaf) {
+                    *usedLeaf = l;
+                }
             }
 
             return old_val;
         }
 
+        if (!creates_leaf(value, desc)) {
+            *replaced = true;
+            return NULL;
+        }
+
         // New value, we must split the leaf into a node4
-        artNode4 *new_node = (artNode4 *)alloc_node(NODE4);
+        artNode4 *new_node = (artNode4 *)alloc_node(t, NODE4);
 
         // Create a new leaf
-        artLeaf *l2 = make_leaf(key, keyLen, value);
+        artLeaf *l2 = make_leaf(t, key, keyLen, value, desc);
+        if (usedLeaf) {
+            *usedLeaf = l2;
+        }
 
         // Determine longest prefix
         int longestPrefix = longest_commonPrefix(l, l2, depth);
         new_node->n.partialLen = longestPrefix;
         memcpy(new_node->n.partial, key + depth,
                min(MAX_PREFIX_LEN, longestPrefix));
+        LEAF_COUNT_SET(&new_node->n, 2);
 
         // Add the leafs to the new node4
-        *ref = (artNode *)new_node;
-        add_child4(new_node, ref, leafKeyAt(l, depth + longestPrefix),
-                   SET_LEAF(l));
-        add_child4(new_node, ref, leafKeyAt(l2, depth + longestPrefix),
-                   SET_LEAF(l2));
+        *ref = PTR_REF(new_node);
+        add_leaf4(t, new_node, ref, l, depth + longestPrefix, fixedLen);
+        add_leaf4(t, new_node, ref, l2, depth + longestPrefix, fixedLen);
         return NULL;
     }
 
+    // Everything below modifies 'n' or a descendant
+    if (t->rcu) {
+        n = writable_node(t, n);
+        *ref = PTR_REF(n);
+    }
+
     // Check if given node has a prefix
     if (n->partialLen) {
         // Determine if the prefixes differ, since we need to split
-        int prefix_diff = prefix_mismatch(n, key, keyLen, depth);
+        int prefix_diff = prefix_mismatch(t, n, key, keyLen, depth);
         if ((uint32_t)prefix_diff >= n->partialLen) {
             depth += n->partialLen;
             goto RECURSE_SEARCH;
         }
 
+        if (!creates_leaf(value, desc)) {
+            *replaced = true;
+            return NULL;
+        }
+
         // Create a new node
-        artNode4 *new_node = (artNode4 *)alloc_node(NODE4);
-        *ref = (artNode *)new_node;
+        METRIC_INC(t, prefixSplits);
+        artNode4 *new_node = (artNode4 *)alloc_node(t, NODE4);
+        *ref = PTR_REF(new_node);
         new_node->n.partialLen = prefix_diff;
         memcpy(new_node->n.partial, n->partial,
                min(MAX_PREFIX_LEN, prefix_diff));
+        LEAF_COUNT_SET(&new_node->n, n->leafCount + 1);
 
         // Adjust the prefix of the old node
         if (n->partialLen <= MAX_PREFIX_LEN) {
-            add_child4(new_node, ref, n->partial[prefix_diff], n);
+            add_child4(t, new_node, ref, n->partial[prefix_diff], n);
             n->partialLen -= (prefix_diff + 1);
             memmove(n->partial, n->partial + prefix_diff + 1,
                     min(MAX_PREFIX_LEN, n->partialLen));
         } else {
             n->partialLen -= (prefix_diff + 1);
             artLeaf *l = minimum(n);
-            add_child4(new_node, ref, leafKeyAt(l, depth + prefix_diff), n);
+            add_child4(t, new_node, ref,
+                       leafKeyAtFixed(l, depth + prefix_diff, fixedLen), n);
             memcpy(n->partial, l->key + depth + prefix_diff + 1,
                    min(MAX_PREFIX_LEN, n->partialLen));
         }
 
         // Insert the new leaf
-        artLeaf *l = make_leaf(key, keyLen, value);
+        artLeaf *l = make_leaf(t, key, keyLen, value, desc);
         if (usedLeaf) {
             *usedLeaf = l;
         }
 
-        add_child4(new_node, ref, leafKeyAt(l, depth + prefix_diff),
-                   SET_LEAF(l));
+        add_leaf4(t, new_node, ref, l, depth + prefix_diff, fixedLen);
         return NULL;
     }
 
 RECURSE_SEARCH:;
+#if ART_BINARY_KEYS
+    // The key ends at this node, so it lives in the end slot
+    if ((uint_fast32_t)depth == keyLen) {
+        void *const old = recursive_insert(t, NODE_END(n), &n->end, key, keyLen,
+                                           value, depth, replaced, desc,
+                                           usedLeaf, fixedLen);
+        if (upsert_removed(value, desc)) {
+            LEAF_COUNT_ADD(n, -1);
+            end_removed(t, n, ref);
+        } else if (!*replaced) {
+            LEAF_COUNT_ADD(n, 1);
+        }
+
+        return old;
+    }
+#endif
+
     // Find a child to recurse to
-    artNode **child = find_child(n, keyAt(key, keyLen, depth));
+    const uint8_t c = keyAtFixed(key, keyLen, depth, fixedLen);
+    artRef *child = find_child(n, c);
     if (child) {
-        return recursive_insert(*child, child, key, keyLen, value, depth + 1,
-                                replaced, desc, usedLeaf);
+        void *const old = recursive_insert(t, REF_PTR(*child), child, key,
+                                           keyLen, value, depth + 1, replaced,
+                                           desc, usedLeaf, fixedLen);
+        if (upsert_removed(value, desc)) {
+            LEAF_COUNT_ADD(n, -1);
+
+            // Only our own slot can have been the leaf itself
+            if (!*child) {
+                remove_child(t, n, ref, c, child);
+            }
+        } else if (!*replaced) {
+            LEAF_COUNT_ADD(n, 1);
+        }
+
+        return old;
     }
 
     // No child, node goes within us
-    artLeaf *l = make_leaf(key, keyLen, value);
+    if (!creates_leaf(value, desc)) {
+        *replaced = true;
+        return NULL;
+    }
+
+    artLeaf *l = make_leaf(t, key, keyLen, value, desc);
     if (usedLeaf) {
         *usedLeaf = l;
     }
 
-    add_child(n, ref, leafKeyAt(l, depth), SET_LEAF(l));
+    LEAF_COUNT_ADD(n, 1);
+
+    add_child(t, n, ref, leafKeyAtFixed(l, depth, fixedLen), SET_LEAF(l));
     return NULL;
 }
 
-/**
- * Inserts a new value into the ART tree
- * @arg t The tree
- * @arg key The key
- * @arg keyLen The length of the key
- * @arg value Opaque value.
- * @return 'true' if key is new; 'false' if key is replaced.
- */
-bool artInsert(art *restrict const t, const void *restrict const key,
-               const uint_fast32_t keyLen, void *restrict const value_,
-               void **oldValue) {
-    bool replaced = false;
-    const artValue value = {.ptr = value_};
+static bool insertValue(art *restrict const t, const void *restrict const key,
+                        const uint_fast32_t keyLen, void *restrict const value_,
+                        void **oldValue, const uint_fast32_t fixedLen) {
+    if (!keyLenFits(t, keyLen)) {
+        return false;
+    }
+
+    METRIC_CLOCK(start);
+    bool replaced = false;
+    const artValue value = {.ptr = value_};
+    artRef root = t->root;
     void *const old =
-        recursive_insert(t->root, &t->root, key, keyLen, &value, 0, &replaced,
-                         ART_INCREMENT_REPLACE, NULL);
+        recursive_insert(t, REF_PTR(root), &root, key, keyLen, &value, 0,
+                         &replaced, ART_INCREMENT_REPLACE, NULL, fixedLen);
+    publish_root(t, root);
+    METRIC_LATENCY(t, insertNs, start);
 
     if (!replaced) {
         t->count++;
@@ -939,6 +2322,291 @@ bool artInsert(art *restrict const t, const void *restrict const key,
     return false;
 }
 
+/**
+ * Inserts a new value into the ART tree
+ * @arg t The tree
+ * @arg key The key
+ * @arg keyLen The length of the key
+ * @arg value Opaque value.
+ * @return 'true' if key is new; 'false' if key is replaced.
+ */
+bool artInsert(art *restrict const t, const void *restrict const key,
+               const uint_fast32_t keyLen, void *restrict const value_,
+               void **oldValue) {
+    return insertValue(t, key, keyLen, value_, oldValue, t->fixedKeyLen);
+}
+
+/**
+ * Finds the leaf for 'key', inserting one with a zero value if there is
+ * none, so callers can build the value in place through
+ * artLeafValueSlot().
+ * @arg inserted Set to 'true' if the leaf is new.
+ * @return The leaf holding 'key'.
+ */
+artLeaf *artInsertLeaf(art *t, const void *key, const uint_fast32_t keyLen,
+                       bool *inserted) {
+    if (!keyLenFits(t, keyLen)) {
+        return NULL;
+    }
+
+    METRIC_CLOCK(start);
+    bool replaced = false;
+    artLeaf *l = NULL;
+    artRef root = t->root;
+    recursive_insert(t, REF_PTR(root), &root, key, keyLen, NULL, 0, &replaced,
+                     ART_INCREMENT_REPLACE, &l, t->fixedKeyLen);
+    publish_root(t, root);
+    METRIC_LATENCY(t, insertNs, start);
+
+    if (!replaced) {
+        t->count++;
+    }
+
+    *inserted = !replaced;
+    return l;
+}
+
+/**
+ * Stores 'valueLen' bytes of 'value' inline in the leaf of 'key', right
+ * after the key, replacing any previous value. A value that rounds to the
+ * same leaf size as the one before it is overwritten in place; otherwise
+ * the leaf is reallocated.
+ * @return 'true' if key is new; 'false' if its value is replaced.
+ */
+bool artInsertBlob(art *t, const void *key, const uint_fast32_t keyLen,
+                   const void *value, const uint32_t valueLen) {
+    if (!keyLenFits(t, keyLen)) {
+        return false;
+    }
+
+    METRIC_CLOCK(start);
+    bool replaced = false;
+    const artBlob blob = {.bytes = value, .len = valueLen};
+    const artValue v = {.ptr = (void *)&blob};
+    artRef root = t->root;
+    recursive_insert(t, REF_PTR(root), &root, key, keyLen, &v, 0, &replaced,
+                     ART_INSERT_BLOB, NULL, t->fixedKeyLen);
+    publish_root(t, root);
+    METRIC_LATENCY(t, insertNs, start);
+
+    if (!replaced) {
+        t->count++;
+    }
+
+    return !replaced;
+}
+
+/**
+ * Reads, creates, changes or deletes 'key' in one descent. 'fn' runs once:
+ * - for an existing key with 'found' set and 'value' pointing at its value
+ *   slot, which it may change in place;
+ * - for a missing key with 'found' clear and 'value' pointing at a NULL
+ *   value, which it may fill before returning ART_UPSERT_STORE to add it.
+ * ART_UPSERT_DELETE unlinks an existing key on the way back up.
+ * @return What 'fn' returned.
+ */
+artUpsertOp artUpsert(art *t, const void *key, const uint_fast32_t keyLen,
+                      artUpsertFn fn, void *ctx) {
+    if (!keyLenFits(t, keyLen)) {
+        return ART_UPSERT_KEEP;
+    }
+
+    METRIC_CLOCK(start);
+    bool replaced = false;
+    artUpsertCall call = {.fn = fn, .ctx = ctx, .op = ART_UPSERT_KEEP};
+
+    // RCU writes copy every node they pass, so a missing key is asked about
+    // before descending and a declined one leaves the tree untouched
+    if (t->rcu && !artSearchLeaf(t, key, keyLen, NULL)) {
+        call.op = fn(ctx, &call.value, false);
+        call.decided = true;
+        if (call.op != ART_UPSERT_STORE) {
+            return call.op;
+        }
+    }
+
+    const artValue v = {.ptr = &call};
+    artRef root = t->root;
+    recursive_insert(t, REF_PTR(root), &root, key, keyLen, &v, 0, &replaced,
+                     ART_INSERT_UPSERT, NULL, t->fixedKeyLen);
+    if (root != t->root) {
+        publish_root(t, root);
+    }
+    METRIC_LATENCY(t, insertNs, start);
+
+    if (call.removed) {
+        t->count--;
+        free_leaf(t, call.removed);
+    } else if (!replaced) {
+        t->count++;
+    }
+
+    return call.op;
+}
+
+// Adds one lane of at most 32 bits, wrapping or clamping to [lo, hi]
+static int64_t addLane(const int64_t v, const int64_t delta, const int64_t lo,
+                       const int64_t hi, const bool saturate) {
+    const int64_t sum = v + delta;
+    if (sum >= lo && sum <= hi) {
+        return sum;
+    }
+
+    if (saturate) {
+        return sum < lo ? lo : hi;
+    }
+
+    return lo + ((sum - lo) & (hi - lo));
+}
+
+static artValue addValue(artValue v, const artValue delta,
+                         const uint32_t mode) {
+    const bool saturate = mode & ART_ADD_SATURATE;
+    switch (mode & ART_ADD_LANES) {
+    case ART_ADD_I64:
+        if (__builtin_add_overflow(v.i, delta.i, &v.i) && saturate) {
+            v.i = delta.i < 0 ? INT64_MIN : INT64_MAX;
+        }
+        break;
+    case ART_ADD_I32X2:
+        v.si.a = addLane(v.si.a, delta.si.a, INT32_MIN, INT32_MAX, saturate);
+        v.si.b = addLane(v.si.b, delta.si.b, INT32_MIN, INT32_MAX, saturate);
+        break;
+    case ART_ADD_I16X4:
+        for (int i = 0; i < 4; i++) {
+            v.i16[i] =
+                addLane(v.i16[i], delta.i16[i], INT16_MIN, INT16_MAX, saturate);
+        }
+        break;
+    default:
+        assert(NULL && "Unknown lane layout?");
+        __builtin_unreachable();
+    }
+
+    return v;
+}
+
+// One key of an artAddBatch(), with its position in the caller's arrays
+typedef struct artAddEntry {
+    const uint8_t *key;
+    uint32_t keyLen;
+    size_t idx;
+} artAddEntry;
+
+/* The deltas one upsert applies in order: 'deltas[0]' alone, or the
+ * deltas of every entry in 'group' when it is set. */
+typedef struct artAddCall {
+    const artValue *deltas;
+    const artAddEntry *group;
+    size_t count;
+    uint32_t mode;
+} artAddCall;
+
+static artUpsertOp addCb(void *ctx, void **value, bool found) {
+    const artAddCall *add = ctx;
+    artValue v = {.ptr = *value};
+    for (size_t i = 0; i < add->count; i++) {
+        const size_t idx = add->group ? add->group[i].idx : i;
+        v = addValue(v, add->deltas[idx], add->mode);
+    }
+    *value = v.ptr;
+
+    if (!v.u && (add->mode & ART_ADD_DELETE_ZERO)) {
+        return found ? ART_UPSERT_DELETE : ART_UPSERT_KEEP;
+    }
+
+    return ART_UPSERT_STORE;
+}
+
+/**
+ * Adds 'delta' to the value of 'key', lane by lane as 'mode' says. A
+ * missing key starts at zero.
+ * @arg mode An artAddMode lane layout, OR'd with ART_ADD_SATURATE and
+ * ART_ADD_DELETE_ZERO as needed.
+ * @return 'true' if the key holds a value afterwards, 'false' if the sum
+ * was zero and ART_ADD_DELETE_ZERO removed or never created it.
+ */
+bool artAdd(art *t, const void *key, const uint_fast32_t keyLen,
+            const artValue delta, const uint32_t mode) {
+    artAddCall add = {.deltas = &delta, .count = 1, .mode = mode};
+    return artUpsert(t, key, keyLen, addCb, &add) == ART_UPSERT_STORE;
+}
+
+/**
+ * Compares two keys in tree order (bytewise, shorter key first on a tie).
+ * @return negative, zero, or positive like memcmp().
+ */
+static int keyCompare(const uint8_t *a, uint_fast32_t aLen, const uint8_t *b,
+                      uint_fast32_t bLen) {
+    const int cmp = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (cmp) {
+        return cmp;
+    }
+
+    return (aLen > bLen) - (aLen < bLen);
+}
+
+// Orders entries by key, then by position so repeats keep theirs
+static int compareAddEntries(const void *a_, const void *b_) {
+    const artAddEntry *a = a_;
+    const artAddEntry *b = b_;
+    const int cmp = keyCompare(a->key, a->keyLen, b->key, b->keyLen);
+    if (cmp) {
+        return cmp;
+    }
+
+    return (a->idx > b->idx) - (a->idx < b->idx);
+}
+
+/**
+ * artAdd() over 'count' keys, adding 'deltas[i]' to 'keys[i]'. The keys
+ * are sorted first, so neighbouring descents share their upper nodes, and
+ * each distinct key is descended once with all its deltas applied in the
+ * order given. That ends in the same values as one artAdd() per key, even
+ * with ART_ADD_SATURATE or ART_ADD_DELETE_ZERO.
+ * @return The number of distinct keys that hold a value afterwards.
+ */
+size_t artAddBatch(art *t, const void *const *keys, const uint32_t *keyLens,
+                   const artValue *deltas, const size_t count,
+                   const uint32_t mode) {
+    artAddEntry *entries = malloc(count * sizeof(*entries));
+    if (!entries) {
+        // Without room to sort, fall back to one descent per key
+        size_t present = 0;
+        for (size_t i = 0; i < count; i++) {
+            present += artAdd(t, keys[i], keyLens[i], deltas[i], mode);
+        }
+
+        return present;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        entries[i] =
+            (artAddEntry){.key = keys[i], .keyLen = keyLens[i], .idx = i};
+    }
+    qsort(entries, count, sizeof(*entries), compareAddEntries);
+
+    size_t present = 0;
+    for (size_t i = 0, next; i < count; i = next) {
+        next = i + 1;
+        while (next < count &&
+               !keyCompare(entries[i].key, entries[i].keyLen,
+                           entries[next].key, entries[next].keyLen)) {
+            next++;
+        }
+
+        artAddCall add = {.deltas = deltas,
+                          .group = &entries[i],
+                          .count = next - i,
+                          .mode = mode};
+        present += artUpsert(t, entries[i].key, entries[i].keyLen, addCb,
+                             &add) == ART_UPSERT_STORE;
+    }
+
+    free(entries);
+    return present;
+}
+
 void artLeafIncrement(artLeaf *l) {
     l->value.u++;
 }
@@ -966,8 +2634,21 @@ bool artInsertIncrement(art *const t, const void *const key,
         __builtin_unreachable();
     }
 
-    recursive_insert(t->root, &t->root, key, keyLen, &initialValU, 0, &replaced,
-                     desc, usedLeaf);
+    // A key of the wrong length is never stored, so no leaf is used
+    if (!keyLenFits(t, keyLen)) {
+        if (usedLeaf) {
+            *usedLeaf = NULL;
+        }
+
+        return false;
+    }
+
+    METRIC_CLOCK(start);
+    artRef root = t->root;
+    recursive_insert(t, REF_PTR(root), &root, key, keyLen, &initialValU, 0,
+                     &replaced, desc, usedLeaf, t->fixedKeyLen);
+    publish_root(t, root);
+    METRIC_LATENCY(t, insertNs, start);
 
     if (!replaced) {
         t->count++;
@@ -980,129 +2661,61 @@ bool artInsertIncrement(art *const t, const void *const key,
     return true;
 }
 
-static void remove_child256(artNode256 *n, artNode **ref, uint8_t c) {
-    n->children[c] = NULL;
-    n->n.childrenCount--;
-
-    // Resize to a node48 on underflow, not immediately to prevent
-    // trashing if we sit on the 48/49 boundary
-    if (n->n.childrenCount == 37) {
-        artNode48 *new_node = (artNode48 *)alloc_node(NODE48);
-        *ref = (artNode *)new_node;
-        copy_header((artNode *)new_node, (artNode *)n);
-
-        int pos = 0;
-        for (int i = 0; i < 256; i++) {
-            if (n->children[i]) {
-                new_node->children[pos] = n->children[i];
-                new_node->keys[i] = pos + 1;
-                pos++;
-            }
+/**
+ * Drops one reference of the matching leaf '*l' at '*ref' as 'desc' says.
+ * Returns 'true' once none are left and the leaf must be unlinked;
+ * otherwise the count is decremented, in a copy of the leaf in RCU mode.
+ */
+static bool leaf_released(art *t, artLeaf **l, artRef *ref,
+                          const artIncrementDesc desc) {
+    artValue *v = &(*l)->value;
+    switch (desc) {
+    case ART_INCREMENT_WHOLE:
+        if (v->u == 1) {
+            return true;
         }
-
-        free(n);
-    }
-}
-
-static void remove_child48(artNode48 *n, artNode **ref, uint8_t c) {
-    int pos = n->keys[c];
-    n->keys[c] = 0;
-    n->children[pos - 1] = NULL;
-    n->n.childrenCount--;
-
-    if (n->n.childrenCount == 12) {
-        artNode16 *new_node = (artNode16 *)alloc_node(NODE16);
-        *ref = (artNode *)new_node;
-        copy_header((artNode *)new_node, (artNode *)n);
-
-        int child = 0;
-        for (int i = 0; i < 256; i++) {
-            pos = n->keys[i];
-            if (pos) {
-                new_node->keys[child] = i;
-                new_node->children[child] = n->children[pos - 1];
-                child++;
-            }
+        break;
+    case ART_INCREMENT_A:
+        if (v->su.a == 1) {
+            return true;
         }
-
-        free(n);
-    }
-}
-
-static void remove_child16(artNode16 *n, artNode **ref, artNode **l) {
-    int pos = l - n->children;
-    memmove(n->keys + pos, n->keys + pos + 1, n->n.childrenCount - 1 - pos);
-    memmove(n->children + pos, n->children + pos + 1,
-            (n->n.childrenCount - 1 - pos) * sizeof(void *));
-    n->n.childrenCount--;
-
-    if (n->n.childrenCount == 3) {
-        artNode4 *new_node = (artNode4 *)alloc_node(NODE4);
-        *ref = (artNode *)new_node;
-        copy_header((artNode *)new_node, (artNode *)n);
-        memcpy(new_node->keys, n->keys, 4);
-        memcpy(new_node->children, n->children, 4 * sizeof(void *));
-        free(n);
-    }
-}
-
-static void remove_child4(artNode4 *n, artNode **ref, artNode **l) {
-    int pos = l - n->children;
-    memmove(n->keys + pos, n->keys + pos + 1, n->n.childrenCount - 1 - pos);
-    memmove(n->children + pos, n->children + pos + 1,
-            (n->n.childrenCount - 1 - pos) * sizeof(void *));
-    n->n.childrenCount--;
-
-    // Remove nodes with only a single child
-    if (n->n.childrenCount == 1) {
-        artNode *child = n->children[0];
-        if (!IS_LEAF(child)) {
-            // Concatenate the prefixes
-            int prefix = n->n.partialLen;
-            if (prefix < MAX_PREFIX_LEN) {
-                n->n.partial[prefix] = n->keys[0];
-                prefix++;
-            }
-
-            if (prefix < MAX_PREFIX_LEN) {
-                const int subPrefix =
-                    min(child->partialLen, MAX_PREFIX_LEN - prefix);
-                memcpy(n->n.partial + prefix, child->partial, subPrefix);
-                prefix += subPrefix;
-            }
-
-            // Store the prefix in the child
-            memcpy(child->partial, n->n.partial, min(prefix, MAX_PREFIX_LEN));
-            child->partialLen += n->n.partialLen + 1;
+        break;
+    case ART_INCREMENT_B:
+        if (v->su.b == 1) {
+            return true;
         }
-
-        *ref = child;
-        free(n);
+        break;
+    case ART_INCREMENT_REPLACE:
+        /* Default "delete means delete" action. */
+        return true;
+    default:
+        assert(NULL && "Unknown action?");
+        __builtin_unreachable();
     }
-}
 
-static void remove_child(artNode *n, artNode **ref, uint8_t c, artNode **l) {
-    switch (n->type) {
-    case NODE4:
-        remove_child4((artNode4 *)n, ref, l);
-        break;
-    case NODE16:
-        remove_child16((artNode16 *)n, ref, l);
-        break;
-    case NODE48:
-        remove_child48((artNode48 *)n, ref, c);
+    /* We have more refcounts to delete later */
+    *l = writable_leaf(t, *l);
+    *ref = PTR_REF(SET_LEAF(*l));
+    v = &(*l)->value;
+    switch (desc) {
+    case ART_INCREMENT_WHOLE:
+        v->u--;
         break;
-    case NODE256:
-        remove_child256((artNode256 *)n, ref, c);
+    case ART_INCREMENT_A:
+        v->su.a--;
         break;
     default:
-        __builtin_unreachable();
+        v->su.b--;
+        break;
     }
+
+    return false;
 }
 
-static artLeaf *recursive_delete(artNode *restrict const n, artNode **ref,
+static artLeaf *recursive_delete(art *t, artNode *restrict n, artRef *ref,
                                  const void *key_, const uint_fast32_t keyLen,
-                                 int depth, const artIncrementDesc desc) {
+                                 int depth, const artIncrementDesc desc,
+                                 const uint_fast32_t fixedLen) {
     // Search terminated
     if (!n) {
         return NULL;
@@ -1113,53 +2726,21 @@ static artLeaf *recursive_delete(artNode *restrict const n, artNode **ref,
     // Handle hitting a leaf node
     if (IS_LEAF(n)) {
         artLeaf *l = LEAF_RAW(n);
-        if (leafNodeIsExactKey(l, key, keyLen)) {
-            switch (desc) {
-            case ART_INCREMENT_WHOLE:
-                /* If we were the last refcount, the key is now deleted */
-                if (l->value.u == 1) {
-                    *ref = NULL;
-                } else {
-                    /* else, we have more refcounts to delete later */
-                    l->value.u--;
-                    return NULL;
-                }
-                break;
-            case ART_INCREMENT_A:
-                /* If we were the last refcount, the key is now deleted */
-                if (l->value.su.a == 1) {
-                    *ref = NULL;
-                } else {
-                    /* else, we have more refcounts to delete later */
-                    l->value.su.a--;
-                    return NULL;
-                }
-                break;
-            case ART_INCREMENT_B:
-                /* If we were the last refcount, the key is now deleted */
-                if (l->value.su.b == 1) {
-                    *ref = NULL;
-                } else {
-                    /* else, we have more refcounts to delete later */
-                    l->value.su.b--;
-                    return NULL;
-                }
-                break;
-            case ART_INCREMENT_REPLACE:
-                /* Default "delete means delete" action. */
-                *ref = NULL;
-                break;
-            default:
-                assert(NULL && "Unknown action?");
-                __builtin_unreachable();
-            }
-
+        if (leafMatches(l, key, keyLen, fixedLen) &&
+            leaf_released(t, &l, ref, desc)) {
+            *ref = 0;
             return l;
         }
 
         return NULL;
     }
 
+    // In RCU mode the key is known to be present, so 'n' will change
+    if (t->rcu) {
+        n = writable_node(t, n);
+        *ref = PTR_REF(n);
+    }
+
     // Bail if the prefix does not match
     if (n->partialLen) {
         int prefixLen = checkPrefix(n, key, keyLen, depth);
@@ -1170,17 +2751,38 @@ static artLeaf *recursive_delete(artNode *restrict const n, artNode **ref,
         depth = depth + n->partialLen;
     }
 
+#if ART_BINARY_KEYS
+    // The key ends at this node, so only the end slot can hold it
+    if ((uint_fast32_t)depth >= keyLen) {
+        if ((uint_fast32_t)depth > keyLen || !n->end) {
+            return NULL;
+        }
+
+        artLeaf *l = recursive_delete(t, NODE_END(n), &n->end, key, keyLen,
+                                      depth, desc, fixedLen);
+        if (l) {
+            LEAF_COUNT_ADD(n, -1);
+            end_removed(t, n, ref);
+        }
+
+        return l;
+    }
+#endif
+
     // Find child node
-    artNode **child = find_child(n, keyAt(key, keyLen, depth));
+    artRef *child = find_child(n, keyAtFixed(key, keyLen, depth, fixedLen));
     if (!child) {
         return NULL;
     }
 
     // If the child is leaf, delete from this node
     if (IS_LEAF(*child)) {
-        artLeaf *l = LEAF_RAW(*child);
-        if (leafNodeIsExactKey(l, key, keyLen)) {
-            remove_child(n, ref, keyAt(key, keyLen, depth), child);
+        artLeaf *l = LEAF_RAW(REF_PTR(*child));
+        if (leafMatches(l, key, keyLen, fixedLen) &&
+            leaf_released(t, &l, child, desc)) {
+            LEAF_COUNT_ADD(n, -1);
+            remove_child(t, n, ref, keyAtFixed(key, keyLen, depth, fixedLen),
+                         child);
             return l;
         }
 
@@ -1188,20 +2790,32 @@ static artLeaf *recursive_delete(artNode *restrict const n, artNode **ref,
     }
 
     // Recurse
-    return recursive_delete(*child, child, key, keyLen, depth + 1, desc);
+    artLeaf *l = recursive_delete(t, REF_PTR(*child), child, key, keyLen,
+                                  depth + 1, desc, fixedLen);
+    if (l) {
+        LEAF_COUNT_ADD(n, -1);
+    }
+
+    return l;
 }
 
-/**
- * Deletes a value from the ART tree
- * @arg t The tree
- * @arg key The key
- * @arg keyLen The length of the key
- * @return NULL if the item was not found, otherwise return value pointer.
- */
-bool artDelete(art *t, const void *restrict const key,
-               const uint_fast32_t keyLen, void **value) {
-    artLeaf *l = recursive_delete(t->root, &t->root, key, keyLen, 0,
-                                  ART_INCREMENT_REPLACE);
+static bool deleteValue(art *t, const void *restrict const key,
+                        const uint_fast32_t keyLen, void **value,
+                        const uint_fast32_t fixedLen) {
+    if (!keyLenFits(t, keyLen)) {
+        return false;
+    }
+
+    // RCU writes copy every node they pass, so misses must not write
+    if (t->rcu && !artSearch(t, key, keyLen, NULL)) {
+        return false;
+    }
+
+    METRIC_CLOCK(start);
+    artRef root = t->root;
+    artLeaf *l = recursive_delete(t, REF_PTR(root), &root, key, keyLen, 0,
+                                  ART_INCREMENT_REPLACE, fixedLen);
+    METRIC_LATENCY(t, deleteNs, start);
     if (l) {
         t->count--;
 
@@ -1209,20 +2823,44 @@ bool artDelete(art *t, const void *restrict const key,
             *value = l->value.ptr;
         }
 
-        free(l);
-
-        return true;
+        free_leaf(t, l);
     }
 
-    return false;
+    publish_root(t, root);
+    return l != NULL;
+}
+
+/**
+ * Deletes a value from the ART tree
+ * @arg t The tree
+ * @arg key The key
+ * @arg keyLen The length of the key
+ * @return NULL if the item was not found, otherwise return value pointer.
+ */
+bool artDelete(art *t, const void *restrict const key,
+               const uint_fast32_t keyLen, void **value) {
+    return deleteValue(t, key, keyLen, value, t->fixedKeyLen);
 }
 
 bool artDeleteDecrement(art *t, const void *key, uint_fast32_t keyLen,
                         const artIncrementDesc desc) {
-    artLeaf *l = recursive_delete(t->root, &t->root, key, keyLen, 0, desc);
+    if (!keyLenFits(t, keyLen)) {
+        return false;
+    }
+
+    if (t->rcu && !artSearch(t, key, keyLen, NULL)) {
+        return false;
+    }
+
+    METRIC_CLOCK(start);
+    artRef root = t->root;
+    artLeaf *l = recursive_delete(t, REF_PTR(root), &root, key, keyLen, 0,
+                                  desc, t->fixedKeyLen);
+    METRIC_LATENCY(t, deleteNs, start);
+    publish_root(t, root);
     if (l) {
         t->count--;
-        free(l);
+        free_leaf(t, l);
 
         /* Return 'true' meaning key was actually deleted */
         return true;
@@ -1244,11 +2882,17 @@ static int recursive_iter(artNode *n, artCallback cb, void *data) {
         return cb(data, l->key, l->keyLen, l->value.ptr);
     }
 
-    int res;
-    switch (n->type) {
+    // A key ending at this node sorts before all of its children
+    int res = recursive_iter(NODE_END(n), cb, data);
+    if (res) {
+        return res;
+    }
+
+    switch (n->type) {
     case NODE4:
         for (int i = 0; i < n->childrenCount; i++) {
-            res = recursive_iter(((artNode4 *)n)->children[i], cb, data);
+            res = recursive_iter(REF_PTR(((artNode4 *)n)->children[i]), cb,
+                                 data);
             if (res) {
                 return res;
             }
@@ -1257,21 +2901,29 @@ static int recursive_iter(artNode *n, artCallback cb, void *data) {
         break;
     case NODE16:
         for (int i = 0; i < n->childrenCount; i++) {
-            res = recursive_iter(((artNode16 *)n)->children[i], cb, data);
+            res = recursive_iter(REF_PTR(((artNode16 *)n)->children[i]), cb,
+                                 data);
             if (res) {
                 return res;
             }
         }
 
         break;
-    case NODE48:
-        for (int i = 0; i < 256; i++) {
-            const uint_fast8_t idx = ((artNode48 *)n)->keys[i];
-            if (!idx) {
-                continue;
+    case NODE32:
+        for (int i = 0; i < n->childrenCount; i++) {
+            res = recursive_iter(REF_PTR(((artNode32 *)n)->children[i]), cb,
+                                 data);
+            if (res) {
+                return res;
             }
+        }
 
-            res = recursive_iter(((artNode48 *)n)->children[idx - 1], cb, data);
+        break;
+    case NODE48:
+        PRESENT_FOREACH(((artNode48 *)n)->present, i) {
+            const uint_fast8_t idx = ((artNode48 *)n)->keys[i];
+            res = recursive_iter(
+                REF_PTR(((artNode48 *)n)->children[idx - 1]), cb, data);
             if (res) {
                 return res;
             }
@@ -1279,18 +2931,9 @@ static int recursive_iter(artNode *n, artCallback cb, void *data) {
 
         break;
     case NODE256:
-        for (int i = 0; i < 256; i++) {
-            /* The child nodes are not populated from low to high, so it's
-             * possible to have a few dozen NULL nodes at the beginning then
-             * catch populated entries towards the end.
-             * The iterated node counts here do not respect n->childrenCount
-             * and can exceed the count by design. */
-
-            if (!((artNode256 *)n)->children[i]) {
-                continue;
-            }
-
-            res = recursive_iter(((artNode256 *)n)->children[i], cb, data);
+        PRESENT_FOREACH(((artNode256 *)n)->present, i) {
+            res = recursive_iter(REF_PTR(((artNode256 *)n)->children[i]), cb,
+                                 data);
             if (res) {
                 return res;
             }
@@ -1315,7 +2958,7 @@ static int recursive_iter(artNode *n, artCallback cb, void *data) {
  * @return 0 on success, or the return of the callback.
  */
 int artIter(art *t, artCallback cb, void *data) {
-    return recursive_iter(t->root, cb, data);
+    return recursive_iter(load_root(t), cb, data);
 }
 
 /**
@@ -1334,64 +2977,53 @@ static bool leafPrefix_matches(const artLeaf *n, const void *prefix,
 }
 
 /**
- * Iterates through the entries pairs in the map,
- * invoking a callback for each that matches a given prefix.
- * The callback gets a key, value for each and returns an integer stop value.
- * If the callback returns non-zero, then the iteration stops.
- * @arg t The tree to iterate over
- * @arg key_ The prefix of keys to read
- * @arg keyLen The length of the prefix
- * @arg cb The callback function to invoke
- * @arg data Opaque handle passed to the callback
- * @return 0 on success, or the return of the callback.
+ * Finds the highest node below which every key starts with 'key'.
+ * @return the node (or tagged leaf), or NULL if no key has the prefix.
  */
-int artIterPrefix(const art *t, const void *key_, const uint_fast32_t keyLen,
-                  artCallback cb, void *data) {
-    artNode **child;
-    artNode *n = t->root;
-    int prefixLen;
-    int depth = 0;
-    const uint8_t *restrict key = key_;
+static artNode *prefixRoot(const art *t, const uint8_t *restrict key,
+                           const uint_fast32_t keyLen) {
+    artRef *child;
+    artNode *n = load_root(t);
+    size_t prefixLen;
+    uint_fast32_t depth = 0;
     while (n) {
         // Might be a leaf
         if (IS_LEAF(n)) {
-            n = (artNode *)LEAF_RAW(n);
             // Check if the expanded path matches
-            if (leafPrefix_matches((artLeaf *)n, key, keyLen)) {
-                artLeaf *l = (artLeaf *)n;
-                return cb(data, l->key, l->keyLen, l->value.ptr);
+            if (leafPrefix_matches(LEAF_RAW(n), key, keyLen)) {
+                return n;
             }
 
-            return 0;
+            return NULL;
         }
 
         // If the depth matches the prefix, we need to handle this node
         if (depth == keyLen) {
             artLeaf *l = minimum(n);
             if (leafPrefix_matches(l, key, keyLen)) {
-                return recursive_iter(n, cb, data);
+                return n;
             }
 
-            return 0;
+            return NULL;
         }
 
         // Bail if the prefix does not match
         if (n->partialLen) {
-            prefixLen = prefix_mismatch(n, key, keyLen, depth);
+            prefixLen = prefix_mismatch(t, n, key, keyLen, depth);
 
             // Guard if the mis-match is longer than the MAX_PREFIX_LEN
-            if ((uint32_t)prefixLen > n->partialLen) {
+            if (prefixLen > n->partialLen) {
                 prefixLen = n->partialLen;
             }
 
             // If there is no match, search is terminated
             if (!prefixLen) {
-                return 0;
+                return NULL;
             }
 
             // If we've matched the prefix, iterate on this node
             if (depth + prefixLen == keyLen) {
-                return recursive_iter(n, cb, data);
+                return n;
             }
 
             // if there is a full match, go deeper
@@ -1401,17 +3033,1634 @@ int artIterPrefix(const art *t, const void *key_, const uint_fast32_t keyLen,
 #if 1
         if (depth >= keyLen) {
             // Node depth is greater than input key; can't match
-            return 0;
+            return NULL;
         }
 #endif
 
         // Recursively search
         child = find_child(n, keyAt(key, keyLen, depth));
-        n = (child) ? *child : NULL;
+        n = (child) ? REF_PTR(*child) : NULL;
         depth++;
     }
 
-    return 0;
+    return NULL;
+}
+
+/**
+ * Iterates through the entries pairs in the map,
+ * invoking a callback for each that matches a given prefix.
+ * The callback gets a key, value for each and returns an integer stop value.
+ * If the callback returns non-zero, then the iteration stops.
+ * @arg t The tree to iterate over
+ * @arg key_ The prefix of keys to read
+ * @arg keyLen The length of the prefix
+ * @arg cb The callback function to invoke
+ * @arg data Opaque handle passed to the callback
+ * @return 0 on success, or the return of the callback.
+ */
+int artIterPrefix(const art *t, const void *key_, const uint_fast32_t keyLen,
+                  artCallback cb, void *data) {
+    artNode *n = prefixRoot(t, key_, keyLen);
+    return n ? recursive_iter(n, cb, data) : 0;
+}
+
+/* =================================================
+ * Set algebra between trees
+ * ================================================ */
+/**
+ * Returns the compressed path bytes of 'n' starting 'skip' bytes into the
+ * node's prefix, where 'depth' is the key index of the first returned byte.
+ * Prefixes longer than MAX_PREFIX_LEN are only fully stored in the leaves,
+ * so long prefixes are read from the minimum leaf below the node.
+ */
+static const uint8_t *nodePath(const artNode *n, int depth, int skip) {
+    if (n->partialLen <= MAX_PREFIX_LEN) {
+        return n->partial + skip;
+    }
+
+    return minimum(n)->key + depth;
+}
+
+/**
+ * Finds the leaf for 'key' below 'n', where 'depth' is the key index at
+ * which the prefix of 'n' begins. Prefixes are skipped without comparing
+ * because the final leaf comparison validates the entire key.
+ */
+static artLeaf *findLeaf(artNode *n, int depth, const uint8_t *key,
+                         const uint_fast32_t keyLen) {
+    while (n) {
+        if (IS_LEAF(n)) {
+            artLeaf *l = LEAF_RAW(n);
+            return leafNodeIsExactKey(l, key, keyLen) ? l : NULL;
+        }
+
+        depth += n->partialLen;
+        if ((uint_fast32_t)depth > keyLen) {
+            return NULL;
+        }
+
+#if ART_BINARY_KEYS
+        // The key ends at this node, so only the end slot can hold it
+        if ((uint_fast32_t)depth == keyLen) {
+            n = NODE_END(n);
+            continue;
+        }
+#elif !ART_USE_IMPLICIT_KEY_NULL_TERMINIATOR_PROTECTION
+        if ((uint_fast32_t)depth == keyLen) {
+            return NULL;
+        }
+#endif
+
+        artRef *child = find_child(n, keyAt(key, keyLen, depth));
+        n = (child) ? REF_PTR(*child) : NULL;
+        depth++;
+    }
+
+    return NULL;
+}
+
+// find_child() that also reaches the end slot as key byte END_KEY
+static artRef *find_slot(artNode *n, int c) {
+#if ART_BINARY_KEYS
+    if (c == END_KEY) {
+        return n->end ? &n->end : NULL;
+    }
+#endif
+
+    return find_child(n, c);
+}
+
+typedef struct artSetWalk {
+    artCallback cb;
+    void *data;
+    bool difference; /* emit keys of 'a' missing from 'b' instead */
+} artSetWalk;
+
+typedef struct artIterExcept {
+    artCallback cb;
+    void *data;
+    const artLeaf *except;
+} artIterExcept;
+
+static int iterExceptCb(void *data, const void *key, uint32_t keyLen,
+                        void *value) {
+    const artIterExcept *e = data;
+    if (e->except && key == e->except->key) {
+        return 0;
+    }
+
+    return e->cb(e->data, key, keyLen, value);
+}
+
+/**
+ * Walks 'a' and 'b' in lockstep. Both nodes are positioned at key index
+ * 'depth' after consuming 'aSkip' and 'bSkip' bytes of their own prefixes,
+ * so nodes with compressed paths of different lengths can be aligned
+ * without ever modifying either tree.
+ */
+static int setWalk(const artSetWalk *w, artNode *a, int aSkip, artNode *b,
+                   int bSkip, int depth) {
+    if (!a) {
+        return 0;
+    }
+
+    if (!b) {
+        return w->difference ? recursive_iter(a, w->cb, w->data) : 0;
+    }
+
+    // A single key on our side only needs one lookup on the other side
+    if (IS_LEAF(a)) {
+        artLeaf *l = LEAF_RAW(a);
+        const bool found = findLeaf(b, depth - bSkip, l->key, l->keyLen);
+        if (found != w->difference) {
+            return w->cb(w->data, l->key, l->keyLen, l->value.ptr);
+        }
+
+        return 0;
+    }
+
+    if (IS_LEAF(b)) {
+        const artLeaf *l = LEAF_RAW(b);
+        artLeaf *match = findLeaf(a, depth - aSkip, l->key, l->keyLen);
+        if (w->difference) {
+            artIterExcept e = {.cb = w->cb, .data = w->data, .except = match};
+            return recursive_iter(a, iterExceptCb, &e);
+        }
+
+        return match ? w->cb(w->data, match->key, match->keyLen,
+                             match->value.ptr)
+                     : 0;
+    }
+
+    // Compare the overlapping parts of both compressed paths at once
+    const int aRem = a->partialLen - aSkip;
+    const int bRem = b->partialLen - bSkip;
+    const int common = min(aRem, bRem);
+    const uint8_t *aPath = NULL;
+    const uint8_t *bPath = NULL;
+    if (aRem) {
+        aPath = nodePath(a, depth, aSkip);
+    }
+
+    if (bRem) {
+        bPath = nodePath(b, depth, bSkip);
+    }
+
+    if (common && memcmp(aPath, bPath, common) != 0) {
+        return w->difference ? recursive_iter(a, w->cb, w->data) : 0;
+    }
+
+    int res;
+    int pos = 0;
+    int c;
+    artRef *child;
+    if (aRem == bRem) {
+        // Both nodes branch at the same index, so merge their children
+        depth += common + 1;
+        if (!w->difference && b->type < a->type) {
+            // Drive the intersection from the sparser node
+            while ((child = next_child(b, &pos, &c))) {
+                artRef *other = find_slot(a, c);
+                if (other && (res = setWalk(w, REF_PTR(*other), 0,
+                                            REF_PTR(*child), 0, depth))) {
+                    return res;
+                }
+            }
+
+            return 0;
+        }
+
+        while ((child = next_child(a, &pos, &c))) {
+            artRef *other = find_slot(b, c);
+            if ((res = setWalk(w, REF_PTR(*child), 0,
+                               other ? REF_PTR(*other) : NULL, 0, depth))) {
+                return res;
+            }
+        }
+
+        return 0;
+    }
+
+    if (aRem < bRem) {
+        // 'a' branches first; all of 'b' lives under one child of 'a'
+        const uint8_t bByte = bPath[common];
+        depth += common + 1;
+        if (!w->difference) {
+            child = find_child(a, bByte);
+            return child ? setWalk(w, REF_PTR(*child), 0, b,
+                                   bSkip + common + 1, depth)
+                         : 0;
+        }
+
+        while ((child = next_child(a, &pos, &c))) {
+            if (c == bByte) {
+                res = setWalk(w, REF_PTR(*child), 0, b, bSkip + common + 1,
+                              depth);
+            } else {
+                res = recursive_iter(REF_PTR(*child), w->cb, w->data);
+            }
+
+            if (res) {
+                return res;
+            }
+        }
+
+        return 0;
+    }
+
+    // 'b' branches first; all of 'a' lives under at most one child of 'b'
+    child = find_child(b, aPath[common]);
+    return setWalk(w, a, aSkip + common + 1, child ? REF_PTR(*child) : NULL, 0,
+                   depth + common + 1);
+}
+
+/**
+ * Invokes a callback for every key present in both 'a' and 'b', in key
+ * order. Both trees are descended together so subtrees whose key bytes do
+ * not overlap are skipped entirely. The callback receives the value from 'a'.
+ * If the callback returns non-zero, then the iteration stops.
+ * @arg a The tree providing keys and values
+ * @arg b The tree keys must also exist in
+ * @arg cb The callback function to invoke
+ * @arg data Opaque handle passed to the callback
+ * @return 0 on success, or the return of the callback.
+ */
+int artIntersect(const art *a, const art *b, artCallback cb, void *data) {
+    const artSetWalk w = {.cb = cb, .data = data, .difference = false};
+    return setWalk(&w, load_root(a), 0, load_root(b), 0, 0);
+}
+
+/**
+ * Invokes a callback for every key present in 'a' but not in 'b', in key
+ * order. Subtrees of 'a' with no counterpart in 'b' are emitted without
+ * any further lookups.
+ * If the callback returns non-zero, then the iteration stops.
+ * @arg a The tree providing keys and values
+ * @arg b The tree of keys to exclude
+ * @arg cb The callback function to invoke
+ * @arg data Opaque handle passed to the callback
+ * @return 0 on success, or the return of the callback.
+ */
+int artDifference(const art *a, const art *b, artCallback cb, void *data) {
+    const artSetWalk w = {.cb = cb, .data = data, .difference = true};
+    return setWalk(&w, load_root(a), 0, load_root(b), 0, 0);
+}
+
+/* =================================================
+ * Bulk range removal and splitting
+ * ================================================ */
+/**
+ * Creates the smallest node holding 'count' children with the prefix of
+ * 'hdr'. Children must be sorted by key byte. A single child is returned
+ * directly with the prefix folded into it and no children returns NULL.
+ */
+static artNode *build_node(art *t, const artNode *hdr, int count,
+                           const uint8_t *keys, const artRef *children,
+                           artNode *end) {
+    // An end slot leaf left alone needs no node around it
+    if (count == 0) {
+        return end;
+    }
+
+    if (count == 1 && !end) {
+        return collapse_child(hdr, keys[0], REF_PTR(children[0]));
+    }
+
+    artNode *n;
+    if (count <= 4) {
+        artNode4 *n4 = (artNode4 *)alloc_node(t, NODE4);
+        memcpy(n4->keys, keys, count);
+        memcpy(n4->children, children, count * sizeof(artRef));
+        n = &n4->n;
+    } else if (count <= 16) {
+        artNode16 *n16 = (artNode16 *)alloc_node(t, NODE16);
+        memcpy(n16->keys, keys, count);
+        memcpy(n16->children, children, count * sizeof(artRef));
+        n = &n16->n;
+    } else if (count <= 32) {
+        artNode32 *n32 = (artNode32 *)alloc_node(t, NODE32);
+        memcpy(n32->keys, keys, count);
+        memcpy(n32->children, children, count * sizeof(artRef));
+        n = &n32->n;
+    } else if (count <= 48) {
+        artNode48 *n48 = (artNode48 *)alloc_node(t, NODE48);
+        memcpy(n48->children, children, count * sizeof(artRef));
+        for (int i = 0; i < count; i++) {
+            n48->keys[keys[i]] = i + 1;
+            presentSet(n48->present, keys[i]);
+        }
+
+        n = &n48->n;
+    } else {
+        artNode256 *n256 = (artNode256 *)alloc_node(t, NODE256);
+        for (int i = 0; i < count; i++) {
+            n256->children[keys[i]] = children[i];
+            presentSet(n256->present, keys[i]);
+        }
+
+        n = &n256->n;
+    }
+
+    n->childrenCount = count;
+    n->partialLen = hdr->partialLen;
+    memcpy(n->partial, hdr->partial, min(MAX_PREFIX_LEN, hdr->partialLen));
+    NODE_END_SET(n, end);
+
+#if ART_SUBTREE_COUNTS
+    n->leafCount = end ? 1 : 0;
+    for (int i = 0; i < count; i++) {
+        n->leafCount += subtreeLeaves(REF_PTR(children[i]));
+    }
+#endif
+
+    return n;
+}
+
+/* Where the keys below an inner node sort relative to a range bound */
+typedef enum artBoundSide {
+    ART_BOUND_BELOW = 0, /* every key is less than the bound */
+    ART_BOUND_ABOVE,     /* every key is greater than or equal to the bound */
+    ART_BOUND_STRADDLE,  /* the bound continues below one of our children */
+} artBoundSide;
+
+/**
+ * Classifies the keys below inner node 'n' (whose prefix begins at key
+ * index 'depth') against 'bound', which must match all keys of 'n' up to
+ * 'depth'. On ART_BOUND_STRADDLE the children of 'n' are split by
+ * bound[depth + n->partialLen].
+ */
+static artBoundSide boundSide(const artNode *n, int depth,
+                              const uint8_t *bound,
+                              const uint_fast32_t boundLen) {
+    if (n->partialLen) {
+        const int cmpLen = min(n->partialLen, boundLen - depth);
+        const int cmp = memcmp(nodePath(n, depth, 0), bound + depth, cmpLen);
+        if (cmp) {
+            return cmp < 0 ? ART_BOUND_BELOW : ART_BOUND_ABOVE;
+        }
+
+        // Bound ended inside our prefix, so every key below us is longer
+        if (cmpLen < n->partialLen) {
+            return ART_BOUND_ABOVE;
+        }
+    }
+
+    if ((uint_fast32_t)depth + n->partialLen >= boundLen) {
+        return ART_BOUND_ABOVE;
+    }
+
+    return ART_BOUND_STRADDLE;
+}
+
+/**
+ * Moves the children of 'n' in the byte range (loByte, hiByte) plus the
+ * already carved boundary pieces 'loPart' and 'hiPart' into a new node and
+ * rebuilds 'n' at '*ref' from whatever remains. Both results are resized
+ * to fit their new child counts.
+ * Kept out of line so its child arrays aren't part of every recursive frame.
+ */
+__attribute__((noinline)) static artNode *
+split_children(art *t, artNode *n, artRef *ref, int loByte, artNode *loPart,
+               int hiByte, artNode *hiPart) {
+    uint8_t keepKeys[256];
+    uint8_t outKeys[256];
+    artRef keep[256];
+    artRef out[256];
+    int keepCount = 0;
+    int outCount = 0;
+    artNode *keepEnd = NULL;
+    artNode *outEnd = NULL;
+
+    int pos = 0;
+    int c;
+    artRef *child;
+    while ((child = next_child(n, &pos, &c))) {
+#if ART_BINARY_KEYS
+        // The end slot is only inside the range when there is no lower bound
+        if (c == END_KEY) {
+            if (loByte < END_KEY) {
+                outEnd = REF_PTR(*child);
+            } else {
+                keepEnd = REF_PTR(*child);
+            }
+
+            continue;
+        }
+#endif
+
+        // A boundary child moved over whole may no longer have a slot
+        if (loPart && loByte < c) {
+            outKeys[outCount] = loByte;
+            out[outCount++] = PTR_REF(loPart);
+            loPart = NULL;
+        }
+
+        if (hiPart && hiByte < c) {
+            outKeys[outCount] = hiByte;
+            out[outCount++] = PTR_REF(hiPart);
+            hiPart = NULL;
+        }
+
+        if (c == loByte || c == hiByte) {
+            // Boundary children were split in place by our caller
+            artNode **part = (c == loByte) ? &loPart : &hiPart;
+            if (*part) {
+                outKeys[outCount] = c;
+                out[outCount++] = PTR_REF(*part);
+                *part = NULL;
+            }
+
+            if (*child) {
+                keepKeys[keepCount] = c;
+                keep[keepCount++] = *child;
+            }
+        } else if (c > loByte && c < hiByte) {
+            outKeys[outCount] = c;
+            out[outCount++] = *child;
+        } else {
+            keepKeys[keepCount] = c;
+            keep[keepCount++] = *child;
+        }
+    }
+
+    if (loPart) {
+        outKeys[outCount] = loByte;
+        out[outCount++] = PTR_REF(loPart);
+    }
+
+    if (hiPart) {
+        outKeys[outCount] = hiByte;
+        out[outCount++] = PTR_REF(hiPart);
+    }
+
+    if (!outCount && !outEnd) {
+        return NULL;
+    }
+
+    artNode *extracted = build_node(t, n, outCount, outKeys, out, outEnd);
+    *ref = PTR_REF(build_node(t, n, keepCount, keepKeys, keep, keepEnd));
+    free_node(t, n);
+    return extracted;
+}
+
+/**
+ * Detaches every key in [lo, hi) below 'n' into a new subtree and returns
+ * it, leaving the remaining keys at '*ref'. A NULL bound is unbounded.
+ * Children entirely inside the range move over whole, so only the nodes
+ * along the two bound paths are visited.
+ * '*ref' is only modified if something is returned.
+ */
+static artNode *extract_range(art *t, artNode *n, artRef *ref, int depth,
+                              const uint8_t *lo, uint_fast32_t loLen,
+                              const uint8_t *hi, uint_fast32_t hiLen) {
+    if (!n) {
+        return NULL;
+    }
+
+    if (IS_LEAF(n)) {
+        const artLeaf *l = LEAF_RAW(n);
+        if ((lo && keyCompare(l->key, l->keyLen, lo, loLen) < 0) ||
+            (hi && keyCompare(l->key, l->keyLen, hi, hiLen) >= 0)) {
+            return NULL;
+        }
+
+        *ref = 0;
+        return n;
+    }
+
+    const int branch = depth + n->partialLen;
+    int loByte = END_KEY - 1; /* below even the end slot when unbounded */
+    int hiByte = 256;
+    if (lo) {
+        switch (boundSide(n, depth, lo, loLen)) {
+        case ART_BOUND_BELOW:
+            return NULL;
+        case ART_BOUND_ABOVE:
+            lo = NULL;
+            break;
+        case ART_BOUND_STRADDLE:
+            loByte = lo[branch];
+            break;
+        }
+    }
+
+    if (hi) {
+        switch (boundSide(n, depth, hi, hiLen)) {
+        case ART_BOUND_BELOW:
+            hi = NULL;
+            break;
+        case ART_BOUND_ABOVE:
+            return NULL;
+        case ART_BOUND_STRADDLE:
+            hiByte = hi[branch];
+            break;
+        }
+    }
+
+    // Entire subtree is inside the range
+    if (!lo && !hi) {
+        *ref = 0;
+        return n;
+    }
+
+    // Carve the boundary children first; their slots are updated in place
+    artRef *child;
+    artNode *loPart = NULL;
+    artNode *hiPart = NULL;
+    if (lo && (child = find_child(n, loByte))) {
+        loPart = extract_range(t, REF_PTR(*child), child, branch + 1, lo, loLen,
+                               loByte == hiByte ? hi : NULL, hiLen);
+    }
+
+    if (hi && hiByte != loByte && (child = find_child(n, hiByte))) {
+        hiPart = extract_range(t, REF_PTR(*child), child, branch + 1, NULL, 0,
+                               hi, hiLen);
+    }
+
+    return split_children(t, n, ref, loByte, loPart, hiByte, hiPart);
+}
+
+/**
+ * Deletes every key in [lo, hi) from the tree. Whole subtrees inside the
+ * range are detached with one pointer update and freed in bulk, and only
+ * the nodes along the two bound paths are resized.
+ * Values are not visited, so iterate the range first if they need freeing.
+ * @arg t The tree
+ * @arg lo The first key to delete, or NULL to delete from the minimum
+ * @arg loLen The length of 'lo'
+ * @arg hi The first key past the range, or NULL to delete to the maximum
+ * @arg hiLen The length of 'hi'
+ * @return the number of keys deleted, and 0 without deleting any when RCU
+ * mode is enabled.
+ */
+uint64_t artDeleteRange(art *t, const void *lo, const uint_fast32_t loLen,
+                        const void *hi, const uint_fast32_t hiLen) {
+    // Range deletes edit nodes in place, which readers could be walking
+    if (t->rcu) {
+        return 0;
+    }
+
+    if (lo && hi && keyCompare(lo, loLen, hi, hiLen) >= 0) {
+        return 0;
+    }
+
+    artNode *removed =
+        extract_range(t, REF_PTR(t->root), &t->root, 0, lo, loLen, hi, hiLen);
+    const uint64_t deleted = destroy_node(t, removed);
+    t->count -= deleted;
+    return deleted;
+}
+
+/**
+ * Deletes every key starting with 'prefix'.
+ * @return the number of keys deleted.
+ */
+uint64_t artDeletePrefix(art *t, const void *prefix_,
+                         const uint_fast32_t prefixLen) {
+    const uint8_t *prefix = prefix_;
+
+    // Keys sharing the prefix end before the prefix with its last
+    // non-0xff byte incremented; an all-0xff prefix runs to the maximum.
+    uint_fast32_t hiLen = prefixLen;
+    while (hiLen && prefix[hiLen - 1] == 0xff) {
+        hiLen--;
+    }
+
+    if (!hiLen) {
+        return artDeleteRange(t, prefix, prefixLen, NULL, 0);
+    }
+
+    uint8_t stackHi[256];
+    uint8_t *hi = hiLen <= sizeof(stackHi) ? stackHi : malloc(hiLen);
+    if (!hi) {
+        return 0;
+    }
+
+    memcpy(hi, prefix, hiLen);
+    hi[hiLen - 1]++;
+
+    const uint64_t deleted = artDeleteRange(t, prefix, prefixLen, hi, hiLen);
+    if (hi != stackHi) {
+        free(hi);
+    }
+
+    return deleted;
+}
+
+/**
+ * Moves every key greater than or equal to 'key' into a new tree.
+ * Only the nodes along the path of 'key' are split; everything to
+ * their right is moved by pointer. Nodes do not record the size of their
+ * subtrees, so one side is still walked once to move its share of the
+ * key, node and byte counters: the moved side, or with subtree counts
+ * the smaller one.
+ * @arg t The tree to split; keeps the keys less than 'key'
+ * @arg key The first key of the right tree
+ * @arg keyLen The length of the key
+ * @arg right Receives the new tree, owned by the caller, or NULL when
+ * RCU mode is enabled or the tree cannot be allocated
+ * @return the number of keys moved into 'right'.
+ */
+uint64_t artSplitAt(art *t, const void *key, const uint_fast32_t keyLen,
+                    art **right) {
+    // Splits edit nodes in place, which readers could be walking
+    art *r = t->rcu ? NULL : artNew();
+    *right = r;
+    if (!r) {
+        return 0;
+    }
+
+    r->fixedKeyLen = t->fixedKeyLen;
+    artNode *moved =
+        extract_range(t, REF_PTR(t->root), &t->root, 0, key, keyLen, NULL, 0);
+    r->root = PTR_REF(moved);
+
+    // The moved side's counters come from walking whichever side holds
+    // fewer keys, which subtree counts tell us without a walk
+    const bool keptFewer =
+        ART_SUBTREE_COUNTS && 2 * subtreeLeaves(moved) > t->count;
+    countSubtree(keptFewer ? REF_PTR(t->root) : moved, &r->count, &r->nodes,
+                 &r->bytes);
+    if (keptFewer) {
+        r->count = t->count - r->count;
+        r->nodes = t->nodes - r->nodes;
+        r->bytes = t->bytes - r->bytes;
+    }
+
+    t->count -= r->count;
+    t->nodes -= r->nodes;
+    t->bytes -= r->bytes;
+    return r->count;
+}
+
+/**
+ * Invokes 'cb' for the keys in [lo, hi) below 'n', in key order. 'depth' is
+ * the key index where the prefix of 'n' begins; a NULL bound is unbounded.
+ * Once a subtree lies entirely inside the range it is walked without any
+ * further key comparisons.
+ */
+static int range_iter(artNode *n, int depth, const uint8_t *lo,
+                      const uint_fast32_t loLen, const uint8_t *hi,
+                      const uint_fast32_t hiLen, artCallback cb, void *data) {
+    if (!n) {
+        return 0;
+    }
+
+    if (IS_LEAF(n)) {
+        artLeaf *l = LEAF_RAW(n);
+        if ((lo && keyCompare(l->key, l->keyLen, lo, loLen) < 0) ||
+            (hi && keyCompare(l->key, l->keyLen, hi, hiLen) >= 0)) {
+            return 0;
+        }
+
+        return cb(data, l->key, l->keyLen, l->value.ptr);
+    }
+
+    if (lo) {
+        switch (boundSide(n, depth, lo, loLen)) {
+        case ART_BOUND_BELOW:
+            return 0;
+        case ART_BOUND_ABOVE:
+            lo = NULL;
+            break;
+        case ART_BOUND_STRADDLE:
+            break;
+        }
+    }
+
+    if (hi) {
+        switch (boundSide(n, depth, hi, hiLen)) {
+        case ART_BOUND_BELOW:
+            hi = NULL;
+            break;
+        case ART_BOUND_ABOVE:
+            return 0;
+        case ART_BOUND_STRADDLE:
+            break;
+        }
+    }
+
+    if (!lo && !hi) {
+        return recursive_iter(n, cb, data);
+    }
+
+    depth += n->partialLen;
+    const int loByte = lo ? lo[depth] : -1;
+    const int hiByte = hi ? hi[depth] : 256;
+    artRef *child;
+    int pos = 0;
+    int c;
+    while ((child = next_child(n, &pos, &c)) && c <= hiByte) {
+        if (c < loByte) {
+            continue;
+        }
+
+        const int res = range_iter(REF_PTR(*child), depth + 1,
+                                   c == loByte ? lo : NULL, loLen,
+                                   c == hiByte ? hi : NULL, hiLen, cb, data);
+        if (res) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Iterates through the keys in [lo, hi) in key order, invoking a callback
+ * for each. A NULL bound is unbounded.
+ * If the callback returns non-zero, then the iteration stops.
+ * @return 0 on success, or the return of the callback.
+ */
+int artIterRange(const art *t, const void *lo, const uint_fast32_t loLen,
+                 const void *hi, const uint_fast32_t hiLen, artCallback cb,
+                 void *data) {
+    return range_iter(load_root(t), 0, lo, loLen, hi, hiLen, cb, data);
+}
+
+/**
+ * Finds the first leaf below 'n' with a key above 'key', or equal to it
+ * unless 'strict'. 'depth' is as for boundSide().
+ */
+static artLeaf *seek_after(const artNode *n, int depth, const uint8_t *key,
+                           const uint_fast32_t keyLen, const bool strict) {
+    if (!n) {
+        return NULL;
+    }
+
+    if (IS_LEAF(n)) {
+        artLeaf *l = LEAF_RAW(n);
+        const int cmp = keyCompare(l->key, l->keyLen, key, keyLen);
+        return cmp > 0 || (cmp == 0 && !strict) ? l : NULL;
+    }
+
+    artRef *child;
+    int pos = 0;
+    int c;
+    switch (boundSide(n, depth, key, keyLen)) {
+    case ART_BOUND_BELOW:
+        return NULL;
+    case ART_BOUND_ABOVE:
+        // Only a key ending at this node can equal 'key'. It is a leaf in
+        // the first slot: the end slot, or the implicit '\0' child.
+        child = next_child((artNode *)n, &pos, &c);
+        if (strict && IS_LEAF(REF_PTR(*child)) &&
+            !keyCompare(LEAF_RAW(REF_PTR(*child))->key,
+                        LEAF_RAW(REF_PTR(*child))->keyLen, key, keyLen)) {
+            child = next_child((artNode *)n, &pos, &c);
+        }
+
+        return child ? minimum(REF_PTR(*child)) : NULL;
+    case ART_BOUND_STRADDLE:
+        break;
+    }
+
+    depth += n->partialLen;
+    const int byte = key[depth];
+    while ((child = next_child((artNode *)n, &pos, &c))) {
+        if (c > byte) {
+            return minimum(REF_PTR(*child));
+        }
+
+        if (c == byte) {
+            artLeaf *l =
+                seek_after(REF_PTR(*child), depth + 1, key, keyLen, strict);
+            if (l) {
+                return l;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Finds the last leaf below 'n' with a key below 'key', or equal to it
+ * unless 'strict'.
+ */
+static artLeaf *seek_before(const artNode *n, int depth, const uint8_t *key,
+                            const uint_fast32_t keyLen, const bool strict) {
+    if (!n) {
+        return NULL;
+    }
+
+    if (IS_LEAF(n)) {
+        artLeaf *l = LEAF_RAW(n);
+        const int cmp = keyCompare(l->key, l->keyLen, key, keyLen);
+        return cmp < 0 || (cmp == 0 && !strict) ? l : NULL;
+    }
+
+    switch (boundSide(n, depth, key, keyLen)) {
+    case ART_BOUND_BELOW:
+        return maximum(n);
+    case ART_BOUND_ABOVE:
+        // Every key here is at least 'key', which only the end slot can be
+        return strict ? NULL : seek_before(NODE_END(n), depth, key, keyLen,
+                                           strict);
+    case ART_BOUND_STRADDLE:
+        break;
+    }
+
+    // Children below the key byte all sort before the key, so the last of
+    // them is the fallback when the matching child holds nothing lower
+    depth += n->partialLen;
+    const int byte = key[depth];
+    artRef *child;
+    artRef *below = NULL;
+    int pos = 0;
+    int c;
+    while ((child = next_child((artNode *)n, &pos, &c)) && c <= byte) {
+        if (c == byte) {
+            artLeaf *l =
+                seek_before(REF_PTR(*child), depth + 1, key, keyLen, strict);
+            if (l) {
+                return l;
+            }
+
+            break;
+        }
+
+        below = child;
+    }
+
+    return below ? maximum(REF_PTR(*below)) : NULL;
+}
+
+/**
+ * Returns the leaf with the smallest key not below 'key', or NULL.
+ */
+artLeaf *artLowerBound(const art *t, const void *key,
+                       const uint_fast32_t keyLen) {
+    return seek_after(load_root(t), 0, key, keyLen, false);
+}
+
+/**
+ * Returns the leaf with the smallest key above 'key', or NULL.
+ */
+artLeaf *artUpperBound(const art *t, const void *key,
+                       const uint_fast32_t keyLen) {
+    return seek_after(load_root(t), 0, key, keyLen, true);
+}
+
+/**
+ * Returns the leaf with the largest key below 'key', or NULL.
+ */
+artLeaf *artPredecessor(const art *t, const void *key,
+                        const uint_fast32_t keyLen) {
+    return seek_before(load_root(t), 0, key, keyLen, true);
+}
+
+/* =================================================
+ * Compaction
+ * ================================================ */
+static uint64_t compactNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Whether the step is out of time, reading the clock every 64 subtrees
+static bool compact_expired(artCompaction *c) {
+    if (!c->deadline || ++c->sinceCheck < 64) {
+        return false;
+    }
+
+    c->sinceCheck = 0;
+    return compactNow() >= c->deadline;
+}
+
+/* Stops the step before 'child', the first subtree it has not moved.
+ * Returns false, and the step runs on past its deadline, if there is no
+ * memory to remember where it stopped. */
+static bool compact_stop(artCompaction *c, const artRef child) {
+    const artLeaf *l = minimum(REF_PTR(child));
+    if (l->keyLen > c->nextCap) {
+        uint8_t *next = realloc(c->next, l->keyLen);
+        if (!next) {
+            c->deadline = 0;
+            return false;
+        }
+
+        c->next = next;
+        c->nextCap = l->keyLen;
+    }
+
+    memcpy(c->next, l->key, l->keyLen);
+    c->nextLen = l->keyLen;
+    c->stopped = true;
+    return true;
+}
+
+/**
+ * Replaces inner node 'n' with the smallest node type that holds its
+ * children, or a same-sized copy when it has a single slot.
+ * Kept out of line so its child arrays aren't part of every recursive frame.
+ */
+__attribute__((noinline)) static artNode *compact_resize(art *t,
+                                                         artNode *n) {
+    uint8_t keys[256];
+    artRef children[256];
+    int count = 0;
+
+    int pos = 0;
+    int c;
+    artRef *child;
+    while ((child = next_child(n, &pos, &c))) {
+        if (c != END_KEY) {
+            keys[count] = c;
+            children[count++] = *child;
+        }
+    }
+
+    artNode *fresh;
+    if (count > 1 || (count && NODE_END(n))) {
+        fresh = build_node(t, n, count, keys, children, NODE_END(n));
+    } else {
+        fresh = alloc_node(t, n->type);
+        memcpy(fresh, n, nodeSizes[n->type]);
+    }
+
+    compaction_free_node(t, n);
+    return fresh;
+}
+
+/**
+ * Moves the subtree 'n' (whose prefix begins at key index 'depth') into
+ * fresh memory, each node ahead of its children, so a walk in key order
+ * visits addresses in allocation order. On running out of time the
+ * remaining children are left where they are and 'c' records where to
+ * pick up.
+ * @return the moved subtree.
+ */
+static artNode *compact_node(art *t, artCompaction *c, artNode *n,
+                             int depth) {
+    if (IS_LEAF(n)) {
+        artLeaf *l = LEAF_RAW(n);
+        artLeaf *copy = copy_leaf(t, l);
+        compaction_free_leaf(t, l);
+        return SET_LEAF(copy);
+    }
+
+    n = compact_resize(t, n);
+    depth += n->partialLen;
+
+    int pos = 0;
+    int ch;
+    artRef *child;
+    while ((child = next_child(n, &pos, &ch)) && !c->stopped) {
+        if (ch != END_KEY && compact_expired(c) && compact_stop(c, *child)) {
+            break;
+        }
+
+        *child = PTR_REF(compact_node(t, c, REF_PTR(*child), depth + 1));
+    }
+
+    return n;
+}
+
+/**
+ * Resumes the pass at '*ref': moves the keys of 'n' not below
+ * c->resume, leaving the rest, which an earlier step already moved.
+ */
+static void compact_from(art *t, artCompaction *c, artNode *n, artRef *ref,
+                         int depth) {
+    if (IS_LEAF(n)) {
+        const artLeaf *l = LEAF_RAW(n);
+        if (keyCompare(l->key, l->keyLen, c->resume, c->resumeLen) >= 0) {
+            *ref = PTR_REF(compact_node(t, c, n, depth));
+        }
+
+        return;
+    }
+
+    switch (boundSide(n, depth, c->resume, c->resumeLen)) {
+    case ART_BOUND_BELOW:
+        return;
+    case ART_BOUND_ABOVE:
+        *ref = PTR_REF(compact_node(t, c, n, depth));
+        return;
+    case ART_BOUND_STRADDLE:
+        break;
+    }
+
+    n = writable_node(t, n);
+    *ref = PTR_REF(n);
+    depth += n->partialLen;
+    const int byte = c->resume[depth];
+
+    int pos = 0;
+    int ch;
+    artRef *child;
+    while ((child = next_child(n, &pos, &ch)) && !c->stopped) {
+        if (ch < byte) {
+            continue;
+        }
+
+        if (ch == byte) {
+            compact_from(t, c, REF_PTR(*child), child, depth + 1);
+            continue;
+        }
+
+        if (compact_expired(c) && compact_stop(c, *child)) {
+            break;
+        }
+
+        *child = PTR_REF(compact_node(t, c, REF_PTR(*child), depth + 1));
+    }
+}
+
+/**
+ * Continues compacting 't' for about 'budgetNs' nanoseconds, or until
+ * done when 'budgetNs' is 0. A step moves at least a few subtrees, so
+ * repeated calls always finish.
+ * @return true when this step completed the pass, false when more is
+ * left or the compaction state could not be allocated.
+ */
+bool artCompactStep(art *t, uint64_t budgetNs) {
+    artCompaction *c = t->compaction;
+    if (!c) {
+        c = t->compaction = calloc(1, sizeof(*c));
+        if (!c) {
+            return false;
+        }
+    }
+
+    c->deadline = budgetNs ? compactNow() + budgetNs : 0;
+    c->sinceCheck = 0;
+    c->stopped = false;
+
+    artRef root = t->root;
+    if (!root) {
+        // Nothing left to do
+    } else if (c->resumeLen) {
+        compact_from(t, c, REF_PTR(root), &root, 0);
+    } else {
+        root = PTR_REF(compact_node(t, c, REF_PTR(root), 0));
+    }
+
+    publish_root(t, root);
+    if (!c->stopped) {
+        compaction_free(t);
+        return true;
+    }
+
+    compaction_drain(c);
+    uint8_t *resume = c->resume;
+    const uint32_t resumeCap = c->resumeCap;
+    c->resume = c->next;
+    c->resumeLen = c->nextLen;
+    c->resumeCap = c->nextCap;
+    c->next = resume;
+    c->nextCap = resumeCap;
+    return false;
+}
+
+/**
+ * Rebuilds 't' with every node at the smallest type that holds its
+ * children, moving nodes and leaves into fresh memory in depth-first
+ * order. An unfinished artCompactStep() pass is finished instead.
+ */
+void artCompact(art *t) {
+    artCompactStep(t, 0);
+}
+
+/* =================================================
+ * Order statistics
+ * ================================================ */
+/**
+ * Counts the keys starting with 'prefix'.
+ * O(prefix length) with subtree counts, otherwise a walk of the matches.
+ */
+uint64_t artCountPrefix(const art *t, const void *prefix,
+                        const uint_fast32_t prefixLen) {
+    return subtreeLeaves(prefixRoot(t, prefix, prefixLen));
+}
+
+/**
+ * Returns the number of keys less than 'key', which is also the index
+ * 'key' has or would have in key order.
+ * O(key length) with subtree counts, otherwise a walk of the smaller keys.
+ */
+uint64_t artRank(const art *t, const void *key_, const uint_fast32_t keyLen) {
+    const uint8_t *key = key_;
+    artNode *n = load_root(t);
+    uint64_t rank = 0;
+    int depth = 0;
+    while (n) {
+        if (IS_LEAF(n)) {
+            const artLeaf *l = LEAF_RAW(n);
+            return rank + (keyCompare(l->key, l->keyLen, key, keyLen) < 0);
+        }
+
+        switch (boundSide(n, depth, key, keyLen)) {
+        case ART_BOUND_BELOW:
+            return rank + subtreeLeaves(n);
+        case ART_BOUND_ABOVE:
+            return rank;
+        case ART_BOUND_STRADDLE:
+            break;
+        }
+
+        // Everything under a smaller key byte sorts before 'key'
+        depth += n->partialLen;
+        const uint8_t byte = key[depth];
+        artRef *child;
+        artRef *next = NULL;
+        int pos = 0;
+        int c;
+        while ((child = next_child(n, &pos, &c)) && c <= byte) {
+            if (c == byte) {
+                next = child;
+                break;
+            }
+
+            rank += subtreeLeaves(REF_PTR(*child));
+        }
+
+        n = next ? REF_PTR(*next) : NULL;
+        depth++;
+    }
+
+    return rank;
+}
+
+/**
+ * Counts the keys in [lo, hi); a NULL bound is unbounded.
+ */
+uint64_t artCountRange(const art *t, const void *lo,
+                       const uint_fast32_t loLen, const void *hi,
+                       const uint_fast32_t hiLen) {
+    const uint64_t below = lo ? artRank(t, lo, loLen) : 0;
+    const uint64_t end = hi ? artRank(t, hi, hiLen) : t->count;
+    return end > below ? end - below : 0;
+}
+
+// Recovers the leaf owning a key pointer handed to an iteration callback
+static inline artLeaf *leafFromKey(const void *key) {
+    return (artLeaf *)((uintptr_t)key - offsetof(artLeaf, key));
+}
+
+#if !ART_SUBTREE_COUNTS
+typedef struct artSelectState {
+    uint64_t remaining;
+    const void *key;
+} artSelectState;
+
+static int selectCb(void *data, const void *key, uint32_t keyLen,
+                    void *value) {
+    artSelectState *s = data;
+    (void)keyLen;
+    (void)value;
+    if (s->remaining--) {
+        return 0;
+    }
+
+    s->key = key;
+    return 1;
+}
+#endif
+
+/**
+ * Returns the leaf at zero-based position 'idx' in key order, or NULL
+ * if the tree has 'idx' keys or fewer.
+ * O(key length) with subtree counts, otherwise a walk of the first keys.
+ */
+artLeaf *artSelect(const art *t, uint64_t idx) {
+    if (idx >= t->count) {
+        return NULL;
+    }
+
+#if ART_SUBTREE_COUNTS
+    artNode *n = load_root(t);
+    while (!IS_LEAF(n)) {
+        artRef *child;
+        int pos = 0;
+        int c;
+        while ((child = next_child(n, &pos, &c))) {
+            const uint64_t leaves = subtreeLeaves(REF_PTR(*child));
+            if (idx < leaves) {
+                break;
+            }
+
+            idx -= leaves;
+        }
+
+        n = REF_PTR(*child);
+    }
+
+    return LEAF_RAW(n);
+#else
+    artSelectState s = {.remaining = idx};
+    recursive_iter(load_root(t), selectCb, &s);
+    return leafFromKey(s.key);
+#endif
+}
+
+/* =================================================
+ * Random sampling
+ * ================================================ */
+// splitmix64: tiny, fast, and any seed (including zero) is a good seed
+static uint64_t randomNext(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform integer in [0, bound) by multiply-shift
+static uint64_t randomBelow(uint64_t *state, uint64_t bound) {
+    return (uint64_t)(((__uint128_t)randomNext(state) * bound) >> 64);
+}
+
+#if !ART_SUBTREE_COUNTS
+typedef struct artReservoir {
+    artLeaf **sample;
+    size_t k;
+    uint64_t seen;
+    uint64_t *state;
+} artReservoir;
+
+// Reservoir sampling ("Algorithm R") over an in-order walk
+static int reservoirCb(void *data, const void *key, uint32_t keyLen,
+                       void *value) {
+    artReservoir *r = data;
+    (void)keyLen;
+    (void)value;
+    if (r->seen < r->k) {
+        r->sample[r->seen] = leafFromKey(key);
+    } else {
+        const uint64_t slot = randomBelow(r->state, r->seen + 1);
+        if (slot < r->k) {
+            r->sample[slot] = leafFromKey(key);
+        }
+    }
+
+    r->seen++;
+    return 0;
+}
+#else
+static int rankCmp(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+#endif
+
+/**
+ * Returns a uniformly random leaf, or NULL for an empty tree.
+ * O(key length) with subtree counts, otherwise a walk of the tree.
+ * @arg t The tree
+ * @arg state Caller-owned random state, advanced by each call
+ */
+artLeaf *artRandomLeaf(const art *t, uint64_t *state) {
+    if (!t->count) {
+        return NULL;
+    }
+
+#if ART_SUBTREE_COUNTS
+    return artSelect(t, randomBelow(state, t->count));
+#else
+    artLeaf *l = NULL;
+    artReservoir r = {.sample = &l, .k = 1, .state = state};
+    recursive_iter(load_root(t), reservoirCb, &r);
+    return l;
+#endif
+}
+
+/**
+ * Fills 'sample' with min(k, artCount(t)) distinct leaves chosen uniformly
+ * at random without replacement.
+ * With subtree counts, random ranks are drawn with Floyd's algorithm and
+ * resolved by artSelect() in O(k * key length), returning the sample in key
+ * order. Otherwise the whole tree is reservoir sampled and the sample
+ * order is unspecified.
+ * @arg t The tree
+ * @arg sample Array of at least 'k' entries receiving the leaves
+ * @arg k Number of leaves wanted
+ * @arg state Caller-owned random state, advanced by each call
+ * @return the number of leaves written to 'sample', or 0 if the rank
+ * sets could not be allocated.
+ */
+size_t artRandomSample(const art *t, artLeaf **sample, size_t k,
+                       uint64_t *state) {
+    // Clamped before sizing anything by 'k', so the sizes can't overflow
+    const uint64_t n = t->count;
+    if (k > n) {
+        k = n;
+    }
+
+    if (!k) {
+        return 0;
+    }
+
+#if ART_SUBTREE_COUNTS
+    // Floyd: for each j in [n - k, n) take a random rank in [0, j], or j
+    // itself if that rank was already taken. An open addressing set twice
+    // the sample size tracks taken ranks (stored as rank + 1; 0 is empty).
+    size_t slots = 16;
+    while (slots < k * 2) {
+        slots <<= 1;
+    }
+
+    uint64_t *taken = calloc(slots, sizeof(*taken));
+    uint64_t *ranks = malloc(k * sizeof(*ranks));
+    if (!taken || !ranks) {
+        free(taken);
+        free(ranks);
+        return 0;
+    }
+
+    size_t picked = 0;
+    for (uint64_t j = n - k; j < n; j++) {
+        uint64_t rank = randomBelow(state, j + 1);
+        for (int attempt = 0; attempt < 2; attempt++) {
+            size_t slot = (rank * 0x9e3779b97f4a7c15ULL) & (slots - 1);
+            while (taken[slot] && taken[slot] != rank + 1) {
+                slot = (slot + 1) & (slots - 1);
+            }
+
+            if (!taken[slot]) {
+                taken[slot] = rank + 1;
+                break;
+            }
+
+            // Collision: 'j' can't have been taken yet, so use it instead
+            rank = j;
+        }
+
+        ranks[picked++] = rank;
+    }
+
+    qsort(ranks, k, sizeof(*ranks), rankCmp);
+    for (size_t i = 0; i < k; i++) {
+        sample[i] = artSelect(t, ranks[i]);
+    }
+
+    free(ranks);
+    free(taken);
+#else
+    artReservoir r = {.sample = sample, .k = k, .state = state};
+    recursive_iter(load_root(t), reservoirCb, &r);
+#endif
+
+    return k;
+}
+
+/* =================================================
+ * Typed fixed-width keys
+ * ================================================ */
+/* Typed keys are all 8 bytes. They take the fixed length paths in trees
+ * created with artNewFixed(8), and the generic ones otherwise, since such
+ * a tree may also hold keys of other lengths. */
+#define TYPED_KEY_LEN 8
+
+static bool insertTyped(art *t, const uint8_t *k, void *value,
+                        void **oldValue) {
+    if (t->fixedKeyLen == TYPED_KEY_LEN) {
+        return insertValue(t, k, TYPED_KEY_LEN, value, oldValue,
+                           TYPED_KEY_LEN);
+    }
+
+    return insertValue(t, k, TYPED_KEY_LEN, value, oldValue, 0);
+}
+
+static bool searchTyped(const art *t, const uint8_t *k, void **value) {
+    if (t->fixedKeyLen == TYPED_KEY_LEN) {
+        return search(t, k, TYPED_KEY_LEN, value, TYPED_KEY_LEN);
+    }
+
+    return artSearchLeaf(t, k, TYPED_KEY_LEN, value);
+}
+
+static bool deleteTyped(art *t, const uint8_t *k, void **value) {
+    if (t->fixedKeyLen == TYPED_KEY_LEN) {
+        return deleteValue(t, k, TYPED_KEY_LEN, value, TYPED_KEY_LEN);
+    }
+
+    return deleteValue(t, k, TYPED_KEY_LEN, value, 0);
+}
+
+// Iterates [lo, hi]; appending a zero byte to 'hi' gives the first key after
+// it, turning the inclusive bound into the exclusive one range_iter() takes.
+static int iterRangeTyped(const art *t, const uint8_t *lo, const uint8_t *hi,
+                          artCallback cb, void *data) {
+    uint8_t end[TYPED_KEY_LEN + 1];
+    memcpy(end, hi, TYPED_KEY_LEN);
+    end[TYPED_KEY_LEN] = 0;
+    return range_iter(load_root(t), 0, lo, TYPED_KEY_LEN, end, sizeof(end),
+                      cb, data);
+}
+
+bool artInsertU64(art *t, uint64_t key, void *value, void **oldValue) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutU64(k, key);
+    return insertTyped(t, k, value, oldValue);
+}
+
+bool artSearchU64(const art *t, uint64_t key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutU64(k, key);
+    return searchTyped(t, k, value);
+}
+
+bool artDeleteU64(art *t, uint64_t key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutU64(k, key);
+    return deleteTyped(t, k, value);
+}
+
+int artIterRangeU64(const art *t, uint64_t lo, uint64_t hi, artCallback cb,
+                    void *data) {
+    uint8_t l[TYPED_KEY_LEN];
+    uint8_t h[TYPED_KEY_LEN];
+    artKeyPutU64(l, lo);
+    artKeyPutU64(h, hi);
+    return iterRangeTyped(t, l, h, cb, data);
+}
+
+bool artInsertI64(art *t, int64_t key, void *value, void **oldValue) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutI64(k, key);
+    return insertTyped(t, k, value, oldValue);
+}
+
+bool artSearchI64(const art *t, int64_t key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutI64(k, key);
+    return searchTyped(t, k, value);
+}
+
+bool artDeleteI64(art *t, int64_t key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutI64(k, key);
+    return deleteTyped(t, k, value);
+}
+
+int artIterRangeI64(const art *t, int64_t lo, int64_t hi, artCallback cb,
+                    void *data) {
+    uint8_t l[TYPED_KEY_LEN];
+    uint8_t h[TYPED_KEY_LEN];
+    artKeyPutI64(l, lo);
+    artKeyPutI64(h, hi);
+    return iterRangeTyped(t, l, h, cb, data);
+}
+
+bool artInsertDouble(art *t, double key, void *value, void **oldValue) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutDouble(k, key);
+    return insertTyped(t, k, value, oldValue);
+}
+
+bool artSearchDouble(const art *t, double key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutDouble(k, key);
+    return searchTyped(t, k, value);
+}
+
+bool artDeleteDouble(art *t, double key, void **value) {
+    uint8_t k[TYPED_KEY_LEN];
+    artKeyPutDouble(k, key);
+    return deleteTyped(t, k, value);
+}
+
+int artIterRangeDouble(const art *t, double lo, double hi, artCallback cb,
+                       void *data) {
+    uint8_t l[TYPED_KEY_LEN];
+    uint8_t h[TYPED_KEY_LEN];
+    artKeyPutDouble(l, lo);
+    artKeyPutDouble(h, hi);
+    return iterRangeTyped(t, l, h, cb, data);
+}
+
+/* =================================================
+ * Memory statistics
+ * ================================================ */
+_Static_assert(NODE256 == ART_STATS_NODE_TYPES - 1,
+               "artTreeStats.nodes is indexed by 'artType'");
+
+// Child slots of each node type, indexed by 'artType'
+static const uint32_t nodeCapacities[] = {
+    [NODE4] = 4, [NODE16] = 16, [NODE32] = 32, [NODE48] = 48, [NODE256] = 256,
+};
+
+// Histogram bucket of 'v': 0 for 0, otherwise floor(log2(v)) + 1
+static int statsBucket(const uint64_t v) {
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+static void collectStats(const artNode *n, const uint32_t depth,
+                         artTreeStats *s) {
+    if (IS_LEAF(n)) {
+        const artLeaf *l = LEAF_RAW(n);
+        s->leaves++;
+        s->leafBytes += LEAF_BYTES(l);
+        s->keyBytes += l->keyLen;
+        s->keyLen[statsBucket(l->keyLen)]++;
+        s->depth[min(depth, ART_STATS_MAX_DEPTH - 1)]++;
+        if (depth > s->maxDepth) {
+            s->maxDepth = depth;
+        }
+
+        return;
+    }
+
+    artNodeStats *ns = &s->nodes[n->type];
+    const uint32_t empty = nodeCapacities[n->type] - n->childrenCount;
+
+    // Sorted key nodes also leave a key byte unused per empty slot
+    const size_t slotBytes =
+        sizeof(artRef) + (n->type == NODE48 || n->type == NODE256 ? 0 : 1);
+
+    ns->count++;
+    ns->bytes += nodeSizes[n->type];
+    ns->children += n->childrenCount;
+    ns->wastedBytes += empty * slotBytes;
+    s->prefixLen[statsBucket(n->partialLen)]++;
+
+    artRef *child;
+    int pos = 0;
+    int c;
+    while ((child = next_child((artNode *)n, &pos, &c))) {
+        collectStats(REF_PTR(*child), depth + 1, s);
+    }
+}
+
+/**
+ * Fills 'stats' with a breakdown of the memory used by the tree: counts,
+ * bytes, fill and wasted slot bytes per node type, leaf and key bytes,
+ * and histograms of key lengths, compressed path lengths and leaf depths.
+ * One walk of the whole tree; use artBytes() for just the total.
+ */
+void artStats(const art *t, artTreeStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < ART_STATS_NODE_TYPES; i++) {
+        stats->nodes[i].capacity = nodeCapacities[i];
+    }
+
+    const artNode *root = load_root(t);
+    if (root) {
+        collectStats(root, 0, stats);
+    }
+
+    for (int i = 0; i < ART_STATS_NODE_TYPES; i++) {
+        stats->nodeBytes += stats->nodes[i].bytes;
+        stats->wastedBytes += stats->nodes[i].wastedBytes;
+    }
+}
+
+/* =================================================
+ * Hot path metrics
+ * ================================================ */
+/**
+ * Copies the metrics recorded for the tree into 'metrics'. Without
+ * ART_METRICS nothing is recorded and every field is zero.
+ */
+void artMetrics(const art *t, artTreeMetrics *metrics) {
+#if ART_METRICS
+    *metrics = t->metrics;
+#else
+    (void)t;
+    memset(metrics, 0, sizeof(*metrics));
+#endif
+}
+
+void artMetricsReset(art *t) {
+#if ART_METRICS
+    memset(&t->metrics, 0, sizeof(t->metrics));
+#else
+    (void)t;
+#endif
+}
+
+/**
+ * Returns the latency at percentile 'pct' (0 to 100) of a histogram, as
+ * the highest value of the bucket holding it, or 0 for an empty histogram.
+ */
+uint64_t artLatencyPercentile(const artLatencyHistogram *h, double pct) {
+    if (!h->count) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(pct / 100 * h->count + 0.5);
+    rank = rank < 1 ? 1 : rank > h->count ? h->count : rank;
+
+    uint64_t seen = 0;
+    int b;
+    for (b = 0; b < ART_METRICS_LATENCY_BUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    // Invert the bucketing: values below 8 are exact, then each power of
+    // two from 8 on is split into eight buckets
+    if (b < 8) {
+        return b;
+    }
+
+    const int exp = b / 8 + 2;
+    return ((uint64_t)(8 + b % 8 + 1) << (exp - 3)) - 1;
 }
 
 /* Copyright (c) 2012, Armon Dadgar
@@ -5,9 +5,17 @@
 #include <stdint.h>
 
 #include "artCommon.h"
+#include "artKey.h"
 
 __BEGIN_DECLS
 
+/* C++ sees the tree type as artTree, which leaves 'art' free for the
+ * namespace of art.hpp. Trees only cross the API by pointer, so both
+ * names denote the same thing. */
+#ifdef __cplusplus
+#define art artTree
+#endif
+
 typedef struct art art;
 typedef struct artLeaf artLeaf;
 
@@ -15,32 +23,218 @@ art *artNew(void);
 void artFree(art *t);
 
 void artInit(art *t);
+art *artNewFixed(uint32_t keyLen);
+void artInitFixed(art *t, uint32_t keyLen);
 void artFreeInner(art *t);
 
+/* Single writer, many readers. Once artRcuEnable() is called, every write
+ * copies the nodes it changes and then publishes a new root, so a reader
+ * never sees a node change under it and takes no locks. Each reader thread
+ * registers once and brackets its artSearch(), artIter*(), artMinimum()
+ * and similar calls, and any use of leaves they return, with
+ * artRcuReadLock() and artRcuReadUnlock(). Replaced nodes are freed once
+ * every reader that could still see them has unlocked.
+ *
+ * Writes must be serialized by the caller. artDeleteRange() and
+ * artDeletePrefix() delete nothing and return 0 in this mode, and
+ * artSplitAt() moves nothing and returns a NULL right tree. */
+typedef struct artRcuReader artRcuReader;
+
+bool artRcuEnable(art *t);
+artRcuReader *artRcuRegister(art *t);
+void artRcuUnregister(artRcuReader *r);
+void artRcuReadLock(artRcuReader *r);
+void artRcuReadUnlock(artRcuReader *r);
+void artRcuSynchronize(art *t);
+
 size_t artBytes(const art *t);
 size_t artNodes(const art *t);
 uint64_t artCount(const art *t);
 
+/* Memory breakdown of a tree, gathered in one walk by artStats().
+ * Histograms bucket value v into bucket 0 when v is 0, otherwise into
+ * bucket floor(log2(v)) + 1, so bucket b holds [2^(b-1), 2^b). */
+#define ART_STATS_NODE_TYPES 5
+#define ART_STATS_LOG_BUCKETS 33
+#define ART_STATS_MAX_DEPTH 64
+
+typedef struct artNodeStats {
+    uint32_t capacity;    /* child slots per node: 4, 16, 32, 48 or 256 */
+    uint64_t count;       /* nodes of this type */
+    uint64_t bytes;       /* bytes allocated for them */
+    uint64_t children;    /* children held; average is children / count */
+    uint64_t wastedBytes; /* bytes of their empty child slots */
+} artNodeStats;
+
+typedef struct artTreeStats {
+    artNodeStats nodes[ART_STATS_NODE_TYPES]; /* smallest type first */
+    uint64_t nodeBytes;   /* bytes of all inner nodes */
+    uint64_t wastedBytes; /* bytes of empty child slots in all nodes */
+    uint64_t leaves;
+    uint64_t leafBytes; /* bytes of all leaves, including their keys */
+    uint64_t keyBytes;  /* key bytes alone */
+    uint64_t keyLen[ART_STATS_LOG_BUCKETS];    /* histogram of key lengths */
+    uint64_t prefixLen[ART_STATS_LOG_BUCKETS]; /* compressed path lengths */
+    /* leaves by number of inner nodes above them; deeper ones go in the
+     * last bucket */
+    uint64_t depth[ART_STATS_MAX_DEPTH];
+    uint32_t maxDepth;
+} artTreeStats;
+
+void artStats(const art *t, artTreeStats *stats);
+
+/* Hot path counters, recorded only in ART_METRICS builds (otherwise
+ * artMetrics() reports zeros). Latencies go into log-linear buckets of
+ * eight per power of two, so a percentile is within 12.5% of the true
+ * value; durations past 2^34 ns share the last bucket. */
+#define ART_METRICS_LATENCY_BUCKETS 256
+
+typedef struct artLatencyHistogram {
+    uint64_t count;
+    uint64_t totalNs;
+    uint64_t buckets[ART_METRICS_LATENCY_BUCKETS];
+} artLatencyHistogram;
+
+typedef struct artTreeMetrics {
+    /* node resizes by the type being replaced, in artTreeStats.nodes
+     * order; a node4 shrinking means it collapsed into its only child */
+    uint64_t grows[ART_STATS_NODE_TYPES];
+    uint64_t shrinks[ART_STATS_NODE_TYPES];
+    uint64_t prefixSplits;  /* inserts splitting a compressed path */
+    uint64_t leafFallbacks; /* paths longer than a node stores inline,
+                               compared against a leaf instead */
+    uint64_t searchDepth[ART_STATS_MAX_DEPTH]; /* inner nodes visited */
+    artLatencyHistogram searchNs;
+    artLatencyHistogram insertNs;
+    artLatencyHistogram deleteNs;
+} artTreeMetrics;
+
+void artMetrics(const art *t, artTreeMetrics *metrics);
+void artMetricsReset(art *t);
+uint64_t artLatencyPercentile(const artLatencyHistogram *h, double pct);
+
 bool artInsert(art *t, const void *key, uint_fast32_t keyLen, void *value,
                void **oldValue);
 bool artInsertIncrement(art *t, const void *key, uint_fast32_t keyLen,
                         artIncrementDesc desc, artLeaf **usedLeaf);
+artLeaf *artInsertLeaf(art *t, const void *key, uint_fast32_t keyLen,
+                       bool *inserted);
+
+/* Callback of artUpsert(): 'value' is the key's value slot, or a NULL
+ * value to fill when 'found' is false. */
+typedef enum artUpsertOp {
+    ART_UPSERT_KEEP = 0, /* leave the key as it is now, or missing */
+    ART_UPSERT_STORE,    /* keep the key, adding it if it was missing */
+    ART_UPSERT_DELETE,   /* remove the key if it exists */
+} artUpsertOp;
+
+typedef artUpsertOp (*artUpsertFn)(void *ctx, void **value, bool found);
+
+artUpsertOp artUpsert(art *t, const void *key, uint_fast32_t keyLen,
+                      artUpsertFn fn, void *ctx);
+
+bool artAdd(art *t, const void *key, uint_fast32_t keyLen, artValue delta,
+            uint32_t mode);
+size_t artAddBatch(art *t, const void *const *keys, const uint32_t *keyLens,
+                   const artValue *deltas, size_t count, uint32_t mode);
 bool artDelete(art *t, const void *key, uint_fast32_t keyLen, void **value);
 bool artDeleteDecrement(art *t, const void *key, uint_fast32_t keyLen,
                         artIncrementDesc desc);
 bool artSearch(const art *t, const void *key, uint_fast32_t keyLen,
                void **value);
+artLeaf *artSearchLeaf(const art *t, const void *key, uint_fast32_t keyLen,
+                       void **value);
+
+/* Inline values: the bytes are copied into the key's leaf, so a lookup
+ * reaches them without a second allocation to chase. For such keys
+ * artSearch() and iteration callbacks get a pointer to the stored bytes,
+ * and artDelete() returns it already freed. A plain write to the key
+ * (artInsert(), artUpsert(), artAdd(), ...) replaces the inline value, so
+ * artSearchBlob() then reports a length of 0 and any pointer the write
+ * returns as the old value is freed as well. */
+bool artInsertBlob(art *t, const void *key, uint_fast32_t keyLen,
+                   const void *value, uint32_t valueLen);
+bool artSearchBlob(const art *t, const void *key, uint_fast32_t keyLen,
+                   const void **value, uint32_t *valueLen);
+
+uint64_t artDeleteRange(art *t, const void *lo, uint_fast32_t loLen,
+                        const void *hi, uint_fast32_t hiLen);
+uint64_t artDeletePrefix(art *t, const void *prefix, uint_fast32_t prefixLen);
+
+/* Splits only the nodes on the path of 'key' and moves the rest by pointer,
+ * but still walks the moved nodes once to move their share of the
+ * artCount(), artNodes() and artBytes() counters, so it costs O(moved
+ * keys). With ART_SUBTREE_COUNTS it walks whichever side is smaller. */
+uint64_t artSplitAt(art *t, const void *key, uint_fast32_t keyLen,
+                    art **right);
+
+/* Compaction: rebuilds every node at the smallest type that holds its
+ * children and moves nodes and leaves into fresh memory in key order, so
+ * a scan after heavy churn walks memory front to back. artCompactStep()
+ * does the same work in slices of about 'budgetNs' nanoseconds, resuming
+ * after the last key it moved; the tree may be changed between steps.
+ * Leaves move, so artLeaf pointers and blob values taken before either
+ * call are invalid afterwards. */
+void artCompact(art *t);
+bool artCompactStep(art *t, uint64_t budgetNs);
+
+uint64_t artCountPrefix(const art *t, const void *prefix,
+                        uint_fast32_t prefixLen);
+uint64_t artCountRange(const art *t, const void *lo, uint_fast32_t loLen,
+                       const void *hi, uint_fast32_t hiLen);
+uint64_t artRank(const art *t, const void *key, uint_fast32_t keyLen);
+artLeaf *artSelect(const art *t, uint64_t idx);
+
+artLeaf *artRandomLeaf(const art *t, uint64_t *state);
+size_t artRandomSample(const art *t, artLeaf **sample, size_t k,
+                       uint64_t *state);
 
 void *artLeafValue(artLeaf *l);
 size_t artLeafKey(artLeaf *l, void **key);
 void *artLeafKeyOnly(artLeaf *l);
+void **artLeafValueSlot(artLeaf *l);
 void artLeafIncrement(artLeaf *l);
 
 artLeaf *artMinimum(art *t);
 artLeaf *artMaximum(art *t);
+artLeaf *artLowerBound(const art *t, const void *key, uint_fast32_t keyLen);
+artLeaf *artUpperBound(const art *t, const void *key, uint_fast32_t keyLen);
+artLeaf *artPredecessor(const art *t, const void *key, uint_fast32_t keyLen);
 
 int artIter(art *t, artCallback cb, void *data);
 int artIterPrefix(const art *t, const void *prefix, uint_fast32_t prefixLen,
                   artCallback cb, void *data);
+int artIterRange(const art *t, const void *lo, uint_fast32_t loLen,
+                 const void *hi, uint_fast32_t hiLen, artCallback cb,
+                 void *data);
+
+/* Typed keys, stored with the artKey.h encodings as 8 byte keys. They are
+ * fastest in a tree created with artNewFixed(8), but may share any other
+ * non-fixed tree with keys of other lengths. Ranges include both bounds and
+ * callbacks receive the encoded key; decode it with artKeyGet*(). */
+bool artInsertU64(art *t, uint64_t key, void *value, void **oldValue);
+bool artSearchU64(const art *t, uint64_t key, void **value);
+bool artDeleteU64(art *t, uint64_t key, void **value);
+int artIterRangeU64(const art *t, uint64_t lo, uint64_t hi, artCallback cb,
+                    void *data);
+
+bool artInsertI64(art *t, int64_t key, void *value, void **oldValue);
+bool artSearchI64(const art *t, int64_t key, void **value);
+bool artDeleteI64(art *t, int64_t key, void **value);
+int artIterRangeI64(const art *t, int64_t lo, int64_t hi, artCallback cb,
+                    void *data);
+
+bool artInsertDouble(art *t, double key, void *value, void **oldValue);
+bool artSearchDouble(const art *t, double key, void **value);
+bool artDeleteDouble(art *t, double key, void **value);
+int artIterRangeDouble(const art *t, double lo, double hi, artCallback cb,
+                       void *data);
+
+int artIntersect(const art *a, const art *b, artCallback cb, void *data);
+int artDifference(const art *a, const art *b, artCallback cb, void *data);
+
+#ifdef __cplusplus
+#undef art
+#endif
 
 __END_DECLS
@@ -0,0 +1,527 @@
+#pragma once
+
+/* C++17 wrapper around the C tree.
+ *
+ *     art::map<uint64_t, Session> sessions;
+ *     sessions.try_emplace(id, user, now);
+ *     for (auto it = sessions.lower_bound(lo); it != sessions.end(); ++it) {
+ *         auto [id, session] = *it;
+ *         ...
+ *     }
+ *
+ * Keys are stored encoded by a key_codec. Codecs with a non-zero 'width'
+ * encode every key to that many bytes at compile time and the map uses a
+ * fixed-length tree (artNewFixed()), so integer keys take the fixed-width
+ * search path. Strings are stored with their NUL terminator unless the
+ * library is built with ART_BINARY_KEYS.
+ *
+ * Values that are trivially copyable and fit in a pointer are constructed
+ * directly in the leaf's value slot; anything else is built by 'Alloc' and
+ * the leaf points at it. Either way a value's address is stable until its
+ * key is erased or the map is compact()ed, which moves every leaf and so
+ * also invalidates iterators.
+ *
+ * Iterators hold only the current leaf. The C tree has no cursor, so each
+ * step seeks the neighbouring key from the root (artUpperBound() and
+ * artPredecessor()). That makes a step O(key length) rather than amortized
+ * O(1), but an iterator stays usable across inserts and erases of other
+ * keys. Keys are stored encoded, so there is no pair to refer to, and
+ * these are proxy iterators like those of std::vector<bool>. Dereferencing
+ * yields a pair of the decoded key and a reference to the value, by value.
+ * operator->() returns a small holder of that pair, so 'it->second' works
+ * but '&*it' is a temporary. They step both ways and std::reverse_iterator
+ * works over them, but algorithms that keep references from '*it' do not.
+ *
+ * Maps must not be used with artRcuEnable(), since values are changed in
+ * place. */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "art.h"
+
+namespace art {
+
+/* Codecs turn keys into bytes whose memcmp() order is the key order.
+ * encode() returns something with data() and size(); decode() rebuilds the
+ * key from a leaf. 'width' is the encoded size, or 0 if it varies. */
+template <class K, class Enable = void> struct key_codec;
+
+/* Big-endian, with the sign bit flipped for signed types, as in artKey.h */
+template <class K>
+struct key_codec<K, std::enable_if_t<std::is_integral_v<K>>> {
+    static constexpr uint32_t width = sizeof(K);
+    using unsigned_type = std::make_unsigned_t<K>;
+
+    struct bytes {
+        uint8_t b[sizeof(K)];
+        constexpr const uint8_t *data() const noexcept { return b; }
+        static constexpr uint32_t size() noexcept { return sizeof(K); }
+    };
+
+    static constexpr unsigned_type flip =
+        std::is_signed_v<K> ? unsigned_type(1) << (8 * sizeof(K) - 1) : 0;
+
+    static constexpr bytes encode(K key) noexcept {
+        const unsigned_type v = unsigned_type(key) ^ flip;
+        bytes out{};
+        for (uint32_t i = 0; i < sizeof(K); i++) {
+            out.b[i] = uint8_t(v >> (8 * (sizeof(K) - 1 - i)));
+        }
+        return out;
+    }
+
+    static constexpr K decode(const uint8_t *key, uint32_t) noexcept {
+        unsigned_type v = 0;
+        for (uint32_t i = 0; i < sizeof(K); i++) {
+            v = unsigned_type(v << 8 | key[i]);
+        }
+        return K(v ^ flip);
+    }
+};
+
+template <> struct key_codec<double> {
+    static constexpr uint32_t width = 8;
+
+    struct bytes {
+        uint8_t b[8];
+        const uint8_t *data() const noexcept { return b; }
+        static constexpr uint32_t size() noexcept { return 8; }
+    };
+
+    static bytes encode(double key) noexcept {
+        bytes out;
+        artKeyPutDouble(out.b, key);
+        return out;
+    }
+
+    static double decode(const uint8_t *key, uint32_t) noexcept {
+        return artKeyGetDouble(key);
+    }
+};
+
+/* Encoding borrows the string's own buffer, terminator included. */
+template <> struct key_codec<std::string> {
+    static constexpr uint32_t width = 0;
+    static constexpr uint32_t terminator = !ART_BINARY_KEYS;
+
+    static std::string_view encode(const std::string &key) noexcept {
+        return {key.c_str(), key.size() + terminator};
+    }
+
+    static std::string decode(const uint8_t *key, uint32_t len) {
+        return {reinterpret_cast<const char *>(key), len - terminator};
+    }
+};
+
+template <class K, class V, class KeyCodec = key_codec<K>,
+          class Alloc = std::allocator<V>>
+class map {
+    /* Small trivial values live in the leaf's value slot */
+    static constexpr bool inline_value = std::is_trivially_copyable_v<V> &&
+                                         sizeof(V) <= sizeof(void *) &&
+                                         alignof(V) <= alignof(void *);
+
+    using alloc_traits =
+        typename std::allocator_traits<Alloc>::template rebind_traits<V>;
+    using value_alloc = typename alloc_traits::allocator_type;
+
+  public:
+    using key_type = K;
+    using mapped_type = V;
+    using size_type = std::size_t;
+    using allocator_type = Alloc;
+
+    template <bool Const> class basic_iterator {
+        using map_ptr = std::conditional_t<Const, const map *, map *>;
+        using value_ref = std::conditional_t<Const, const V &, V &>;
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<K, V>;
+        using reference = std::pair<K, value_ref>;
+
+        /* operator->() needs an address, so the pair is kept in here */
+        struct pointer {
+            reference ref;
+            reference *operator->() noexcept { return &ref; }
+        };
+
+        basic_iterator() noexcept = default;
+        basic_iterator(map_ptr m, artLeaf *leaf) noexcept
+            : map_(m), leaf_(leaf) {}
+
+        /* Iterators convert to const iterators */
+        template <bool C = Const, class = std::enable_if_t<C>>
+        basic_iterator(const basic_iterator<false> &it) noexcept
+            : map_(it.map_), leaf_(it.leaf_) {}
+
+        K key() const {
+            void *key;
+            const size_t len = artLeafKey(leaf_, &key);
+            return KeyCodec::decode(static_cast<const uint8_t *>(key),
+                                    uint32_t(len));
+        }
+
+        value_ref value() const noexcept { return map::slot_value(leaf_); }
+
+        reference operator*() const { return {key(), value()}; }
+        pointer operator->() const { return {**this}; }
+
+        basic_iterator &operator++() noexcept {
+            void *key;
+            const size_t len = artLeafKey(leaf_, &key);
+            leaf_ = artUpperBound(map_->tree_.t, key, len);
+            return *this;
+        }
+
+        basic_iterator &operator--() noexcept {
+            if (!leaf_) {
+                leaf_ = map_->tree_.t ? artMaximum(map_->tree_.t) : nullptr;
+                return *this;
+            }
+
+            void *key;
+            const size_t len = artLeafKey(leaf_, &key);
+            leaf_ = artPredecessor(map_->tree_.t, key, len);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept {
+            basic_iterator old = *this;
+            ++*this;
+            return old;
+        }
+
+        basic_iterator operator--(int) noexcept {
+            basic_iterator old = *this;
+            --*this;
+            return old;
+        }
+
+        friend bool operator==(const basic_iterator &a,
+                               const basic_iterator &b) noexcept {
+            return a.leaf_ == b.leaf_;
+        }
+
+        friend bool operator!=(const basic_iterator &a,
+                               const basic_iterator &b) noexcept {
+            return a.leaf_ != b.leaf_;
+        }
+
+      private:
+        friend class map;
+        friend class basic_iterator<true>;
+
+        map_ptr map_ = nullptr;
+        artLeaf *leaf_ = nullptr;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    map() noexcept(noexcept(Alloc())) : map(Alloc()) {}
+    explicit map(const Alloc &alloc) noexcept : tree_(alloc) {}
+
+    map(const map &other)
+        : tree_(std::allocator_traits<Alloc>::
+                    select_on_container_copy_construction(other.allocator())) {
+        for (auto it = other.begin(); it != other.end(); ++it) {
+            try_emplace(it.key(), it.value());
+        }
+    }
+
+    /* Takes over the tree; 'other' is left empty without a tree */
+    map(map &&other) noexcept : tree_(other.allocator()) {
+        tree_.t = std::exchange(other.tree_.t, nullptr);
+    }
+
+    map &operator=(const map &other) {
+        if (this != &other) {
+            map copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    map &operator=(map &&other) noexcept {
+        if (this != &other) {
+            destroy();
+            tree_.t = std::exchange(other.tree_.t, nullptr);
+            allocator() = other.allocator();
+        }
+        return *this;
+    }
+
+    ~map() { destroy(); }
+
+    void swap(map &other) noexcept {
+        std::swap(tree_.t, other.tree_.t);
+        std::swap(allocator(), other.allocator());
+    }
+
+    allocator_type get_allocator() const noexcept { return allocator(); }
+
+    /* The underlying tree, or NULL before the first insert */
+    ::artTree *native_handle() noexcept { return tree_.t; }
+
+    size_type size() const noexcept { return tree_.t ? artCount(tree_.t) : 0; }
+    bool empty() const noexcept { return !size(); }
+
+    void clear() noexcept { destroy(); }
+
+    void compact() {
+        if (tree_.t) {
+            artCompact(tree_.t);
+        }
+    }
+
+    iterator begin() noexcept { return {this, first()}; }
+    iterator end() noexcept { return {this, nullptr}; }
+    const_iterator begin() const noexcept { return {this, first()}; }
+    const_iterator end() const noexcept { return {this, nullptr}; }
+    const_iterator cbegin() const noexcept { return begin(); }
+    const_iterator cend() const noexcept { return end(); }
+    reverse_iterator rbegin() noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() noexcept { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const noexcept {
+        return const_reverse_iterator(end());
+    }
+    const_reverse_iterator rend() const noexcept {
+        return const_reverse_iterator(begin());
+    }
+
+    iterator find(const K &key) noexcept { return {this, lookup(key)}; }
+    const_iterator find(const K &key) const noexcept {
+        return {this, lookup(key)};
+    }
+
+    bool contains(const K &key) const noexcept { return lookup(key); }
+    size_type count(const K &key) const noexcept { return contains(key); }
+
+    V &at(const K &key) {
+        artLeaf *l = lookup(key);
+        if (!l) {
+            throw std::out_of_range("art::map::at");
+        }
+        return slot_value(l);
+    }
+
+    const V &at(const K &key) const {
+        return const_cast<map *>(this)->at(key);
+    }
+
+    V &operator[](const K &key) { return try_emplace(key).first.value(); }
+
+    iterator lower_bound(const K &key) noexcept {
+        return {this, seek(key, artLowerBound)};
+    }
+    const_iterator lower_bound(const K &key) const noexcept {
+        return {this, seek(key, artLowerBound)};
+    }
+
+    iterator upper_bound(const K &key) noexcept {
+        return {this, seek(key, artUpperBound)};
+    }
+    const_iterator upper_bound(const K &key) const noexcept {
+        return {this, seek(key, artUpperBound)};
+    }
+
+    std::pair<iterator, iterator> equal_range(const K &key) noexcept {
+        iterator it = lower_bound(key);
+        return {it, holds(it.leaf_, key) ? std::next(it) : it};
+    }
+
+    std::pair<const_iterator, const_iterator>
+    equal_range(const K &key) const noexcept {
+        const_iterator it = lower_bound(key);
+        return {it, holds(it.leaf_, key) ? std::next(it) : it};
+    }
+
+    /* Builds the value from 'args' in place if 'key' is absent; otherwise
+     * 'args' are left untouched. */
+    template <class... Args>
+    std::pair<iterator, bool> try_emplace(const K &key, Args &&...args) {
+        const auto k = KeyCodec::encode(key);
+        bool inserted;
+        artLeaf *l = artInsertLeaf(tree(), k.data(), k.size(), &inserted);
+        if (inserted) {
+            try {
+                construct(artLeafValueSlot(l), std::forward<Args>(args)...);
+            } catch (...) {
+                artDelete(tree_.t, k.data(), k.size(), nullptr);
+                throw;
+            }
+        }
+        return {iterator(this, l), inserted};
+    }
+
+    std::pair<iterator, bool> insert(const std::pair<const K, V> &kv) {
+        return try_emplace(kv.first, kv.second);
+    }
+
+    template <class M>
+    std::pair<iterator, bool> insert_or_assign(const K &key, M &&value) {
+        auto res = try_emplace(key, std::forward<M>(value));
+        if (!res.second) {
+            res.first.value() = std::forward<M>(value);
+        }
+        return res;
+    }
+
+    size_type erase(const K &key) {
+        if (!tree_.t) {
+            return 0;
+        }
+
+        const auto k = KeyCodec::encode(key);
+        void *old;
+        if (!artDelete(tree_.t, k.data(), k.size(), &old)) {
+            return 0;
+        }
+
+        release(old);
+        return 1;
+    }
+
+    iterator erase(const_iterator pos) {
+        iterator next(this, pos.leaf_);
+        ++next;
+        void *key;
+        const size_t len = artLeafKey(pos.leaf_, &key);
+        void *old;
+        artDelete(tree_.t, key, len, &old);
+        release(old);
+        return next;
+    }
+
+  private:
+    ::artTree *tree() {
+        if (!tree_.t) {
+            tree_.t = KeyCodec::width ? artNewFixed(KeyCodec::width) : artNew();
+            if (!tree_.t) {
+                throw std::bad_alloc();
+            }
+        }
+        return tree_.t;
+    }
+
+    artLeaf *first() const noexcept {
+        return tree_.t ? artMinimum(tree_.t) : nullptr;
+    }
+
+    artLeaf *lookup(const K &key) const noexcept {
+        if (!tree_.t) {
+            return nullptr;
+        }
+
+        const auto k = KeyCodec::encode(key);
+        return artSearchLeaf(tree_.t, k.data(), k.size(), nullptr);
+    }
+
+    static bool holds(artLeaf *l, const K &key) noexcept {
+        if (!l) {
+            return false;
+        }
+
+        const auto k = KeyCodec::encode(key);
+        void *found;
+        const size_t len = artLeafKey(l, &found);
+        return len == k.size() && !std::memcmp(found, k.data(), len);
+    }
+
+    template <class Seek>
+    artLeaf *seek(const K &key, Seek fn) const noexcept {
+        if (!tree_.t) {
+            return nullptr;
+        }
+
+        const auto k = KeyCodec::encode(key);
+        return fn(tree_.t, k.data(), k.size());
+    }
+
+    static V &slot_value(artLeaf *l) noexcept {
+        void **slot = artLeafValueSlot(l);
+        if constexpr (inline_value) {
+            return *std::launder(reinterpret_cast<V *>(slot));
+        } else {
+            return *static_cast<V *>(*slot);
+        }
+    }
+
+    template <class... Args> void construct(void **slot, Args &&...args) {
+        if constexpr (inline_value) {
+            ::new (static_cast<void *>(slot)) V(std::forward<Args>(args)...);
+        } else {
+            value_alloc alloc(allocator());
+            V *v = alloc_traits::allocate(alloc, 1);
+            try {
+                alloc_traits::construct(alloc, v, std::forward<Args>(args)...);
+            } catch (...) {
+                alloc_traits::deallocate(alloc, v, 1);
+                throw;
+            }
+            *slot = v;
+        }
+    }
+
+    /* Frees a value artDelete() handed back */
+    void release(void *old) noexcept {
+        if constexpr (!inline_value) {
+            value_alloc alloc(allocator());
+            V *v = static_cast<V *>(old);
+            alloc_traits::destroy(alloc, v);
+            alloc_traits::deallocate(alloc, v, 1);
+        } else {
+            (void)old;
+        }
+    }
+
+    static int release_cb(void *data, const void *, uint32_t, void *value) {
+        static_cast<map *>(data)->release(value);
+        return 0;
+    }
+
+    void destroy() noexcept {
+        if (!tree_.t) {
+            return;
+        }
+
+        if constexpr (!inline_value) {
+            artIter(tree_.t, release_cb, this);
+        }
+        artFree(tree_.t);
+        tree_.t = nullptr;
+    }
+
+    Alloc &allocator() noexcept { return tree_; }
+    const Alloc &allocator() const noexcept { return tree_; }
+
+    /* The allocator is the base of the tree pointer so that an empty one
+     * takes no space, as [[no_unique_address]] only arrives in C++20 */
+    struct tree_holder : Alloc {
+        explicit tree_holder(const Alloc &alloc) noexcept : Alloc(alloc) {}
+        ::artTree *t = nullptr;
+    };
+
+    tree_holder tree_;
+};
+
+template <class K, class V, class C, class A>
+void swap(map<K, V, C, A> &a, map<K, V, C, A> &b) noexcept {
+    a.swap(b);
+}
+
+} // namespace art
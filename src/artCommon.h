@@ -3,6 +3,14 @@
 #include <stdint.h>
 __BEGIN_DECLS
 
+/* Treat keys as arbitrary bytes instead of relying on an implicit NUL
+ * terminator: keys may contain 0x00 and one key may be a prefix of
+ * another. Each inner node gets a slot for the leaf whose key ends at
+ * that node, growing the node header by 8 bytes. */
+#ifndef ART_BINARY_KEYS
+#define ART_BINARY_KEYS 0
+#endif
+
 typedef enum artIncrementDesc {
     ART_INCREMENT_REPLACE = 0,
     ART_INCREMENT_WHOLE,
@@ -22,9 +30,25 @@ typedef union artValue {
         int32_t a;
         int32_t b;
     } si;
+    int16_t i16[4]; /* lanes of ART_ADD_I16X4 */
 } artValue;
 
+/* How artAdd() treats a value: one of the lane layouts, optionally OR'd
+ * with the flags after it. */
+typedef enum artAddMode {
+    ART_ADD_I64 = 0, /* 'i' */
+    ART_ADD_I32X2,   /* 'si.a' and 'si.b' */
+    ART_ADD_I16X4,   /* 'i16[0]' to 'i16[3]' */
+    ART_ADD_LANES = 3,
+    ART_ADD_SATURATE = 1 << 2,    /* clamp each lane instead of wrapping */
+    ART_ADD_DELETE_ZERO = 1 << 3, /* remove the key once all lanes are 0 */
+} artAddMode;
+
+#ifdef __cplusplus
+static_assert(
+#else
 _Static_assert(
+#endif
     sizeof(artValue) == sizeof(uint64_t),
     "artValue is larger than we expect, are you sure you want it to be "
     "larger than 8 bytes?");
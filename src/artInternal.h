@@ -1,10 +1,73 @@
 #pragma once
 
-#include "artCommon.h"
+#include "art.h"
 __BEGIN_DECLS
 
-/* 'artType' must fit in 2 bits (max integer value is 3) */
-typedef enum artType { NODE4 = 0, NODE16, NODE48, NODE256 } artType;
+/* Keep the number of leaves below each inner node so counting, ranking and
+ * selecting keys run in O(key length) instead of walking subtrees.
+ * The count takes 8 bytes of each node's inline prefix. */
+#ifndef ART_SUBTREE_COUNTS
+#define ART_SUBTREE_COUNTS 0
+#endif
+
+/* Allocate inner nodes on cache line boundaries. The header and key bytes
+ * of a node4 or node16 then share its first line, so a find_child() hit
+ * touches at most one more line for the child pointer. A node48 still
+ * needs up to three lines: header, index byte and child pointer.
+ * In bench_art this cost 5-9% more bytes per key and was no faster, as
+ * aligned allocation is slower than malloc(), so it stays off. */
+#ifndef ART_CACHE_ALIGNED_NODES
+#define ART_CACHE_ALIGNED_NODES 0
+#endif
+
+#if ART_CACHE_ALIGNED_NODES
+#define ART_CACHE_LINE 64
+#define ART_NODE_ALIGN __attribute__((aligned(ART_CACHE_LINE)))
+#else
+#define ART_NODE_ALIGN
+#endif
+
+/* Count node resizes, prefix splits, search depths and operation
+ * latencies per tree for artMetrics(). Every search, insert and delete
+ * then reads the clock twice. */
+#ifndef ART_METRICS
+#define ART_METRICS 0
+#endif
+
+/* Store child references as 32-bit offsets into a process-wide node arena
+ * instead of 8-byte pointers, halving every child array (a node256 drops
+ * from 2 KB to 1 KB). Nodes and leaves are then allocated from the arena,
+ * which reserves 32 GB of address space up front and never returns freed
+ * blocks to the system; they are reused for later nodes and leaves. An
+ * insert that finds the arena full aborts with "art arena exhausted". */
+#ifndef ART_COMPRESSED_POINTERS
+#define ART_COMPRESSED_POINTERS 0
+#endif
+
+/* Back the node arena with 2 MB pages, so a descent through a large tree
+ * needs far fewer dTLB entries. A MAP_HUGETLB mapping is used when the
+ * preallocated huge page pool can hold the whole reservation; otherwise
+ * the arena is mapped with normal pages and madvise(MADV_HUGEPAGE) asks
+ * for transparent huge pages, which the kernel may or may not provide. */
+#ifndef ART_HUGE_PAGES
+#define ART_HUGE_PAGES 0
+#endif
+
+#if ART_HUGE_PAGES && !ART_COMPRESSED_POINTERS
+#error "ART_HUGE_PAGES needs the arena of ART_COMPRESSED_POINTERS"
+#endif
+
+#if ART_COMPRESSED_POINTERS
+#if ART_CACHE_ALIGNED_NODES
+#error "ART_COMPRESSED_POINTERS does not support ART_CACHE_ALIGNED_NODES"
+#endif
+typedef uint32_t artRef; /* arena offset / 8, leaf tag in bit 0, 0 is NULL */
+#else
+typedef struct artNode *artRef;
+#endif
+
+/* 'artType' must fit in 3 bits (max integer value is 7) */
+typedef enum artType { NODE4 = 0, NODE16, NODE32, NODE48, NODE256 } artType;
 
 /**
  * This struct is included as part of all the various node sizes
@@ -27,58 +90,94 @@ typedef struct artNode {
 #endif
     uint8_t partial[MAX_PREFIX_LEN];
 } artNode;
+#elif ART_SUBTREE_COUNTS
+#define MAX_PREFIX_LEN 5
+typedef struct artNode {
+    uint16_t type : 3;          /* one of the 'artType' enum values */
+    uint16_t childrenCount : 9; /* must be able to hold value 256 */
+    uint8_t partialLen; /* length of 'partial' (could be 4 bits, but less
+                           efficient) */
+    uint8_t partial[MAX_PREFIX_LEN];
+    uint64_t leafCount; /* number of leaves below this node */
+#if ART_BINARY_KEYS
+    artRef end; /* tagged leaf whose key ends at this node */
+#endif
+} artNode;
+
+_Static_assert(sizeof(artNode) == 16 + 8 * ART_BINARY_KEYS,
+               "Subtree counts should not grow the node header");
 #else
 /* Optimize MAX_PREFIX_LEN by reducing len and type to minimal required sizes */
-#define MAX_PREFIX_LEN 14
+#define MAX_PREFIX_LEN 13
 typedef struct artNode {
+    uint16_t type : 3;          /* one of the 'artType' enum values */
+    uint16_t childrenCount : 9; /* must be able to hold value 256 */
     uint8_t partialLen; /* length of 'partial' (could be 4 bits, but less
                            efficient) */
-    uint8_t type : 2;
-    uint8_t childrenCount : 6;
     uint8_t partial[MAX_PREFIX_LEN];
+#if ART_BINARY_KEYS
+    artRef end; /* tagged leaf whose key ends at this node */
+#endif
 } artNode;
 
 _Static_assert(
-    sizeof(artNode) == 16,
+    sizeof(artNode) == 16 + sizeof(artRef) * ART_BINARY_KEYS,
     "Are you sure you want to make artNode bigger than we expected?");
 #endif
 
 /**
  * Small node with only 4 children
  */
-typedef struct artNode4 {
+typedef struct ART_NODE_ALIGN artNode4 {
     artNode n;
     uint8_t keys[4];
-    artNode *children[4];
+    artRef children[4];
 } artNode4;
 
 /**
  * Node with 16 children
  */
-typedef struct artNode16 {
+typedef struct ART_NODE_ALIGN artNode16 {
     artNode n;
     /* 16 keys and children because 16 bytes loads nicely into a __m128i */
     /* (16 bytes * 8 bytes/byte == 128 bits == in-place __m128i vector) */
     uint8_t keys[16];
-    artNode *children[16];
+    artRef children[16];
 } artNode16;
 
+/**
+ * Node with 32 children, searched as two 16 byte vectors (or one 32 byte
+ * vector with AVX2). Fills the gap between node16 and the much larger
+ * node48 for the 17-32 child fanouts of hex and base64 key spaces.
+ */
+typedef struct ART_NODE_ALIGN artNode32 {
+    artNode n;
+    uint8_t keys[32];
+    artRef children[32];
+} artNode32;
+
 /**
  * Node with 48 children, but a full 256 byte field.
+ * 'present' has bit c set when key byte c has a child, for both node48
+ * and node256, so scans and min/max skip empty slots a word at a time.
+ * Its 32 bytes are 5% of a node48 and 1.5% of a node256, under 0.1 bytes
+ * per key in bench_art, for about 4x faster min/max on the words set.
  */
-typedef struct artNode48 {
+typedef struct ART_NODE_ALIGN artNode48 {
     artNode n;
+    uint64_t present[4];
     uint8_t keys[256];
-    artNode *children[48];
+    artRef children[48];
 } artNode48;
 
 /**
  * Full node with 256 children
  */
-typedef struct artNode256 {
+typedef struct ART_NODE_ALIGN artNode256 {
     artNode n;
+    uint64_t present[4];
     /* node256 has no keys and uses pointers directly for comparisons */
-    artNode *children[256];
+    artRef children[256];
 } artNode256;
 
 /**
@@ -94,9 +193,31 @@ struct artLeaf {
      * as needed. See function 'make_leaf' */
     artValue value;
     uint32_t keyLen;
+    uint32_t valueLen; /* bytes of an inline value, see artInsertBlob() */
     uint8_t key[];
 };
 
+/* Inline values are stored right after the key, with the leaf rounded up to
+ * a multiple of this. A new value that rounds to the same size is written
+ * over the old one in place. */
+#define ART_BLOB_GRANULE 16
+
+static inline size_t leafBytes(const uint32_t keyLen,
+                               const uint32_t valueLen) {
+    const size_t bytes = sizeof(artLeaf) + keyLen;
+    if (!valueLen) {
+        return bytes;
+    }
+
+    return (bytes + valueLen + ART_BLOB_GRANULE - 1) &
+           ~(size_t)(ART_BLOB_GRANULE - 1);
+}
+
+#define LEAF_BYTES(l) leafBytes((l)->keyLen, (l)->valueLen)
+
+// An inline value's pointer is the address of its own bytes
+#define LEAF_BLOB(l) ((l)->key + (l)->keyLen)
+
 typedef struct artKeySetLeaf {
     /* Also, leaves are allocated individually thus incurring even more
      * allocation overhead. We could create a slab/mempool of leaves to hand out
@@ -106,8 +227,16 @@ typedef struct artKeySetLeaf {
 } artKeySetLeaf;
 
 struct art {
-    artNode *root;
+    artRef root;
     uint64_t count;
+    uint64_t nodes; /* inner nodes, kept current by every alloc and free */
+    uint64_t bytes; /* bytes of all nodes and leaves, kept the same way */
+    uint32_t fixedKeyLen; /* 0 unless every key must have this length */
+    struct artRcu *rcu;   /* NULL unless artRcuEnable() was called */
+    struct artCompaction *compaction; /* an unfinished artCompactStep() */
+#if ART_METRICS
+    artTreeMetrics metrics;
+#endif
 };
 
 __END_DECLS
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+/* Order-preserving fixed-width key encodings.
+ *
+ * Integers are stored big-endian, signed integers with their sign bit
+ * flipped, and doubles as IEEE-754 bits with the sign bit flipped for
+ * positive values and every bit flipped for negative values. Comparing the
+ * encoded bytes with memcmp() then gives the numeric order, which is the
+ * order the tree iterates in.
+ *
+ * Each artKeyPut*() writes its value at 'dst' and returns the position just
+ * past it, so composite keys (tenant, timestamp, ...) are built by chaining
+ * calls into one buffer and sort by their components left to right:
+ *
+ *     uint8_t key[12];
+ *     artKeyPutI64(artKeyPutU32(key, tenant), timestamp);
+ *
+ * artKeyGet*() decode a component back from its position in a key. */
+
+static inline uint8_t *artKeyPutU32(uint8_t *dst, const uint32_t v) {
+    dst[0] = v >> 24;
+    dst[1] = v >> 16;
+    dst[2] = v >> 8;
+    dst[3] = v;
+    return dst + 4;
+}
+
+static inline uint8_t *artKeyPutU64(uint8_t *dst, const uint64_t v) {
+    dst[0] = v >> 56;
+    dst[1] = v >> 48;
+    dst[2] = v >> 40;
+    dst[3] = v >> 32;
+    dst[4] = v >> 24;
+    dst[5] = v >> 16;
+    dst[6] = v >> 8;
+    dst[7] = v;
+    return dst + 8;
+}
+
+static inline uint8_t *artKeyPutI32(uint8_t *dst, const int32_t v) {
+    return artKeyPutU32(dst, (uint32_t)v ^ 0x80000000U);
+}
+
+static inline uint8_t *artKeyPutI64(uint8_t *dst, const int64_t v) {
+    return artKeyPutU64(dst, (uint64_t)v ^ 0x8000000000000000ULL);
+}
+
+/* -0.0 is stored as 0.0 so both find the same key. NaNs sort after
+ * +infinity (or before -infinity when their sign bit is set). */
+static inline uint8_t *artKeyPutDouble(uint8_t *dst, const double v) {
+    const double normalized = v == 0 ? 0.0 : v;
+    uint64_t bits;
+    memcpy(&bits, &normalized, sizeof(bits));
+    bits = (bits & 0x8000000000000000ULL) ? ~bits
+                                          : bits | 0x8000000000000000ULL;
+    return artKeyPutU64(dst, bits);
+}
+
+static inline uint32_t artKeyGetU32(const uint8_t *src) {
+    return (uint32_t)src[0] << 24 | (uint32_t)src[1] << 16 |
+           (uint32_t)src[2] << 8 | src[3];
+}
+
+static inline uint64_t artKeyGetU64(const uint8_t *src) {
+    return (uint64_t)artKeyGetU32(src) << 32 | artKeyGetU32(src + 4);
+}
+
+static inline int32_t artKeyGetI32(const uint8_t *src) {
+    return (int32_t)(artKeyGetU32(src) ^ 0x80000000U);
+}
+
+static inline int64_t artKeyGetI64(const uint8_t *src) {
+    return (int64_t)(artKeyGetU64(src) ^ 0x8000000000000000ULL);
+}
+
+static inline double artKeyGetDouble(const uint8_t *src) {
+    uint64_t bits = artKeyGetU64(src);
+    bits = (bits & 0x8000000000000000ULL) ? bits & ~0x8000000000000000ULL
+                                          : ~bits;
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
@@ -0,0 +1,368 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "artSharded.h"
+
+/* Keys a merge cursor buffers per refill. Each refill is one seek. */
+#define SHARD_BATCH 64
+
+typedef struct artShard {
+    pthread_rwlock_t lock;
+    art *t;
+} artShard;
+
+struct artSharded {
+    artShard *shards;
+    uint32_t count;
+    uint32_t routeLen;
+    artShardMode mode;
+};
+
+/* Reads the routed bytes as a big-endian number, padding short keys with
+ * 'pad' so a range shard can be found for either end of a prefix. */
+static uint32_t routeRange(const artSharded *s, const uint8_t *key,
+                           uint_fast32_t keyLen, uint8_t pad) {
+    uint64_t v = 0;
+    for (uint32_t i = 0; i < s->routeLen; i++) {
+        v = v << 8 | (i < keyLen ? key[i] : pad);
+    }
+
+    return (v * s->count) >> (8 * s->routeLen);
+}
+
+static uint32_t route(const artSharded *s, const void *key_,
+                      uint_fast32_t keyLen) {
+    const uint8_t *key = key_;
+    if (s->mode == ART_SHARD_RANGE) {
+        return routeRange(s, key, keyLen, 0);
+    }
+
+    // FNV-1a over the routed bytes
+    const uint32_t n = keyLen < s->routeLen ? keyLen : s->routeLen;
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (uint32_t i = 0; i < n; i++) {
+        h = (h ^ key[i]) * 0x100000001B3ULL;
+    }
+
+    return (h ^ h >> 32) % s->count;
+}
+
+/**
+ * Creates a container of 'shards' trees routed by the first 'routeLen'
+ * bytes of each key, which must be between 1 and 4.
+ */
+artSharded *artShardedNew(uint32_t shards, uint32_t routeLen,
+                          artShardMode mode) {
+    assert(shards);
+    assert(routeLen >= 1 && routeLen <= 4);
+
+    artSharded *s = calloc(1, sizeof(*s));
+    if (!s) {
+        return NULL;
+    }
+
+    s->shards = calloc(shards, sizeof(*s->shards));
+    if (!s->shards) {
+        free(s);
+        return NULL;
+    }
+
+    s->count = shards;
+    s->routeLen = routeLen;
+    s->mode = mode;
+    for (uint32_t i = 0; i < shards; i++) {
+        s->shards[i].t = artNew();
+        if (!s->shards[i].t) {
+            // Free only the shards built so far
+            s->count = i;
+            artShardedFree(s);
+            return NULL;
+        }
+
+        pthread_rwlock_init(&s->shards[i].lock, NULL);
+    }
+
+    return s;
+}
+
+void artShardedFree(artSharded *s) {
+    for (uint32_t i = 0; i < s->count; i++) {
+        artFree(s->shards[i].t);
+        pthread_rwlock_destroy(&s->shards[i].lock);
+    }
+
+    free(s->shards);
+    free(s);
+}
+
+uint64_t artShardedCount(artSharded *s) {
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < s->count; i++) {
+        pthread_rwlock_rdlock(&s->shards[i].lock);
+        count += artCount(s->shards[i].t);
+        pthread_rwlock_unlock(&s->shards[i].lock);
+    }
+
+    return count;
+}
+
+size_t artShardedBytes(artSharded *s) {
+    size_t bytes = sizeof(*s) + s->count * sizeof(*s->shards);
+    for (uint32_t i = 0; i < s->count; i++) {
+        pthread_rwlock_rdlock(&s->shards[i].lock);
+        bytes += artBytes(s->shards[i].t);
+        pthread_rwlock_unlock(&s->shards[i].lock);
+    }
+
+    return bytes;
+}
+
+bool artShardedInsert(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void *value, void **oldValue) {
+    artShard *shard = &s->shards[route(s, key, keyLen)];
+    pthread_rwlock_wrlock(&shard->lock);
+    const bool added = artInsert(shard->t, key, keyLen, value, oldValue);
+    pthread_rwlock_unlock(&shard->lock);
+    return added;
+}
+
+bool artShardedSearch(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void **value) {
+    artShard *shard = &s->shards[route(s, key, keyLen)];
+    pthread_rwlock_rdlock(&shard->lock);
+    const bool found = artSearch(shard->t, key, keyLen, value);
+    pthread_rwlock_unlock(&shard->lock);
+    return found;
+}
+
+bool artShardedDelete(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void **value) {
+    artShard *shard = &s->shards[route(s, key, keyLen)];
+    pthread_rwlock_wrlock(&shard->lock);
+    const bool removed = artDelete(shard->t, key, keyLen, value);
+    pthread_rwlock_unlock(&shard->lock);
+    return removed;
+}
+
+/* =================================================
+ * Iteration
+ * ================================================ */
+
+/* A batch of the next keys of one shard in [lo, hi). The key pointers
+ * point into the shard's leaves, so they stay valid while its read lock
+ * is held. */
+typedef struct shardCursor {
+    art *t;
+    const void *hi;
+    uint32_t hiLen;
+    const uint8_t *keys[SHARD_BATCH];
+    uint32_t lens[SHARD_BATCH];
+    void *values[SHARD_BATCH];
+    uint32_t pos;
+    uint32_t count;
+    bool done;
+} shardCursor;
+
+static inline int compareKeys(const uint8_t *a, uint32_t aLen,
+                              const uint8_t *b, uint32_t bLen) {
+    const int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    return c ? c : (aLen > bLen) - (aLen < bLen);
+}
+
+static int fillCb(void *data, const void *key, uint32_t keyLen,
+                  void *value) {
+    shardCursor *c = data;
+    c->keys[c->count] = key;
+    c->lens[c->count] = keyLen;
+    c->values[c->count] = value;
+    return ++c->count == SHARD_BATCH;
+}
+
+/* Refills the batch with the keys after the current last one, or from
+ * 'lo' on the first fill. */
+static void cursorFill(shardCursor *c, const void *lo, uint32_t loLen) {
+    const uint8_t *after = c->count ? c->keys[c->count - 1] : NULL;
+    const uint32_t afterLen = c->count ? c->lens[c->count - 1] : 0;
+    if (after) {
+        lo = after;
+        loLen = afterLen;
+    }
+
+    c->pos = 0;
+    c->count = 0;
+    c->done = !artIterRange(c->t, lo, loLen, c->hi, c->hiLen, fillCb, c);
+
+    // The range starts at the previous last key, which was already seen
+    if (after && c->count && c->keys[0] == after) {
+        c->pos = 1;
+    }
+}
+
+static inline bool cursorLess(const shardCursor *a, const shardCursor *b) {
+    return compareKeys(a->keys[a->pos], a->lens[a->pos], b->keys[b->pos],
+                       b->lens[b->pos]) < 0;
+}
+
+static void heapDown(shardCursor **heap, uint32_t n, uint32_t i) {
+    for (;;) {
+        uint32_t least = i;
+        const uint32_t l = 2 * i + 1;
+        const uint32_t r = l + 1;
+        if (l < n && cursorLess(heap[l], heap[least])) {
+            least = l;
+        }
+        if (r < n && cursorLess(heap[r], heap[least])) {
+            least = r;
+        }
+        if (least == i) {
+            return;
+        }
+
+        shardCursor *tmp = heap[i];
+        heap[i] = heap[least];
+        heap[least] = tmp;
+        i = least;
+    }
+}
+
+/* K-way merge of every shard's [lo, hi) under all the read locks, taken in
+ * shard order so writers, which only ever hold one, cannot deadlock it. */
+static int mergeRange(artSharded *s, const void *lo, uint32_t loLen,
+                      const void *hi, uint32_t hiLen, artCallback cb,
+                      void *data) {
+    shardCursor *cursors = malloc(s->count * sizeof(*cursors));
+    shardCursor **heap = malloc(s->count * sizeof(*heap));
+    if (!cursors || !heap) {
+        free(heap);
+        free(cursors);
+        return -1;
+    }
+
+    uint32_t n = 0;
+    int res = 0;
+
+    for (uint32_t i = 0; i < s->count; i++) {
+        pthread_rwlock_rdlock(&s->shards[i].lock);
+    }
+
+    for (uint32_t i = 0; i < s->count; i++) {
+        shardCursor *c = &cursors[i];
+        c->t = s->shards[i].t;
+        c->hi = hi;
+        c->hiLen = hiLen;
+        c->count = 0;
+        cursorFill(c, lo, loLen);
+        if (c->pos < c->count) {
+            heap[n++] = c;
+        }
+    }
+
+    for (uint32_t i = n / 2; i-- > 0;) {
+        heapDown(heap, n, i);
+    }
+
+    while (n) {
+        shardCursor *c = heap[0];
+        res = cb(data, c->keys[c->pos], c->lens[c->pos], c->values[c->pos]);
+        if (res) {
+            break;
+        }
+
+        if (++c->pos == c->count && !c->done) {
+            cursorFill(c, NULL, 0);
+        }
+        if (c->pos == c->count) {
+            heap[0] = heap[--n];
+        }
+        heapDown(heap, n, 0);
+    }
+
+    for (uint32_t i = 0; i < s->count; i++) {
+        pthread_rwlock_unlock(&s->shards[i].lock);
+    }
+
+    free(heap);
+    free(cursors);
+    return res;
+}
+
+/* Range shards hold increasing slices of the key order, so walking
+ * [first, last] in turn yields keys in order. */
+static int walkShards(artSharded *s, uint32_t first, uint32_t last,
+                      const void *lo, uint32_t loLen, const void *hi,
+                      uint32_t hiLen, const void *prefix, uint32_t prefixLen,
+                      artCallback cb, void *data) {
+    int res = 0;
+    for (uint32_t i = first; i <= last && !res; i++) {
+        artShard *shard = &s->shards[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        res = prefix ? artIterPrefix(shard->t, prefix, prefixLen, cb, data)
+                     : artIterRange(shard->t, lo, loLen, hi, hiLen, cb, data);
+        pthread_rwlock_unlock(&shard->lock);
+    }
+
+    return res;
+}
+
+/**
+ * Iterates through the keys in [lo, hi) in key order; a NULL bound is
+ * unbounded. Range shards are visited one at a time, each under its own
+ * read lock; hash shards are merged under all of them.
+ * @return 0 on success, the return of the callback, or -1 if hash shards
+ * could not allocate their merge.
+ */
+int artShardedIterRange(artSharded *s, const void *lo, uint_fast32_t loLen,
+                        const void *hi, uint_fast32_t hiLen, artCallback cb,
+                        void *data) {
+    if (s->mode == ART_SHARD_HASH) {
+        return mergeRange(s, lo, loLen, hi, hiLen, cb, data);
+    }
+
+    const uint32_t first = lo ? route(s, lo, loLen) : 0;
+    const uint32_t last = hi ? route(s, hi, hiLen) : s->count - 1;
+    return walkShards(s, first, last, lo, loLen, hi, hiLen, NULL, 0, cb,
+                      data);
+}
+
+int artShardedIter(artSharded *s, artCallback cb, void *data) {
+    return artShardedIterRange(s, NULL, 0, NULL, 0, cb, data);
+}
+
+/**
+ * Iterates through the keys starting with 'prefix' in key order.
+ * @return 0 on success, the return of the callback, or -1 if hash shards
+ * could not allocate their merge.
+ */
+int artShardedIterPrefix(artSharded *s, const void *prefix_,
+                         uint_fast32_t prefixLen, artCallback cb,
+                         void *data) {
+    const uint8_t *prefix = prefix_;
+    if (s->mode == ART_SHARD_RANGE) {
+        return walkShards(s, routeRange(s, prefix, prefixLen, 0),
+                          routeRange(s, prefix, prefixLen, 0xFF), NULL, 0,
+                          NULL, 0, prefix, prefixLen, cb, data);
+    }
+
+    if (prefixLen >= s->routeLen) {
+        const uint32_t i = route(s, prefix, prefixLen);
+        return walkShards(s, i, i, NULL, 0, NULL, 0, prefix, prefixLen, cb,
+                          data);
+    }
+
+    // Shorter than routeLen: merge [prefix, next prefix), where the next
+    // prefix drops trailing 0xFF bytes and increments the last one
+    uint8_t next[4];
+    uint32_t nextLen = prefixLen;
+    memcpy(next, prefix, prefixLen);
+    while (nextLen && next[nextLen - 1] == 0xFF) {
+        nextLen--;
+    }
+    if (nextLen) {
+        next[nextLen - 1]++;
+    }
+
+    return mergeRange(s, prefix, prefixLen, nextLen ? next : NULL, nextLen,
+                      cb, data);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h> /* size_t */
+#include <stdint.h>
+
+#include "art.h"
+
+__BEGIN_DECLS
+
+#ifdef __cplusplus
+#define art artTree
+#endif
+
+/* K independent trees, each behind its own reader-writer lock, with keys
+ * routed by their first 'routeLen' bytes (1 to 4).
+ *
+ * ART_SHARD_RANGE splits the byte space into K contiguous ranges, so every
+ * shard holds a slice of the key order and iteration walks the shards in
+ * turn. ART_SHARD_HASH hashes the leading bytes, spreading skewed keys
+ * evenly; iteration then merges the shards, holding every shard's read
+ * lock, unless a prefix covers all routeLen bytes and so lives in a single
+ * shard. Keys shorter than routeLen route on the bytes they have.
+ *
+ * Callbacks run with shard locks held and must not modify the container. */
+typedef enum artShardMode {
+    ART_SHARD_RANGE = 0,
+    ART_SHARD_HASH,
+} artShardMode;
+
+typedef struct artSharded artSharded;
+
+artSharded *artShardedNew(uint32_t shards, uint32_t routeLen,
+                          artShardMode mode);
+void artShardedFree(artSharded *s);
+
+uint64_t artShardedCount(artSharded *s);
+size_t artShardedBytes(artSharded *s);
+
+bool artShardedInsert(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void *value, void **oldValue);
+bool artShardedSearch(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void **value);
+bool artShardedDelete(artSharded *s, const void *key, uint_fast32_t keyLen,
+                      void **value);
+
+int artShardedIter(artSharded *s, artCallback cb, void *data);
+int artShardedIterPrefix(artSharded *s, const void *prefix,
+                         uint_fast32_t prefixLen, artCallback cb, void *data);
+int artShardedIterRange(artSharded *s, const void *lo, uint_fast32_t loLen,
+                        const void *hi, uint_fast32_t hiLen, artCallback cb,
+                        void *data);
+
+#ifdef __cplusplus
+#undef art
+#endif
+
+__END_DECLS
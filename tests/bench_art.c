@@ -0,0 +1,890 @@
+/* Microbenchmarks for the tree.
+ *
+ *     bench_art [-b] [-f text|csv|json] [-n keys] [-q queries] [-s seed]
+ *               [-d dir] [dataset...]
+ *
+ * Each dataset is loaded (or generated) up front, then timed through
+ * insert, search hit, search miss, prefix iteration, full iteration,
+ * min/max and delete on a fresh tree. Every row reports ns/op, throughput
+ * and the p50/p99/p99.9 latency of one op in SAMPLE_STRIDE, less the cost
+ * of reading the clock. The clock reads keep a sampled op from overlapping
+ * its neighbours' cache misses, so on large trees the percentiles can sit
+ * above ns/op. Inserts also report artBytes() per key.
+ *
+ * -b runs the same workloads against the baselines in bench_baselines.c
+ * (hash, sorted, btree) for comparison, skipping what a structure cannot
+ * do: the hash table has no ordered ops, the sorted array is bulk loaded
+ * in one timed qsort() and neither it nor the B+-tree deletes. -f csv or
+ * -f json prints one record per row instead of the table.
+ *
+ * Datasets: words and uuid are read from tests/ (or -d), capped at -n
+ * lines; random, sequential and prefix generate -n keys. Searches and
+ * deletes visit the keys in a shuffled order, inserts in dataset order.
+ *
+ * Where perf events are available (Linux, perf_event_paranoid <= 2) timed
+ * rows also report user-space dTLB load misses per op. Comparing a build
+ * with -DART_COMPRESSED_POINTERS=1 against one that adds
+ * -DART_HUGE_PAGES=1 on a large tree, e.g. "-n 20000000 random", shows
+ * what huge page backing of the node arena saves per lookup. */
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "../src/art.h"
+#include "../src/artKey.h"
+#include "bench_baselines.c"
+
+#define SAMPLE_STRIDE 8
+#define SHARED_PREFIX_LEN 64
+
+typedef struct keySet {
+    uint8_t *buf;
+    size_t *off;
+    uint32_t *len;
+    size_t count;
+    size_t used;
+    size_t cap;
+} keySet;
+
+typedef struct dataset {
+    const char *name;
+    keySet keys;
+    keySet misses;
+    size_t *order;
+    uint32_t prefixLen;
+} dataset;
+
+typedef struct benchResult {
+    const char *structure;
+    const char *dataset;
+    const char *op;
+    uint64_t ops;
+    uint64_t totalNs;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    bool sampled;
+    double bytesPerKey;
+    bool counted;
+    uint64_t tlbMisses;
+} benchResult;
+
+typedef struct benchCtx {
+    const char *structure;
+    art *t;
+    hashTable hash;
+    sortedArray sorted;
+    bTree btree;
+    const dataset *d;
+    uint64_t found;
+} benchCtx;
+
+typedef void (*benchOp)(benchCtx *ctx, size_t i);
+
+typedef enum outputFormat {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} outputFormat;
+
+static uint64_t clockOverhead;
+static int tlbCounter = -1;
+static outputFormat format = FORMAT_TEXT;
+static bool firstRow = true;
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Smallest gap between two back-to-back clock reads, subtracted from each
+ * sampled op so the percentiles describe the op rather than the timer. */
+static uint64_t calibrateClock(void) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < 10000; i++) {
+        const uint64_t a = nowNs();
+        const uint64_t b = nowNs();
+        if (b - a < best) {
+            best = b - a;
+        }
+    }
+
+    return best;
+}
+
+/* Counts this thread's user-space dTLB load misses, leaving tlbCounter at
+ * -1 where perf events are unavailable. */
+static void openTlbCounter(void) {
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                  PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    tlbCounter = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static uint64_t readTlbMisses(void) {
+    uint64_t misses = 0;
+    if (tlbCounter >= 0 &&
+        read(tlbCounter, &misses, sizeof(misses)) != sizeof(misses)) {
+        misses = 0;
+    }
+
+    return misses;
+}
+
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void keySetAdd(keySet *s, const void *key, uint32_t len) {
+    if (s->used + len > s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1 << 20;
+        while (s->used + len > s->cap) {
+            s->cap *= 2;
+        }
+        s->buf = realloc(s->buf, s->cap);
+    }
+
+    if ((s->count & (s->count - 1)) == 0) {
+        const size_t n = s->count ? s->count * 2 : 1;
+        s->off = realloc(s->off, n * sizeof(*s->off));
+        s->len = realloc(s->len, n * sizeof(*s->len));
+    }
+
+    memcpy(s->buf + s->used, key, len);
+    s->off[s->count] = s->used;
+    s->len[s->count] = len;
+    s->used += len;
+    s->count++;
+}
+
+static inline const uint8_t *keyAt(const keySet *s, size_t i) {
+    return s->buf + s->off[i];
+}
+
+static void keySetFree(keySet *s) {
+    free(s->buf);
+    free(s->off);
+    free(s->len);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Lines are stored with their trailing NUL, as the tests do, so no key is a
+ * prefix of another. */
+static bool loadFile(dataset *d, const char *dir, const char *file,
+                     size_t limit) {
+    char path[4096];
+    char line[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, file);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+
+    while (d->keys.count < limit && fgets(line, sizeof(line), f)) {
+        const size_t len = strcspn(line, "\n");
+        line[len] = '\0';
+        keySetAdd(&d->keys, line, len + 1);
+    }
+
+    fclose(f);
+    return d->keys.count > 0;
+}
+
+/* A miss shares the length and most of the bytes of a real key but has the
+ * top bit of its first byte flipped, which no text line contains. */
+static void makeTextMisses(dataset *d) {
+    uint8_t buf[512];
+    for (size_t i = 0; i < d->keys.count; i++) {
+        const uint32_t len = d->keys.len[i];
+        memcpy(buf, keyAt(&d->keys, i), len);
+        buf[0] ^= 0x80;
+        keySetAdd(&d->misses, buf, len);
+    }
+}
+
+static void makeRandom(dataset *d, size_t n, uint64_t seed) {
+    uint8_t key[8];
+    uint64_t state = seed;
+    for (size_t i = 0; i < n; i++) {
+        artKeyPutU64(key, nextRandom(&state));
+        keySetAdd(&d->keys, key, sizeof(key));
+    }
+
+    state = ~seed;
+    for (size_t i = 0; i < n; i++) {
+        artKeyPutU64(key, nextRandom(&state));
+        keySetAdd(&d->misses, key, sizeof(key));
+    }
+}
+
+static void makeSequential(dataset *d, size_t n) {
+    uint8_t key[8];
+    for (size_t i = 0; i < n; i++) {
+        artKeyPutU64(key, i);
+        keySetAdd(&d->keys, key, sizeof(key));
+        artKeyPutU64(key, n + i);
+        keySetAdd(&d->misses, key, sizeof(key));
+    }
+}
+
+/* SHARED_PREFIX_LEN identical bytes followed by a random 64-bit suffix, so
+ * every lookup has to get through a long compressed path first. */
+static void makeSharedPrefix(dataset *d, size_t n, uint64_t seed) {
+    uint8_t key[SHARED_PREFIX_LEN + 8];
+    memset(key, 'p', SHARED_PREFIX_LEN);
+
+    uint64_t state = seed;
+    for (size_t i = 0; i < n; i++) {
+        artKeyPutU64(key + SHARED_PREFIX_LEN, nextRandom(&state));
+        keySetAdd(&d->keys, key, sizeof(key));
+    }
+
+    state = ~seed;
+    for (size_t i = 0; i < n; i++) {
+        artKeyPutU64(key + SHARED_PREFIX_LEN, nextRandom(&state));
+        keySetAdd(&d->misses, key, sizeof(key));
+    }
+}
+
+static void shuffleOrder(dataset *d, uint64_t seed) {
+    const size_t n = d->keys.count;
+    d->order = malloc(n * sizeof(*d->order));
+    for (size_t i = 0; i < n; i++) {
+        d->order[i] = i;
+    }
+
+    uint64_t state = seed;
+    for (size_t i = n; i > 1; i--) {
+        const size_t j = nextRandom(&state) % i;
+        const size_t tmp = d->order[i - 1];
+        d->order[i - 1] = d->order[j];
+        d->order[j] = tmp;
+    }
+}
+
+static bool loadDataset(dataset *d, const char *name, const char *dir,
+                        size_t n, uint64_t seed) {
+    memset(d, 0, sizeof(*d));
+    d->name = name;
+
+    if (!strcmp(name, "words")) {
+        if (!loadFile(d, dir, "words.txt", n)) {
+            return false;
+        }
+        makeTextMisses(d);
+        d->prefixLen = 3;
+    } else if (!strcmp(name, "uuid")) {
+        if (!loadFile(d, dir, "uuid.txt", n)) {
+            return false;
+        }
+        makeTextMisses(d);
+        d->prefixLen = 2;
+    } else if (!strcmp(name, "random")) {
+        makeRandom(d, n, seed);
+        d->prefixLen = 2;
+    } else if (!strcmp(name, "sequential")) {
+        makeSequential(d, n);
+        d->prefixLen = 7;
+    } else if (!strcmp(name, "prefix")) {
+        makeSharedPrefix(d, n, seed);
+        d->prefixLen = SHARED_PREFIX_LEN + 2;
+    } else {
+        fprintf(stderr, "unknown dataset: %s\n", name);
+        return false;
+    }
+
+    shuffleOrder(d, seed);
+    return true;
+}
+
+static void freeDataset(dataset *d) {
+    keySetFree(&d->keys);
+    keySetFree(&d->misses);
+    free(d->order);
+}
+
+
+static int compareU64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double pct) {
+    size_t idx = (size_t)(pct / 100.0 * n);
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void printHeader(void) {
+    switch (format) {
+    case FORMAT_TEXT:
+        printf("%-9s %-11s %-12s %10s %9s %9s %8s %8s %8s %8s\n",
+               "structure", "dataset", "op", "ops", "ns/op", "Mops/s", "p50",
+               "p99", "p99.9", "dTLB/op");
+        break;
+    case FORMAT_CSV:
+        printf("structure,dataset,op,ops,ns_per_op,mops,p50_ns,p99_ns,"
+               "p999_ns,bytes_per_key,dtlb_misses_per_op\n");
+        break;
+    case FORMAT_JSON:
+        printf("[");
+        break;
+    }
+}
+
+static void printFooter(void) {
+    if (format == FORMAT_JSON) {
+        printf("\n]\n");
+    }
+}
+
+static void printText(const benchResult *r, double nsPerOp, double mops,
+                      double tlbPerOp) {
+    printf("%-9s %-11s %-12s %10" PRIu64, r->structure, r->dataset, r->op,
+           r->ops);
+    if (r->bytesPerKey) {
+        printf(" keys %8.1f bytes/key\n", r->bytesPerKey);
+        return;
+    }
+
+    if (r->sampled) {
+        printf(" %9.1f %9.2f %8" PRIu64 " %8" PRIu64 " %8" PRIu64, nsPerOp,
+               mops, r->p50, r->p99, r->p999);
+    } else {
+        printf(" %9.1f %9.2f %8s %8s %8s", nsPerOp, mops, "-", "-", "-");
+    }
+    if (r->counted) {
+        printf(" %8.3f\n", tlbPerOp);
+    } else {
+        printf(" %8s\n", "-");
+    }
+}
+
+/* Fields a row does not have are left empty. */
+static void printCsv(const benchResult *r, double nsPerOp, double mops,
+                     double tlbPerOp) {
+    printf("%s,%s,%s,%" PRIu64 ",", r->structure, r->dataset, r->op, r->ops);
+    if (!r->bytesPerKey) {
+        printf("%.2f,%.4f", nsPerOp, mops);
+    } else {
+        printf(",");
+    }
+    if (r->sampled) {
+        printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64, r->p50, r->p99, r->p999);
+    } else {
+        printf(",,,");
+    }
+    if (r->bytesPerKey) {
+        printf(",%.2f", r->bytesPerKey);
+    } else {
+        printf(",");
+    }
+    if (r->counted) {
+        printf(",%.4f\n", tlbPerOp);
+    } else {
+        printf(",\n");
+    }
+}
+
+/* Fields a row does not have are left out. */
+static void printJson(const benchResult *r, double nsPerOp, double mops,
+                      double tlbPerOp) {
+    printf("%s\n  {\"structure\": \"%s\", \"dataset\": \"%s\", "
+           "\"op\": \"%s\", \"ops\": %" PRIu64,
+           firstRow ? "" : ",", r->structure, r->dataset, r->op, r->ops);
+    if (r->bytesPerKey) {
+        printf(", \"bytes_per_key\": %.2f}", r->bytesPerKey);
+        return;
+    }
+
+    printf(", \"ns_per_op\": %.2f, \"mops\": %.4f", nsPerOp, mops);
+    if (r->sampled) {
+        printf(", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+               ", \"p999_ns\": %" PRIu64,
+               r->p50, r->p99, r->p999);
+    }
+    if (r->counted) {
+        printf(", \"dtlb_misses_per_op\": %.4f", tlbPerOp);
+    }
+    printf("}");
+}
+
+static void printResult(const benchResult *r) {
+    const double nsPerOp = r->ops ? (double)r->totalNs / r->ops : 0;
+    const double mops = r->totalNs ? r->ops * 1000.0 / r->totalNs : 0;
+    const double tlbPerOp = r->ops ? (double)r->tlbMisses / r->ops : 0;
+
+    switch (format) {
+    case FORMAT_TEXT:
+        printText(r, nsPerOp, mops, tlbPerOp);
+        break;
+    case FORMAT_CSV:
+        printCsv(r, nsPerOp, mops, tlbPerOp);
+        break;
+    case FORMAT_JSON:
+        printJson(r, nsPerOp, mops, tlbPerOp);
+        break;
+    }
+    firstRow = false;
+}
+
+static void printMemory(const benchCtx *ctx, uint64_t count, size_t bytes) {
+    const benchResult r = {
+        .structure = ctx->structure,
+        .dataset = ctx->d->name,
+        .op = "memory",
+        .ops = count,
+        .bytesPerKey = count ? (double)bytes / count : 0,
+    };
+    printResult(&r);
+}
+
+/* Runs fn for i in [0, n), timing the whole loop for throughput and every
+ * SAMPLE_STRIDE-th call on its own for the percentiles. */
+static void runOps(benchCtx *ctx, const char *op, size_t n, benchOp fn) {
+    uint64_t *samples = malloc((n / SAMPLE_STRIDE + 1) * sizeof(*samples));
+    size_t nSamples = 0;
+
+    const uint64_t tlbStart = readTlbMisses();
+    const uint64_t start = nowNs();
+    for (size_t i = 0; i < n; i++) {
+        if (i % SAMPLE_STRIDE == 0) {
+            const uint64_t opStart = nowNs();
+            fn(ctx, i);
+            const uint64_t elapsed = nowNs() - opStart;
+            samples[nSamples++] =
+                elapsed > clockOverhead ? elapsed - clockOverhead : 0;
+        } else {
+            fn(ctx, i);
+        }
+    }
+    const uint64_t totalNs = nowNs() - start;
+    const uint64_t tlbMisses = readTlbMisses() - tlbStart;
+
+    benchResult r = {
+        .structure = ctx->structure,
+        .dataset = ctx->d->name,
+        .op = op,
+        .ops = n,
+        .totalNs = totalNs,
+        .sampled = nSamples > 0,
+        .counted = tlbCounter >= 0,
+        .tlbMisses = tlbMisses,
+    };
+    if (nSamples) {
+        qsort(samples, nSamples, sizeof(*samples), compareU64);
+        r.p50 = percentile(samples, nSamples, 50);
+        r.p99 = percentile(samples, nSamples, 99);
+        r.p999 = percentile(samples, nSamples, 99.9);
+    }
+    printResult(&r);
+    free(samples);
+}
+
+static inline const uint8_t *insertKey(const benchCtx *ctx, size_t i,
+                                       uint32_t *len) {
+    *len = ctx->d->keys.len[i];
+    return keyAt(&ctx->d->keys, i);
+}
+
+static inline const uint8_t *hitKey(const benchCtx *ctx, size_t i,
+                                    uint32_t *len) {
+    return insertKey(ctx, ctx->d->order[i], len);
+}
+
+static inline const uint8_t *missKey(const benchCtx *ctx, size_t i,
+                                     uint32_t *len) {
+    *len = ctx->d->misses.len[i];
+    return keyAt(&ctx->d->misses, i);
+}
+
+/* The prefix queries cycle through the keys in shuffled order and take the
+ * dataset's prefixLen leading bytes of each. */
+static inline const uint8_t *prefixKey(const benchCtx *ctx, size_t i,
+                                       uint32_t *len) {
+    const uint8_t *key = hitKey(ctx, i % ctx->d->keys.count, len);
+    if (*len > ctx->d->prefixLen) {
+        *len = ctx->d->prefixLen;
+    }
+    return key;
+}
+
+static int countCb(void *data, const void *key, uint32_t keyLen,
+                   void *value) {
+    (void)key;
+    (void)keyLen;
+    (void)value;
+    (*(uint64_t *)data)++;
+    return 0;
+}
+
+static void opInsert(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = insertKey(ctx, i, &len);
+    artInsert(ctx->t, key, len, (void *)(uintptr_t)(i + 1), NULL);
+}
+
+static void opSearchHit(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    void *value;
+    ctx->found += artSearch(ctx->t, key, len, &value);
+}
+
+static void opSearchMiss(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = missKey(ctx, i, &len);
+    void *value;
+    ctx->found += artSearch(ctx->t, key, len, &value);
+}
+
+static void opIterPrefix(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = prefixKey(ctx, i, &len);
+    artIterPrefix(ctx->t, key, len, countCb, &ctx->found);
+}
+
+static void opMinMax(benchCtx *ctx, size_t i) {
+    ctx->found += (i & 1 ? artMaximum(ctx->t) : artMinimum(ctx->t)) != NULL;
+}
+
+static void opDelete(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    ctx->found += artDelete(ctx->t, key, len, NULL);
+}
+
+static void opHashInsert(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = insertKey(ctx, i, &len);
+    hashInsert(&ctx->hash, key, len, (void *)(uintptr_t)(i + 1));
+}
+
+static void opHashSearchHit(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    void *value;
+    ctx->found += hashSearch(&ctx->hash, key, len, &value);
+}
+
+static void opHashSearchMiss(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = missKey(ctx, i, &len);
+    void *value;
+    ctx->found += hashSearch(&ctx->hash, key, len, &value);
+}
+
+static void opHashDelete(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    ctx->found += hashDelete(&ctx->hash, key, len);
+}
+
+static void opSortedSearchHit(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    void *value;
+    ctx->found += sortedSearch(&ctx->sorted, key, len, &value);
+}
+
+static void opSortedSearchMiss(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = missKey(ctx, i, &len);
+    void *value;
+    ctx->found += sortedSearch(&ctx->sorted, key, len, &value);
+}
+
+static void opSortedIterPrefix(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = prefixKey(ctx, i, &len);
+    sortedIterPrefix(&ctx->sorted, key, len, countCb, &ctx->found);
+}
+
+static void opSortedMinMax(benchCtx *ctx, size_t i) {
+    const sortedArray *s = &ctx->sorted;
+    if (s->count) {
+        const baseEntry *e = &s->entries[i & 1 ? s->count - 1 : 0];
+        ctx->found += e->key != NULL;
+    }
+}
+
+static void opBtreeInsert(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = insertKey(ctx, i, &len);
+    btreeInsert(&ctx->btree, key, len, (void *)(uintptr_t)(i + 1));
+}
+
+static void opBtreeSearchHit(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = hitKey(ctx, i, &len);
+    void *value;
+    ctx->found += btreeSearch(&ctx->btree, key, len, &value);
+}
+
+static void opBtreeSearchMiss(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = missKey(ctx, i, &len);
+    void *value;
+    ctx->found += btreeSearch(&ctx->btree, key, len, &value);
+}
+
+static void opBtreeIterPrefix(benchCtx *ctx, size_t i) {
+    uint32_t len;
+    const uint8_t *key = prefixKey(ctx, i, &len);
+    btreeIterPrefix(&ctx->btree, key, len, countCb, &ctx->found);
+}
+
+static void opBtreeMinMax(benchCtx *ctx, size_t i) {
+    const baseEntry *e =
+        i & 1 ? btreeMaximum(&ctx->btree) : btreeMinimum(&ctx->btree);
+    ctx->found += e != NULL;
+}
+
+/* One full scan in whichever structure ctx is timing. */
+static void iterAll(benchCtx *ctx, uint64_t *visited) {
+    if (!strcmp(ctx->structure, "art")) {
+        artIter(ctx->t, countCb, visited);
+    } else if (!strcmp(ctx->structure, "sorted")) {
+        sortedIter(&ctx->sorted, countCb, visited);
+    } else {
+        btreeIter(&ctx->btree, countCb, visited);
+    }
+}
+
+/* A full scan is timed as one block and reported per key visited. */
+static void runIterFull(benchCtx *ctx, int passes) {
+    uint64_t visited = 0;
+    const uint64_t tlbStart = readTlbMisses();
+    const uint64_t start = nowNs();
+    for (int p = 0; p < passes; p++) {
+        iterAll(ctx, &visited);
+    }
+
+    const benchResult r = {
+        .structure = ctx->structure,
+        .dataset = ctx->d->name,
+        .op = "iter",
+        .ops = visited,
+        .totalNs = nowNs() - start,
+        .counted = tlbCounter >= 0,
+        .tlbMisses = readTlbMisses() - tlbStart,
+    };
+    printResult(&r);
+}
+
+static void checkFound(const benchCtx *ctx, const char *op,
+                       uint64_t expected) {
+    if (ctx->found != expected) {
+        fprintf(stderr, "%s %s %s: expected %" PRIu64 ", got %" PRIu64 "\n",
+                ctx->structure, ctx->d->name, op, expected, ctx->found);
+        exit(1);
+    }
+}
+
+/* Runs one timed op and checks how many of its calls hit, unless expected
+ * is UINT64_MAX. */
+static void runChecked(benchCtx *ctx, const char *op, size_t n, benchOp fn,
+                       uint64_t expected) {
+    ctx->found = 0;
+    runOps(ctx, op, n, fn);
+    if (expected != UINT64_MAX) {
+        checkFound(ctx, op, expected);
+    }
+}
+
+static void benchArt(const dataset *d, size_t queries) {
+    const size_t n = d->keys.count;
+    benchCtx ctx = {.structure = "art", .t = artNew(), .d = d};
+
+    runOps(&ctx, "insert", n, opInsert);
+    const uint64_t count = artCount(ctx.t);
+    printMemory(&ctx, count, artBytes(ctx.t));
+
+    runChecked(&ctx, "search-hit", n, opSearchHit, n);
+    runChecked(&ctx, "search-miss", d->misses.count, opSearchMiss,
+               UINT64_MAX);
+    runChecked(&ctx, "iter-prefix", queries, opIterPrefix, UINT64_MAX);
+    runIterFull(&ctx, 3);
+    runChecked(&ctx, "min-max", queries, opMinMax, queries);
+    runChecked(&ctx, "delete", n, opDelete, count);
+
+    artFree(ctx.t);
+}
+
+static void benchHash(const dataset *d) {
+    const size_t n = d->keys.count;
+    benchCtx ctx = {.structure = "hash", .d = d};
+    hashInit(&ctx.hash, 16);
+
+    runOps(&ctx, "insert", n, opHashInsert);
+    const uint64_t count = ctx.hash.count;
+    printMemory(&ctx, count, hashBytes(&ctx.hash) + d->keys.used);
+
+    runChecked(&ctx, "search-hit", n, opHashSearchHit, n);
+    runChecked(&ctx, "search-miss", d->misses.count, opHashSearchMiss,
+               UINT64_MAX);
+    runChecked(&ctx, "delete", n, opHashDelete, count);
+
+    hashFree(&ctx.hash);
+}
+
+static void benchSorted(const dataset *d, size_t queries) {
+    const size_t n = d->keys.count;
+    benchCtx ctx = {.structure = "sorted", .d = d};
+
+    baseEntry *entries = malloc(n * sizeof(*entries));
+    for (size_t i = 0; i < n; i++) {
+        entries[i] = (baseEntry){keyAt(&d->keys, i), d->keys.len[i],
+                                 (void *)(uintptr_t)(i + 1)};
+    }
+
+    const uint64_t start = nowNs();
+    sortedBuild(&ctx.sorted, entries, n);
+    const benchResult build = {
+        .structure = ctx.structure,
+        .dataset = d->name,
+        .op = "build",
+        .ops = n,
+        .totalNs = nowNs() - start,
+    };
+    printResult(&build);
+    free(entries);
+    printMemory(&ctx, n, sortedBytes(&ctx.sorted) + d->keys.used);
+
+    runChecked(&ctx, "search-hit", n, opSortedSearchHit, n);
+    runChecked(&ctx, "search-miss", d->misses.count, opSortedSearchMiss,
+               UINT64_MAX);
+    runChecked(&ctx, "iter-prefix", queries, opSortedIterPrefix,
+               UINT64_MAX);
+    runIterFull(&ctx, 3);
+    runChecked(&ctx, "min-max", queries, opSortedMinMax, queries);
+
+    sortedFree(&ctx.sorted);
+}
+
+static void benchBtree(const dataset *d, size_t queries) {
+    const size_t n = d->keys.count;
+    benchCtx ctx = {.structure = "btree", .d = d};
+    btreeInit(&ctx.btree);
+
+    runOps(&ctx, "insert", n, opBtreeInsert);
+    printMemory(&ctx, ctx.btree.count, ctx.btree.bytes + d->keys.used);
+
+    runChecked(&ctx, "search-hit", n, opBtreeSearchHit, n);
+    runChecked(&ctx, "search-miss", d->misses.count, opBtreeSearchMiss,
+               UINT64_MAX);
+    runChecked(&ctx, "iter-prefix", queries, opBtreeIterPrefix, UINT64_MAX);
+    runIterFull(&ctx, 3);
+    runChecked(&ctx, "min-max", queries, opBtreeMinMax, queries);
+
+    btreeFree(&ctx.btree);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-b] [-f text|csv|json] [-n keys] [-q queries] "
+            "[-s seed] [-d dir] [dataset...]\n"
+            "datasets: words uuid random sequential prefix (default: all)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    static const char *allDatasets[] = {"words", "uuid", "random",
+                                        "sequential", "prefix"};
+    size_t n = 1000000;
+    size_t queries = 100000;
+    uint64_t seed = 42;
+    const char *dir = "tests";
+    bool baselines = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bf:n:q:s:d:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            baselines = true;
+            break;
+        case 'f':
+            if (!strcmp(optarg, "text")) {
+                format = FORMAT_TEXT;
+            } else if (!strcmp(optarg, "csv")) {
+                format = FORMAT_CSV;
+            } else if (!strcmp(optarg, "json")) {
+                format = FORMAT_JSON;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            n = strtoull(optarg, NULL, 10);
+            break;
+        case 'q':
+            queries = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    const char **names = allDatasets;
+    int count = sizeof(allDatasets) / sizeof(allDatasets[0]);
+    if (optind < argc) {
+        names = (const char **)argv + optind;
+        count = argc - optind;
+    }
+
+    clockOverhead = calibrateClock();
+    openTlbCounter();
+    printHeader();
+
+    int status = 0;
+    for (int i = 0; i < count; i++) {
+        dataset d;
+        if (loadDataset(&d, names[i], dir, n, seed)) {
+            benchArt(&d, queries);
+            if (baselines) {
+                benchHash(&d);
+                benchSorted(&d, queries);
+                benchBtree(&d, queries);
+            }
+        } else {
+            status = 1;
+        }
+        freeDataset(&d);
+    }
+
+    printFooter();
+    return status;
+}
@@ -0,0 +1,475 @@
+/* Comparison structures for bench_art: an open-addressing hash table, a
+ * sorted array and a B+-tree. None of them copies keys; entries point into
+ * the dataset, and bench_art adds the key bytes when it reports memory so
+ * the numbers line up with artBytes(), which counts the keys in the leaves.
+ *
+ * Keys compare like the tree orders them: bytewise, shorter first on a
+ * shared prefix. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/art.h"
+
+typedef struct baseEntry {
+    const uint8_t *key;
+    uint32_t len;
+    void *value;
+} baseEntry;
+
+static inline int compareKeys(const uint8_t *a, uint32_t aLen,
+                              const uint8_t *b, uint32_t bLen) {
+    const int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    return c ? c : (aLen > bLen) - (aLen < bLen);
+}
+
+static inline bool hasPrefix(const baseEntry *e, const uint8_t *prefix,
+                             uint32_t prefixLen) {
+    return e->len >= prefixLen && !memcmp(e->key, prefix, prefixLen);
+}
+
+/*
+ * Open-addressing hash table: linear probing, power of two capacity kept
+ * under 3/4 full, backward-shift deletion so no tombstones build up.
+ */
+
+typedef struct hashSlot {
+    uint64_t hash;
+    baseEntry e;
+} hashSlot;
+
+typedef struct hashTable {
+    hashSlot *slots;
+    size_t mask;
+    size_t count;
+} hashTable;
+
+static uint64_t hashKey(const uint8_t *key, uint32_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ len;
+    uint64_t w;
+    for (; len >= 8; key += 8, len -= 8) {
+        memcpy(&w, key, 8);
+        h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 29;
+    }
+
+    w = 0;
+    memcpy(&w, key, len);
+    h = (h ^ w) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 31);
+}
+
+static void hashInit(hashTable *h, size_t capacity) {
+    size_t cap = 16;
+    while (cap < capacity) {
+        cap *= 2;
+    }
+
+    h->slots = calloc(cap, sizeof(*h->slots));
+    h->mask = cap - 1;
+    h->count = 0;
+}
+
+static void hashFree(hashTable *h) {
+    free(h->slots);
+    memset(h, 0, sizeof(*h));
+}
+
+static size_t hashBytes(const hashTable *h) {
+    return (h->mask + 1) * sizeof(*h->slots) + sizeof(*h);
+}
+
+static hashSlot *hashFind(const hashTable *h, uint64_t hash,
+                          const uint8_t *key, uint32_t len) {
+    for (size_t i = hash & h->mask;; i = (i + 1) & h->mask) {
+        hashSlot *s = &h->slots[i];
+        if (!s->e.key) {
+            return s;
+        }
+        if (s->hash == hash && s->e.len == len &&
+            !memcmp(s->e.key, key, len)) {
+            return s;
+        }
+    }
+}
+
+static void hashGrow(hashTable *h) {
+    hashTable bigger;
+    hashInit(&bigger, (h->mask + 1) * 2);
+    for (size_t i = 0; i <= h->mask; i++) {
+        const hashSlot *s = &h->slots[i];
+        if (s->e.key) {
+            *hashFind(&bigger, s->hash, s->e.key, s->e.len) = *s;
+        }
+    }
+
+    bigger.count = h->count;
+    free(h->slots);
+    *h = bigger;
+}
+
+static bool hashInsert(hashTable *h, const uint8_t *key, uint32_t len,
+                       void *value) {
+    if ((h->count + 1) * 4 > (h->mask + 1) * 3) {
+        hashGrow(h);
+    }
+
+    const uint64_t hash = hashKey(key, len);
+    hashSlot *s = hashFind(h, hash, key, len);
+    const bool added = !s->e.key;
+    s->hash = hash;
+    s->e = (baseEntry){key, len, value};
+    h->count += added;
+    return added;
+}
+
+static bool hashSearch(const hashTable *h, const uint8_t *key, uint32_t len,
+                       void **value) {
+    const hashSlot *s = hashFind(h, hashKey(key, len), key, len);
+    if (!s->e.key) {
+        return false;
+    }
+
+    *value = s->e.value;
+    return true;
+}
+
+static bool hashDelete(hashTable *h, const uint8_t *key, uint32_t len) {
+    hashSlot *s = hashFind(h, hashKey(key, len), key, len);
+    if (!s->e.key) {
+        return false;
+    }
+
+    /* Pull back every later slot in the run whose home is not between the
+     * hole and itself, then clear whichever slot ends up empty. */
+    size_t hole = s - h->slots;
+    for (size_t i = (hole + 1) & h->mask; h->slots[i].e.key;
+         i = (i + 1) & h->mask) {
+        const size_t home = h->slots[i].hash & h->mask;
+        if (((i - home) & h->mask) >= ((i - hole) & h->mask)) {
+            h->slots[hole] = h->slots[i];
+            hole = i;
+        }
+    }
+
+    memset(&h->slots[hole], 0, sizeof(h->slots[hole]));
+    h->count--;
+    return true;
+}
+
+/*
+ * Sorted array: bulk loaded with qsort(), searched by binary search.
+ */
+
+typedef struct sortedArray {
+    baseEntry *entries;
+    size_t count;
+} sortedArray;
+
+static int compareEntries(const void *a, const void *b) {
+    const baseEntry *x = a;
+    const baseEntry *y = b;
+    return compareKeys(x->key, x->len, y->key, y->len);
+}
+
+static void sortedBuild(sortedArray *s, const baseEntry *entries,
+                        size_t count) {
+    s->entries = malloc(count * sizeof(*s->entries));
+    memcpy(s->entries, entries, count * sizeof(*s->entries));
+    s->count = count;
+    qsort(s->entries, count, sizeof(*s->entries), compareEntries);
+}
+
+static void sortedFree(sortedArray *s) {
+    free(s->entries);
+    memset(s, 0, sizeof(*s));
+}
+
+static size_t sortedBytes(const sortedArray *s) {
+    return s->count * sizeof(*s->entries) + sizeof(*s);
+}
+
+static size_t sortedLowerBound(const sortedArray *s, const uint8_t *key,
+                               uint32_t len) {
+    size_t lo = 0;
+    size_t hi = s->count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const baseEntry *e = &s->entries[mid];
+        if (compareKeys(e->key, e->len, key, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static bool sortedSearch(const sortedArray *s, const uint8_t *key,
+                         uint32_t len, void **value) {
+    const size_t i = sortedLowerBound(s, key, len);
+    if (i == s->count ||
+        compareKeys(s->entries[i].key, s->entries[i].len, key, len)) {
+        return false;
+    }
+
+    *value = s->entries[i].value;
+    return true;
+}
+
+static int sortedIterPrefix(const sortedArray *s, const uint8_t *prefix,
+                            uint32_t prefixLen, artCallback cb, void *data) {
+    for (size_t i = sortedLowerBound(s, prefix, prefixLen);
+         i < s->count && hasPrefix(&s->entries[i], prefix, prefixLen); i++) {
+        const baseEntry *e = &s->entries[i];
+        const int res = cb(data, e->key, e->len, e->value);
+        if (res) {
+            return res;
+        }
+    }
+
+    return 0;
+}
+
+static int sortedIter(const sortedArray *s, artCallback cb, void *data) {
+    return sortedIterPrefix(s, (const uint8_t *)"", 0, cb, data);
+}
+
+/*
+ * B+-tree: BTREE_FANOUT entries per leaf, leaves chained for scans. Nodes
+ * split when they fill up; there is no delete.
+ */
+
+#define BTREE_FANOUT 32
+
+typedef struct bNode {
+    bool leaf;
+    uint32_t count;
+} bNode;
+
+typedef struct bLeaf {
+    bNode n;
+    baseEntry entries[BTREE_FANOUT];
+    struct bLeaf *next;
+} bLeaf;
+
+/* keys[i] is the smallest key under children[i + 1]. */
+typedef struct bInner {
+    bNode n;
+    baseEntry keys[BTREE_FANOUT];
+    bNode *children[BTREE_FANOUT + 1];
+} bInner;
+
+typedef struct bTree {
+    bNode *root;
+    bLeaf *first;
+    size_t count;
+    size_t bytes;
+} bTree;
+
+static bLeaf *btreeNewLeaf(bTree *b) {
+    bLeaf *l = calloc(1, sizeof(*l));
+    l->n.leaf = true;
+    b->bytes += sizeof(*l);
+    return l;
+}
+
+static bInner *btreeNewInner(bTree *b) {
+    bInner *in = calloc(1, sizeof(*in));
+    b->bytes += sizeof(*in);
+    return in;
+}
+
+static void btreeInit(bTree *b) {
+    memset(b, 0, sizeof(*b));
+    b->first = btreeNewLeaf(b);
+    b->root = &b->first->n;
+    b->bytes += sizeof(*b);
+}
+
+static void btreeFreeNode(bNode *n) {
+    if (!n->leaf) {
+        const bInner *in = (const bInner *)n;
+        for (uint32_t i = 0; i <= n->count; i++) {
+            btreeFreeNode(in->children[i]);
+        }
+    }
+    free(n);
+}
+
+static void btreeFree(bTree *b) {
+    btreeFreeNode(b->root);
+    memset(b, 0, sizeof(*b));
+}
+
+/* First position in 'entries' whose key is >= key (upper: > key). */
+static uint32_t btreeBound(const baseEntry *entries, uint32_t count,
+                           const uint8_t *key, uint32_t len, bool upper) {
+    uint32_t lo = 0;
+    uint32_t hi = count;
+    while (lo < hi) {
+        const uint32_t mid = (lo + hi) / 2;
+        const int c = compareKeys(entries[mid].key, entries[mid].len, key, len);
+        if (c < 0 || (upper && c == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static bLeaf *btreeFindLeaf(const bTree *b, const uint8_t *key,
+                            uint32_t len) {
+    const bNode *n = b->root;
+    while (!n->leaf) {
+        const bInner *in = (const bInner *)n;
+        n = in->children[btreeBound(in->keys, n->count, key, len, true)];
+    }
+
+    return (bLeaf *)n;
+}
+
+/* Inserts into the subtree at 'n'. When 'n' fills up it is split, and the
+ * new right sibling and the key separating it are returned through
+ * 'right' and 'sep' for the parent to link in. */
+static bool btreeInsertRec(bTree *b, bNode *n, const baseEntry *e,
+                           bNode **right, baseEntry *sep) {
+    *right = NULL;
+
+    if (n->leaf) {
+        bLeaf *l = (bLeaf *)n;
+        const uint32_t pos =
+            btreeBound(l->entries, n->count, e->key, e->len, false);
+        if (pos < n->count && !compareKeys(l->entries[pos].key,
+                                           l->entries[pos].len, e->key,
+                                           e->len)) {
+            l->entries[pos].value = e->value;
+            return false;
+        }
+
+        memmove(&l->entries[pos + 1], &l->entries[pos],
+                (n->count - pos) * sizeof(*l->entries));
+        l->entries[pos] = *e;
+        if (++n->count < BTREE_FANOUT) {
+            return true;
+        }
+
+        bLeaf *r = btreeNewLeaf(b);
+        r->n.count = BTREE_FANOUT / 2;
+        memcpy(r->entries, &l->entries[BTREE_FANOUT / 2],
+               r->n.count * sizeof(*r->entries));
+        n->count = BTREE_FANOUT / 2;
+        r->next = l->next;
+        l->next = r;
+        *right = &r->n;
+        *sep = r->entries[0];
+        return true;
+    }
+
+    bInner *in = (bInner *)n;
+    const uint32_t idx = btreeBound(in->keys, n->count, e->key, e->len, true);
+    bNode *childRight;
+    baseEntry childSep;
+    const bool added =
+        btreeInsertRec(b, in->children[idx], e, &childRight, &childSep);
+    if (!childRight) {
+        return added;
+    }
+
+    memmove(&in->keys[idx + 1], &in->keys[idx],
+            (n->count - idx) * sizeof(*in->keys));
+    memmove(&in->children[idx + 2], &in->children[idx + 1],
+            (n->count - idx) * sizeof(*in->children));
+    in->keys[idx] = childSep;
+    in->children[idx + 1] = childRight;
+    if (++n->count < BTREE_FANOUT) {
+        return added;
+    }
+
+    /* The middle key moves up; the right half keeps the keys after it. */
+    const uint32_t mid = BTREE_FANOUT / 2;
+    bInner *r = btreeNewInner(b);
+    r->n.count = BTREE_FANOUT - mid - 1;
+    memcpy(r->keys, &in->keys[mid + 1], r->n.count * sizeof(*r->keys));
+    memcpy(r->children, &in->children[mid + 1],
+           (r->n.count + 1) * sizeof(*r->children));
+    n->count = mid;
+    *right = &r->n;
+    *sep = in->keys[mid];
+    return added;
+}
+
+static bool btreeInsert(bTree *b, const uint8_t *key, uint32_t len,
+                        void *value) {
+    const baseEntry e = {key, len, value};
+    bNode *right;
+    baseEntry sep;
+    const bool added = btreeInsertRec(b, b->root, &e, &right, &sep);
+    if (right) {
+        bInner *root = btreeNewInner(b);
+        root->n.count = 1;
+        root->keys[0] = sep;
+        root->children[0] = b->root;
+        root->children[1] = right;
+        b->root = &root->n;
+    }
+
+    b->count += added;
+    return added;
+}
+
+static bool btreeSearch(const bTree *b, const uint8_t *key, uint32_t len,
+                        void **value) {
+    const bLeaf *l = btreeFindLeaf(b, key, len);
+    const uint32_t pos = btreeBound(l->entries, l->n.count, key, len, false);
+    if (pos == l->n.count ||
+        compareKeys(l->entries[pos].key, l->entries[pos].len, key, len)) {
+        return false;
+    }
+
+    *value = l->entries[pos].value;
+    return true;
+}
+
+static int btreeIterPrefix(const bTree *b, const uint8_t *prefix,
+                           uint32_t prefixLen, artCallback cb, void *data) {
+    const bLeaf *l = btreeFindLeaf(b, prefix, prefixLen);
+    uint32_t pos = btreeBound(l->entries, l->n.count, prefix, prefixLen, false);
+    for (; l; l = l->next, pos = 0) {
+        for (; pos < l->n.count; pos++) {
+            const baseEntry *e = &l->entries[pos];
+            if (!hasPrefix(e, prefix, prefixLen)) {
+                return 0;
+            }
+
+            const int res = cb(data, e->key, e->len, e->value);
+            if (res) {
+                return res;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int btreeIter(const bTree *b, artCallback cb, void *data) {
+    return btreeIterPrefix(b, (const uint8_t *)"", 0, cb, data);
+}
+
+static const baseEntry *btreeMinimum(const bTree *b) {
+    return b->count ? &b->first->entries[0] : NULL;
+}
+
+static const baseEntry *btreeMaximum(const bTree *b) {
+    const bNode *n = b->root;
+    while (!n->leaf) {
+        n = ((const bInner *)n)->children[n->count];
+    }
+
+    return n->count ? &((const bLeaf *)n)->entries[n->count - 1] : NULL;
+}
@@ -24,6 +24,28 @@ int main(void) {
     tcase_add_test(tc1, test_artLong_prefix);
     tcase_add_test(tc1, test_artInsert_search_uuid);
     tcase_add_test(tc1, test_artMax_prefix_len_scan_prefix);
+    tcase_add_test(tc1, test_artIntersect_difference);
+    tcase_add_test(tc1, test_artDeleteRange_prefix_split);
+    tcase_add_test(tc1, test_artCount_rank_select);
+    tcase_add_test(tc1, test_artRandom_sample);
+    tcase_add_test(tc1, test_artTyped_keys);
+    tcase_add_test(tc1, test_artIterRange);
+    tcase_add_test(tc1, test_artFixed_keys);
+    tcase_add_test(tc1, test_artNode_grow_shrink);
+    tcase_add_test(tc1, test_artStats);
+    tcase_add_test(tc1, test_artRunning_counters);
+    tcase_add_test(tc1, test_artMetrics);
+    tcase_add_test(tc1, test_artSharded);
+    tcase_add_test(tc1, test_artRcu);
+    tcase_add_test(tc1, test_artSeek);
+    tcase_add_test(tc1, test_artBlob);
+    tcase_add_test(tc1, test_artUpsert);
+    tcase_add_test(tc1, test_artAdd);
+    tcase_add_test(tc1, test_artDeleteDecrement_child_leaf);
+    tcase_add_test(tc1, test_artCompact);
+#if ART_BINARY_KEYS
+    tcase_add_test(tc1, test_artBinary_keys);
+#endif
     tcase_set_timeout(tc1, 180);
 
     srunner_run_all(sr, CK_ENV);
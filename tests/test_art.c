@@ -1,11 +1,15 @@
 #include <fcntl.h>
 #include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "../deps/check-0.9.8/src/check.h"
 
 #include "../src/art.h"
+#include "../src/artSharded.h"
 
 START_TEST(test_artInit_and_destroy) {
     art *t = artNew();
@@ -470,3 +474,1574 @@ START_TEST(test_artMax_prefix_len_scan_prefix) {
     artFree(t);
 }
 END_TEST
+
+typedef struct {
+    const art *in;
+    const art *notIn;
+    uint64_t count;
+    char last[512];
+} set_data;
+
+static int test_set_cb(void *data, const void *k, uint32_t k_len, void *val) {
+    set_data *s = (set_data *)data;
+    void *found = NULL;
+    (void)val;
+
+    // Keys arrive in order, exist where expected, and are absent elsewhere
+    fail_unless(strcmp(s->last, k) < 0, "Key: %s Last: %s", k, s->last);
+    fail_unless(artSearch(s->in, k, k_len, &found));
+    fail_unless(!s->notIn || !artSearch(s->notIn, k, k_len, &found));
+    memcpy(s->last, k, k_len);
+    s->count++;
+    return 0;
+}
+
+START_TEST(test_artIntersect_difference) {
+    art *a = artNew();
+    art *b = artNew();
+
+    int len;
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+
+    // 'a' holds every word, 'b' holds every third word
+    uintptr_t line = 1, shared = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        fail_unless(true == artInsert(a, buf, len, (void *)line, NULL));
+        if (line % 3 == 0) {
+            fail_unless(true == artInsert(b, buf, len, (void *)line, NULL));
+            shared++;
+        }
+
+        line++;
+    }
+
+    // ...plus keys 'a' never sees
+    f = fopen("tests/uuid.txt", "r");
+    for (int i = 0; i < 1000 && fgets(buf, sizeof buf, f); i++) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        fail_unless(true == artInsert(b, buf, len, NULL, NULL));
+    }
+
+    set_data s = {.in = b, .notIn = NULL};
+    fail_unless(artIntersect(a, b, test_set_cb, &s) == 0);
+    fail_unless(s.count == shared, "Count: %" PRIu64, s.count);
+
+    set_data s2 = {.in = a, .notIn = b};
+    fail_unless(artDifference(a, b, test_set_cb, &s2) == 0);
+    fail_unless(s2.count == artCount(a) - shared, "Count: %" PRIu64,
+                s2.count);
+
+    set_data s3 = {.in = b, .notIn = a};
+    fail_unless(artDifference(b, a, test_set_cb, &s3) == 0);
+    fail_unless(s3.count == 1000, "Count: %" PRIu64, s3.count);
+
+    // Against an empty tree
+    art *empty = artNew();
+    set_data s4 = {.in = a, .notIn = NULL};
+    fail_unless(artIntersect(a, empty, test_set_cb, &s4) == 0);
+    fail_unless(s4.count == 0);
+    fail_unless(artDifference(a, empty, test_set_cb, &s4) == 0);
+    fail_unless(s4.count == artCount(a));
+
+    artFree(empty);
+    artFree(a);
+    artFree(b);
+}
+END_TEST
+
+static int test_count_cb(void *data, const void *k, uint32_t k_len,
+                         void *val) {
+    (void)k;
+    (void)k_len;
+    (void)val;
+    (*(uint64_t *)data)++;
+    return 0;
+}
+
+START_TEST(test_artDeleteRange_prefix_split) {
+    art *t = artNew();
+
+    int len;
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+
+    uint64_t un = 0, b = 0, fromM = 0, total = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        fail_unless(true == artInsert(t, buf, len, NULL, NULL));
+        un += strncmp(buf, "un", 2) == 0;
+        b += buf[0] == 'b';
+        fromM += strcmp(buf, "m") >= 0;
+        total++;
+    }
+
+    // Delete every word starting with "un"
+    fail_unless(artDeletePrefix(t, "un", 2) == un);
+    fail_unless(artCount(t) == total - un);
+    fail_unless(!artSearch(t, "undo", 5, NULL));
+    fail_unless(artSearch(t, "umbrella", 9, NULL));
+    fail_unless(artSearch(t, "uplift", 7, NULL));
+    fail_unless(artDeletePrefix(t, "un", 2) == 0);
+
+    // Delete [b, c)
+    fail_unless(artDeleteRange(t, "b", 1, "c", 1) == b);
+    fail_unless(!artSearch(t, "banana", 7, NULL));
+    fail_unless(artSearch(t, "azure", 6, NULL));
+    fail_unless(artSearch(t, "c", 2, NULL));
+    total -= un + b;
+
+    uint64_t iterated = 0;
+    fail_unless(artIter(t, test_count_cb, &iterated) == 0);
+    fail_unless(iterated == total);
+
+    // Split everything from "m" onward into a second tree
+    art *right = NULL;
+    fail_unless(artSplitAt(t, "m", 1, &right) == fromM - un);
+    fail_unless(artCount(t) + artCount(right) == total);
+    fail_unless(artSearch(t, "lemon", 6, NULL));
+    fail_unless(!artSearch(t, "melon", 6, NULL));
+    fail_unless(artSearch(right, "melon", 6, NULL));
+    fail_unless(strcmp((char *)artLeafKeyOnly(artMaximum(t)), "m") < 0);
+    fail_unless(strcmp((char *)artLeafKeyOnly(artMinimum(right)), "m") >= 0);
+
+    // Both halves remain fully usable
+    fail_unless(true == artInsert(right, "apple", 6, NULL, NULL));
+    fail_unless(artDeleteRange(right, NULL, 0, NULL, 0) == fromM - un + 1);
+    fail_unless(artCount(right) == 0);
+    fail_unless(!artMinimum(right));
+
+    artFree(right);
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artCount_rank_select) {
+    art *t = artNew();
+
+    int len;
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+
+    uint64_t a = 0, re = 0, mToP = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        fail_unless(true == artInsert(t, buf, len, NULL, NULL));
+        a += buf[0] == 'a';
+        re += strncmp(buf, "re", 2) == 0;
+        mToP += buf[0] >= 'm' && buf[0] < 'p';
+    }
+
+    fail_unless(artCountPrefix(t, "a", 1) == a);
+    fail_unless(artCountPrefix(t, "re", 2) == re);
+    fail_unless(artCountPrefix(t, "", 0) == artCount(t));
+    fail_unless(artCountPrefix(t, "zzzz", 4) == 0);
+    fail_unless(artCountRange(t, "m", 1, "p", 1) == mToP);
+    fail_unless(artCountRange(t, NULL, 0, NULL, 0) == artCount(t));
+    fail_unless(artCountRange(t, "p", 1, "m", 1) == 0);
+
+    // Rank and select are inverses of each other
+    fail_unless(artRank(t, "A", 2) == 0);
+    fail_unless(artSelect(t, 0) == artMinimum(t));
+    fail_unless(artSelect(t, artCount(t) - 1) == artMaximum(t));
+    fail_unless(artSelect(t, artCount(t)) == NULL);
+    for (uint64_t i = 0; i < artCount(t); i += 997) {
+        void *key;
+        size_t keyLen = artLeafKey(artSelect(t, i), &key);
+        fail_unless(artRank(t, key, keyLen) == i);
+    }
+
+    // Counts follow deletes
+    fail_unless(artDelete(t, "apple", 6, NULL));
+    fail_unless(artCountPrefix(t, "a", 1) == a - 1);
+    fail_unless(artDeletePrefix(t, "re", 2) == re);
+    fail_unless(artCountPrefix(t, "re", 2) == 0);
+    fail_unless(artCountRange(t, NULL, 0, NULL, 0) == artCount(t));
+
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artRandom_sample) {
+    art *t = artNew();
+    uint64_t state = 42;
+
+    fail_unless(artRandomLeaf(t, &state) == NULL);
+
+    // Skewed shape: one key alone under 'a', 99 keys sharing "bbb"
+    char key[8];
+    fail_unless(true == artInsert(t, "a", 2, (void *)0, NULL));
+    for (uintptr_t i = 1; i < 100; i++) {
+        snprintf(key, sizeof(key), "bbb%02d", (int)i);
+        fail_unless(true ==
+                    artInsert(t, key, strlen(key) + 1, (void *)i, NULL));
+    }
+
+    // Every key should be drawn about equally often
+    uint32_t hits[100] = {0};
+    for (int i = 0; i < 100000; i++) {
+        hits[(uintptr_t)artLeafValue(artRandomLeaf(t, &state))]++;
+    }
+
+    for (int i = 0; i < 100; i++) {
+        fail_unless(hits[i] > 700 && hits[i] < 1300, "Key %d hits %u", i,
+                    hits[i]);
+    }
+
+    // Samples are distinct and capped at the tree size
+    artLeaf *sample[128];
+    fail_unless(artRandomSample(t, sample, 10, &state) == 10);
+    fail_unless(artRandomSample(t, sample, 128, &state) == 100);
+    bool seen[100] = {false};
+    for (int i = 0; i < 100; i++) {
+        uintptr_t v = (uintptr_t)artLeafValue(sample[i]);
+        fail_unless(!seen[v]);
+        seen[v] = true;
+    }
+
+    artFree(t);
+}
+END_TEST
+
+typedef struct typedRange {
+    uint64_t count;
+    double prev;
+    bool ordered;
+} typedRange;
+
+static int typedRangeCb(void *data, const void *key, uint32_t keyLen,
+                        void *value) {
+    typedRange *r = data;
+    const double v = artKeyGetDouble(key);
+    fail_unless(keyLen == 8);
+    r->ordered &= !r->count || r->prev < v;
+    r->prev = v;
+    r->count++;
+    return 0;
+}
+
+static int countCb(void *data, const void *key, uint32_t keyLen,
+                   void *value) {
+    (*(uint64_t *)data)++;
+    return 0;
+}
+
+START_TEST(test_artTyped_keys) {
+    art *t = artNew();
+
+    // Signed keys iterate numerically, negatives first
+    const int64_t ints[] = {INT64_MIN, -70000, -1, 0, 1, 255, 256, INT64_MAX};
+    for (int i = 7; i >= 0; i--) {
+        fail_unless(true ==
+                    artInsertI64(t, ints[i], (void *)(uintptr_t)i, NULL));
+    }
+
+    for (int i = 0; i < 8; i++) {
+        void *v;
+        fail_unless(artSearchI64(t, ints[i], &v));
+        fail_unless((uintptr_t)v == (uintptr_t)i);
+        artLeaf *l = artSelect(t, i);
+        fail_unless(artKeyGetI64(artLeafKeyOnly(l)) == ints[i]);
+    }
+
+    uint64_t count = 0;
+    artIterRangeI64(t, -1, 255, countCb, &count);
+    fail_unless(count == 4);
+    fail_unless(artDeleteI64(t, -70000, NULL));
+    fail_unless(!artSearchI64(t, -70000, NULL));
+    artFreeInner(t);
+    artInit(t);
+
+    // Doubles, including both zeros and infinities
+    const double dbl[] = {-INFINITY, -1e300, -2.5, -0.0,
+                          1e-300,    0.5,    3,    INFINITY};
+    for (int i = 0; i < 8; i++) {
+        artInsertDouble(t, dbl[i], NULL, NULL);
+    }
+
+    fail_unless(artCount(t) == 8);
+    fail_unless(artSearchDouble(t, 0.0, NULL));
+    typedRange r = {.ordered = true};
+    artIterRangeDouble(t, -2.5, 3, typedRangeCb, &r);
+    fail_unless(r.ordered && r.count == 5);
+    artFreeInner(t);
+    artInit(t);
+
+    // Unsigned keys against a brute force range count
+    uint64_t vals[1000];
+    uint64_t x = 1;
+    for (int i = 0; i < 1000; i++) {
+        x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+        vals[i] = x >> (i % 48);
+        artInsertU64(t, vals[i], NULL, NULL);
+    }
+
+    for (int i = 0; i < 1000; i += 7) {
+        const uint64_t lo = vals[i] / 2;
+        const uint64_t hi = vals[i];
+        uint64_t expected = 0;
+        for (int j = 0; j < 1000; j++) {
+            bool dup = false;
+            for (int k = 0; k < j && !dup; k++) {
+                dup = vals[k] == vals[j];
+            }
+
+            expected += !dup && vals[j] >= lo && vals[j] <= hi;
+        }
+
+        count = 0;
+        artIterRangeU64(t, lo, hi, countCb, &count);
+        fail_unless(count == expected, "%" PRIu64 " != %" PRIu64, count,
+                    expected);
+    }
+
+    for (int i = 0; i < 1000; i++) {
+        fail_unless(artSearchU64(t, vals[i], NULL));
+        artDeleteU64(t, vals[i], NULL);
+    }
+
+    fail_unless(artCount(t) == 0);
+
+    // In a plain tree typed keys compare lengths like any other key
+    fail_unless(artInsert(t, "ABCD", 5, NULL, NULL));
+    fail_unless(!artSearchU64(t, 0x4142434400000000ULL, NULL));
+    fail_unless(!artDeleteU64(t, 0x4142434400000000ULL, NULL));
+    fail_unless(artDelete(t, "ABCD", 5, NULL));
+
+#if ART_BINARY_KEYS
+    // ...so they can share it with longer keys they are a prefix of
+    uint8_t longer[12];
+    memcpy(artKeyPutU64(longer, 42), "xyz", 4);
+    fail_unless(artInsert(t, longer, sizeof(longer), (void *)1, NULL));
+    fail_unless(artInsertU64(t, 42, (void *)2, NULL));
+    void *v = NULL;
+    fail_unless(artSearchU64(t, 42, &v) && (uintptr_t)v == 2);
+    fail_unless(artDeleteU64(t, 42, NULL));
+    fail_unless(!artSearchU64(t, 42, NULL));
+    fail_unless(artSearch(t, longer, sizeof(longer), &v) && (uintptr_t)v == 1);
+    fail_unless(artDelete(t, longer, sizeof(longer), NULL));
+#endif
+
+    // Composite keys sort by their components left to right
+    uint8_t a[12], b[12];
+    artKeyPutI64(artKeyPutU32(a, 7), -5);
+    artKeyPutI64(artKeyPutU32(b, 7), 3);
+    fail_unless(memcmp(a, b, sizeof(a)) < 0);
+    fail_unless(artKeyGetU32(a) == 7 && artKeyGetI64(a + 4) == -5);
+    artKeyPutI64(artKeyPutU32(b, 6), INT64_MAX);
+    fail_unless(memcmp(a, b, sizeof(a)) > 0);
+
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artIterRange) {
+    art *t = artNew();
+
+    int len;
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+
+    uint64_t mToP = 0, total = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        fail_unless(true == artInsert(t, buf, len, NULL, NULL));
+        mToP += buf[0] >= 'm' && buf[0] < 'p';
+        total++;
+    }
+
+    uint64_t count = 0;
+    fail_unless(artIterRange(t, "m", 1, "p", 1, countCb, &count) == 0);
+    fail_unless(count == mToP);
+    count = 0;
+    artIterRange(t, NULL, 0, NULL, 0, countCb, &count);
+    fail_unless(count == total);
+    count = 0;
+    artIterRange(t, "apple", 6, "apple\x01", 7, countCb, &count);
+    fail_unless(count == 1);
+    count = 0;
+    artIterRange(t, "p", 1, "m", 1, countCb, &count);
+    fail_unless(count == 0);
+
+    artFree(t);
+}
+END_TEST
+
+// Packs a textual uuid into its 16 raw bytes
+static void uuidBytes(const char *text, uint8_t *out) {
+    for (int i = 0; i < 16; text++) {
+        if (*text != '-') {
+            sscanf(text, "%2hhx", &out[i++]);
+            text++;
+        }
+    }
+}
+
+START_TEST(test_artFixed_keys) {
+    art *t = artNewFixed(16);
+
+    char buf[512];
+    uint8_t key[16];
+    FILE *f = fopen("tests/uuid.txt", "r");
+
+    uintptr_t line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        uuidBytes(buf, key);
+        fail_unless(true == artInsert(t, key, 16, (void *)line, NULL));
+        line++;
+    }
+
+    fail_unless(artCount(t) == line - 1);
+
+    // Byte order of the packed uuids matches the text order
+    uuidBytes("00026bda-e0ea-4cda-8245-522764e9f325", key);
+    fail_unless(memcmp(artLeafKeyOnly(artMinimum(t)), key, 16) == 0);
+
+    // Search for each line, deleting every other one
+    fseek(f, 0, SEEK_SET);
+    line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        uuidBytes(buf, key);
+        void *val = NULL;
+        fail_unless(artSearch(t, key, 16, &val));
+        fail_unless(line == (uintptr_t)val);
+        if (line % 2) {
+            fail_unless(artDelete(t, key, 16, NULL));
+            fail_unless(!artSearch(t, key, 16, NULL));
+        }
+
+        line++;
+    }
+
+    fail_unless(artCount(t) == (line - 1) / 2);
+
+    // Splitting keeps the fixed length
+    art *right;
+    uuidBytes("80000000-0000-0000-0000-000000000000", key);
+    artSplitAt(t, key, 16, &right);
+    fail_unless(artCount(t) + artCount(right) == (line - 1) / 2);
+    memcpy(key, artLeafKeyOnly(artMinimum(right)), 16);
+    fail_unless(key[0] == 0x80 && artSearch(right, key, 16, NULL));
+    artFree(right);
+    artFree(t);
+    fclose(f);
+
+    // Typed keys work in a matching fixed tree
+    t = artNewFixed(8);
+    for (uint64_t i = 0; i < 5000; i++) {
+        fail_unless(true == artInsertU64(t, i * 977, NULL, NULL));
+    }
+
+    uint8_t k[8];
+    artKeyPutU64(k, 977 * 4999);
+    fail_unless(artSearch(t, k, 8, NULL));
+    fail_unless(artSearchU64(t, 977 * 123, NULL));
+    fail_unless(!artSearchU64(t, 977 * 123 + 1, NULL));
+
+    // Keys of any other length are turned away without being read
+    artLeaf *l = (artLeaf *)1;
+    fail_unless(!artSearch(t, k, 7, NULL));
+    fail_unless(!artInsert(t, "short", 6, NULL, NULL));
+    fail_unless(!artInsertIncrement(t, "short", 6, ART_INCREMENT_WHOLE, &l));
+    fail_unless(!l);
+    fail_unless(!artInsertLeaf(t, "short", 6, NULL));
+    fail_unless(!artInsertBlob(t, "short", 6, "x", 1));
+    fail_unless(!artAdd(t, "short", 6, (artValue){.i = 1}, ART_ADD_I64));
+    fail_unless(!artDelete(t, k, 7, NULL));
+    fail_unless(!artDeleteDecrement(t, k, 7, ART_INCREMENT_WHOLE));
+    fail_unless(artCount(t) == 5000 && artSearch(t, k, 8, NULL));
+    artFree(t);
+}
+END_TEST
+
+#if ART_BINARY_KEYS
+START_TEST(test_artBinary_keys) {
+    art *t = artNew();
+
+    // Embedded NULs and keys that are prefixes of other keys
+    const struct {
+        const char *key;
+        uint32_t len;
+    } keys[] = {
+        {"", 0},       {"\0", 1},      {"\0\0", 2},  {"\0\1", 2},
+        {"a", 1},      {"a\0", 2},     {"a\0b", 3},  {"ab", 2},
+        {"abc", 3},    {"abcdefghijklmnopqrstuvwxyz", 26},
+        {"abcdefghijklmnopqrstuvwxyz0", 27},
+    };
+    const int count = sizeof(keys) / sizeof(*keys);
+
+    for (uintptr_t i = count; i-- > 0;) {
+        fail_unless(true ==
+                    artInsert(t, keys[i].key, keys[i].len, (void *)i, NULL));
+    }
+
+    fail_unless(artCount(t) == (uint64_t)count);
+    for (uintptr_t i = 0; i < (uintptr_t)count; i++) {
+        void *v;
+        fail_unless(artSearch(t, keys[i].key, keys[i].len, &v));
+        fail_unless((uintptr_t)v == i);
+
+        // Keys iterate in byte order with shorter keys first
+        void *key;
+        fail_unless(artLeafKey(artSelect(t, i), &key) == keys[i].len);
+        fail_unless(memcmp(key, keys[i].key, keys[i].len) == 0);
+    }
+
+    fail_unless(!artSearch(t, "abcd", 4, NULL));
+    fail_unless(!artSearch(t, "\0\0\0", 3, NULL));
+    fail_unless(artCountPrefix(t, "a", 1) == 7);
+    fail_unless(artCountPrefix(t, "\0", 1) == 3);
+
+    // An upsert unlinks an end slot key on its way back up
+    fail_unless(!artAdd(t, "a\0", 2, (artValue){.i = -5},
+                        ART_ADD_I64 | ART_ADD_DELETE_ZERO));
+    fail_unless(!artSearch(t, "a\0", 2, NULL));
+    fail_unless(artSearch(t, "a\0b", 3, NULL));
+    fail_unless(artCountPrefix(t, "a", 1) == 6);
+    fail_unless(artInsert(t, "a\0", 2, (void *)5, NULL));
+
+    // Removing a prefix key leaves the longer keys reachable
+    fail_unless(artDelete(t, "ab", 2, NULL));
+    fail_unless(artDelete(t, "", 0, NULL));
+    fail_unless(artSearch(t, "abc", 3, NULL));
+    fail_unless(artSearch(t, "a\0b", 3, NULL));
+    void *min;
+    fail_unless(artLeafKey(artMinimum(t), &min) == 1);
+
+    fail_unless(artDeletePrefix(t, "a", 1) == 6);
+    fail_unless(artCount(t) == 3);
+    for (int i = 1; i < 4; i++) {
+        fail_unless(artDelete(t, keys[i].key, keys[i].len, NULL));
+    }
+
+    fail_unless(artCount(t) == 0 && !artMinimum(t));
+    artFree(t);
+}
+END_TEST
+#endif
+
+// Checks that keys arrive in increasing order of their second byte
+static int ascending_cb(void *data, const void *key, uint32_t keyLen,
+                        void *value) {
+    int *last = data;
+    const int b = ((const uint8_t *)key)[1];
+    if (b <= *last) {
+        return 1;
+    }
+
+    *last = b;
+    return 0;
+}
+
+START_TEST(test_artNode_grow_shrink) {
+    art *t = artNew();
+    bool live[256] = {false};
+
+    // Grow one node through every type and back, checking all keys each step
+    char key[3] = {'x', 0, 0};
+    for (int i = 0; i < 256; i++) {
+        key[1] = i * 7 % 256;
+        fail_unless(true == artInsert(t, key, 3, (void *)(uintptr_t)i, NULL));
+        live[i * 7 % 256] = true;
+        for (int j = 0; j <= i; j++) {
+            void *v;
+            key[1] = j * 7 % 256;
+            fail_unless(artSearch(t, key, 3, &v));
+            fail_unless((uintptr_t)v == (uintptr_t)j);
+        }
+
+        fail_unless(artNodes(t) == (size_t)(i ? i + 2 : 1));
+        fail_unless(((uint8_t *)artLeafKeyOnly(artMinimum(t)))[1] == 0);
+    }
+
+    fail_unless(((uint8_t *)artLeafKeyOnly(artMaximum(t)))[1] == 255);
+    for (int i = 0; i < 256; i++) {
+        key[1] = i * 7 % 256;
+        fail_unless(artDelete(t, key, 3, NULL));
+        live[i * 7 % 256] = false;
+        for (int j = i + 1; j < 256; j++) {
+            key[1] = j * 7 % 256;
+            fail_unless(artSearch(t, key, 3, NULL));
+        }
+
+        fail_unless(artCount(t) == (uint64_t)(255 - i));
+
+        // Min, max and iteration skip the slots emptied so far
+        int lo = 0;
+        int hi = 255;
+        while (lo < 256 && !live[lo]) {
+            lo++;
+        }
+        while (hi >= 0 && !live[hi]) {
+            hi--;
+        }
+        if (lo < 256) {
+            fail_unless(((uint8_t *)artLeafKeyOnly(artMinimum(t)))[1] == lo);
+            fail_unless(((uint8_t *)artLeafKeyOnly(artMaximum(t)))[1] == hi);
+        }
+
+        int last = -1;
+        fail_unless(artIter(t, ascending_cb, &last) == 0);
+        fail_unless(last == (lo < 256 ? hi : -1));
+    }
+
+    fail_unless(!artMinimum(t));
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artStats) {
+    art *t = artNew();
+    artTreeStats s;
+
+    artStats(t, &s);
+    fail_unless(s.leaves == 0 && s.nodeBytes == 0 && s.maxDepth == 0);
+    fail_unless(s.nodes[4].capacity == 256);
+
+    // A single key is a leaf at the root
+    fail_unless(artInsert(t, "a", 2, NULL, NULL));
+    artStats(t, &s);
+    fail_unless(s.leaves == 1 && s.nodeBytes == 0);
+    fail_unless(s.leafBytes == artBytes(t));
+    fail_unless(s.depth[0] == 1 && s.keyLen[2] == 1);
+
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        artInsert(t, buf, len, NULL, NULL);
+    }
+
+    fclose(f);
+
+    // The breakdown adds up to the totals reported by the full walks
+    artStats(t, &s);
+    fail_unless(s.leaves == artCount(t));
+    fail_unless(s.nodeBytes + s.leafBytes == artBytes(t));
+
+    uint64_t nodes = 0;
+    uint64_t children = 0;
+    uint64_t wasted = 0;
+    for (int i = 0; i < ART_STATS_NODE_TYPES; i++) {
+        const artNodeStats *ns = &s.nodes[i];
+        fail_unless(ns->children <= ns->count * ns->capacity);
+        nodes += ns->count;
+        children += ns->children;
+        wasted += ns->wastedBytes;
+    }
+
+    fail_unless(nodes + s.leaves == artNodes(t));
+    fail_unless(children == nodes + s.leaves - 1);
+    fail_unless(wasted == s.wastedBytes && wasted < s.nodeBytes);
+
+    uint64_t keyLens = 0;
+    uint64_t prefixLens = 0;
+    uint64_t depths = 0;
+    for (int i = 0; i < ART_STATS_LOG_BUCKETS; i++) {
+        keyLens += s.keyLen[i];
+        prefixLens += s.prefixLen[i];
+    }
+
+    for (int i = 0; i < ART_STATS_MAX_DEPTH; i++) {
+        depths += s.depth[i];
+    }
+
+    fail_unless(keyLens == s.leaves && depths == s.leaves);
+    fail_unless(prefixLens == nodes);
+    fail_unless(s.maxDepth > 1 && s.maxDepth < ART_STATS_MAX_DEPTH);
+    fail_unless(s.depth[s.maxDepth] > 0 && s.depth[0] == 0);
+    fail_unless(s.keyBytes < s.leafBytes);
+
+    artFree(t);
+}
+END_TEST
+
+// Whether the running counters agree with a full walk of the tree
+static bool countersMatchWalk(const art *t) {
+    artTreeStats s;
+    artStats(t, &s);
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < ART_STATS_NODE_TYPES; i++) {
+        nodes += s.nodes[i].count;
+    }
+
+    return artBytes(t) == s.nodeBytes + s.leafBytes &&
+           artNodes(t) == nodes + s.leaves;
+}
+
+START_TEST(test_artRunning_counters) {
+    art *t = artNew();
+    fail_unless(artBytes(t) == 0 && artNodes(t) == 0);
+
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+    uintptr_t line = 0;
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        artInsert(t, buf, len, NULL, NULL);
+        if (++line % 10000 == 0) {
+            fail_unless(countersMatchWalk(t));
+        }
+    }
+
+    fail_unless(countersMatchWalk(t));
+
+    // Splits move their share of the counters to the new tree
+    const size_t bytes = artBytes(t);
+    art *right;
+    artSplitAt(t, "m", 1, &right);
+    fail_unless(countersMatchWalk(t) && countersMatchWalk(right));
+    fail_unless(artBytes(t) + artBytes(right) < bytes + 4096);
+
+    artDeletePrefix(t, "b", 1);
+    artDeleteRange(right, "p", 1, "s", 1);
+    fail_unless(countersMatchWalk(t) && countersMatchWalk(right));
+
+    // Either side of a split can be the one walked for the counters
+    art *most;
+    art *few;
+    artSplitAt(right, "n", 1, &most);
+    artSplitAt(most, "y", 1, &few);
+    fail_unless(countersMatchWalk(right) && countersMatchWalk(most) &&
+                countersMatchWalk(few));
+    artFree(most);
+    artFree(few);
+
+    // Deleting every key brings the counters back to zero
+    rewind(f);
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        artDelete(t, buf, len, NULL);
+        artDelete(right, buf, len, NULL);
+    }
+
+    fclose(f);
+    fail_unless(artBytes(t) == 0 && artNodes(t) == 0);
+    fail_unless(artBytes(right) == 0 && artNodes(right) == 0);
+
+    artFree(right);
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artMetrics) {
+    art *t = artNew();
+    artTreeMetrics m;
+
+    // Grow one node through every type, look every key up, shrink it back
+    char key[3] = {'x', 0, 0};
+    for (int i = 0; i < 256; i++) {
+        key[1] = i;
+        artInsert(t, key, 3, NULL, NULL);
+    }
+
+    for (int i = 0; i < 512; i++) {
+        key[1] = i;
+        fail_unless(artSearch(t, key, i < 256 ? 3 : 2, NULL) == (i < 256));
+    }
+
+    for (int i = 0; i < 256; i++) {
+        key[1] = i;
+        artDelete(t, key, 3, NULL);
+    }
+
+    artMetrics(t, &m);
+#if ART_METRICS
+    for (int i = 0; i < ART_STATS_NODE_TYPES - 1; i++) {
+        fail_unless(m.grows[i] == 1);
+    }
+
+    for (int i = 1; i < ART_STATS_NODE_TYPES; i++) {
+        fail_unless(m.shrinks[i] == 1);
+    }
+
+    fail_unless(m.insertNs.count == 256 && m.deleteNs.count == 256);
+    fail_unless(m.searchNs.count == 512);
+
+    uint64_t searches = 0;
+    for (int i = 0; i < ART_STATS_MAX_DEPTH; i++) {
+        searches += m.searchDepth[i];
+    }
+
+    fail_unless(searches == 512 && m.searchDepth[1] == 512);
+    fail_unless(artLatencyPercentile(&m.searchNs, 50) <=
+                artLatencyPercentile(&m.searchNs, 99));
+
+    artMetricsReset(t);
+    artMetrics(t, &m);
+#endif
+    fail_unless(m.searchNs.count == 0 && m.grows[0] == 0);
+
+    // Percentiles report the top of the bucket holding them
+    artLatencyHistogram h = {0};
+    fail_unless(artLatencyPercentile(&h, 50) == 0);
+    h.count = 100;
+    h.buckets[5] = 90;  /* exactly 5 ns */
+    h.buckets[63] = 10; /* 960 - 1023 ns */
+    fail_unless(artLatencyPercentile(&h, 50) == 5);
+    fail_unless(artLatencyPercentile(&h, 90) == 5);
+    fail_unless(artLatencyPercentile(&h, 99) == 1023);
+
+    artFree(t);
+}
+END_TEST
+
+// Keys collected from a plain tree, then checked off in order
+typedef struct keyList {
+    const void **keys;
+    uint32_t *lens;
+    size_t count;
+    size_t pos;
+} keyList;
+
+static int collectCb(void *data, const void *key, uint32_t keyLen,
+                     void *value) {
+    (void)value;
+    keyList *l = data;
+    l->keys[l->count] = key;
+    l->lens[l->count++] = keyLen;
+    return 0;
+}
+
+static int expectCb(void *data, const void *key, uint32_t keyLen,
+                    void *value) {
+    (void)value;
+    keyList *l = data;
+    if (l->pos == l->count || l->lens[l->pos] != keyLen ||
+        memcmp(l->keys[l->pos], key, keyLen)) {
+        return 1;
+    }
+
+    l->pos++;
+    return 0;
+}
+
+START_TEST(test_artSharded) {
+    const artShardMode modes[] = {ART_SHARD_RANGE, ART_SHARD_HASH};
+    const char *prefixes[] = {"", "a", "ab", "abs", "q", "zz", "\xff"};
+    char buf[512];
+
+    for (int m = 0; m < 2; m++) {
+        art *t = artNew();
+        artSharded *s = artShardedNew(7, 2, modes[m]);
+        FILE *f = fopen("tests/words.txt", "r");
+
+        uintptr_t line = 1;
+        while (fgets(buf, sizeof buf, f)) {
+            const int len = strlen(buf);
+            buf[len - 1] = '\0';
+            artInsert(t, buf, len, (void *)line, NULL);
+            fail_unless(artShardedInsert(s, buf, len, (void *)line, NULL));
+            line++;
+        }
+        fclose(f);
+
+        fail_unless(artShardedCount(s) == artCount(t));
+        fail_unless(artShardedBytes(s) > artBytes(t) / 2);
+
+        keyList l = {malloc(line * sizeof(void *)),
+                     malloc(line * sizeof(uint32_t)), 0, 0};
+        for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+            const uint32_t len = strlen(prefixes[i]);
+            l.count = l.pos = 0;
+            artIterPrefix(t, prefixes[i], len, collectCb, &l);
+            fail_unless(!artShardedIterPrefix(s, prefixes[i], len, expectCb,
+                                              &l));
+            fail_unless(l.pos == l.count, "mode %d prefix '%s': %zu of %zu",
+                        m, prefixes[i], l.pos, l.count);
+        }
+
+        l.count = l.pos = 0;
+        artIterRange(t, "cat", 4, "dog", 4, collectCb, &l);
+        fail_unless(!artShardedIterRange(s, "cat", 4, "dog", 4, expectCb, &l));
+        fail_unless(l.pos == l.count && l.count > 0);
+
+        // A callback stopping the iteration ends it with its return value
+        l.count = l.pos = 0;
+        artIter(t, collectCb, &l);
+        l.count = 1000;
+        fail_unless(artShardedIter(s, expectCb, &l) == 1);
+        fail_unless(l.pos == 1000);
+
+        // Delete every other word from both and compare again
+        for (size_t i = 0; i < line - 1; i += 2) {
+            fail_unless(artDelete(t, l.keys[i], l.lens[i], NULL));
+        }
+        l.count = 0;
+        artIter(t, collectCb, &l);
+
+        f = fopen("tests/words.txt", "r");
+        for (uintptr_t i = 1; fgets(buf, sizeof buf, f); i++) {
+            const int len = strlen(buf);
+            buf[len - 1] = '\0';
+            void *v = NULL;
+            if (!artSearch(t, buf, len, NULL)) {
+                fail_unless(artShardedDelete(s, buf, len, &v));
+                fail_unless((uintptr_t)v == i);
+            }
+            fail_unless(artShardedSearch(s, buf, len, &v) ==
+                        artSearch(t, buf, len, NULL));
+        }
+        fclose(f);
+
+        fail_unless(artShardedCount(s) == artCount(t));
+        l.pos = 0;
+        fail_unless(!artShardedIter(s, expectCb, &l));
+        fail_unless(l.pos == l.count);
+
+        free(l.keys);
+        free(l.lens);
+        artShardedFree(s);
+        artFree(t);
+    }
+}
+END_TEST
+
+// RCU readers: look up keys the writer never touches while it churns others
+typedef struct rcuShared {
+    art *t;
+    bool stop;
+    uint64_t misses;
+    uint64_t lookups;
+} rcuShared;
+
+static void *rcuReader(void *arg) {
+    rcuShared *sh = arg;
+    artRcuReader *r = artRcuRegister(sh->t);
+    char key[32];
+    uint64_t misses = 0;
+    uint64_t lookups = 0;
+
+    while (!__atomic_load_n(&sh->stop, __ATOMIC_RELAXED)) {
+        artRcuReadLock(r);
+        for (int i = 0; i < 1000; i += 7) {
+            snprintf(key, sizeof(key), "stable%d", i);
+            void *v = NULL;
+            if (!artSearch(sh->t, key, strlen(key) + 1, &v) ||
+                (uintptr_t)v != (uintptr_t)i + 1) {
+                misses++;
+            }
+            lookups++;
+        }
+
+        uint64_t n = 0;
+        artIterPrefix(sh->t, "stable", 6, test_count_cb, &n);
+        misses += n != 1000;
+        artRcuReadUnlock(r);
+    }
+
+    __atomic_fetch_add(&sh->misses, misses, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sh->lookups, lookups, __ATOMIC_RELAXED);
+    artRcuUnregister(r);
+    return NULL;
+}
+
+START_TEST(test_artRcu) {
+    art *t = artNew();
+    fail_unless(artRcuEnable(t));
+    char key[32];
+
+    for (uintptr_t i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "stable%d", (int)i);
+        fail_unless(artInsert(t, key, strlen(key) + 1, (void *)(i + 1), NULL));
+    }
+
+    // A leaf a reader holds outlives its deletion until the reader unlocks
+    artRcuReader *r = artRcuRegister(t);
+    artRcuReadLock(r);
+    artLeaf *held = artMinimum(t);
+    fail_unless(!strcmp(artLeafKeyOnly(held), "stable0"));
+    fail_unless(artDelete(t, "stable0", 8, NULL));
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "churn%d", i);
+        artInsert(t, key, strlen(key) + 1, NULL, NULL);
+        artDelete(t, key, strlen(key) + 1, NULL);
+    }
+    fail_unless(!strcmp(artLeafKeyOnly(held), "stable0"));
+    fail_unless(!artSearch(t, "stable0", 8, NULL));
+    artRcuReadUnlock(r);
+    artRcuUnregister(r);
+    artRcuSynchronize(t);
+    fail_unless(artInsert(t, "stable0", 8, (void *)1, NULL));
+    fail_unless(countersMatchWalk(t));
+
+    // Increments copy the leaf too
+    fail_unless(!artInsertIncrement(t, "counter", 8, ART_INCREMENT_WHOLE,
+                                    NULL));
+    fail_unless(artInsertIncrement(t, "counter", 8, ART_INCREMENT_WHOLE,
+                                   NULL));
+    void *v = NULL;
+    fail_unless(artSearch(t, "counter", 8, &v) && (uintptr_t)v == 2);
+    fail_unless(artDelete(t, "counter", 8, NULL));
+
+    // Concurrent readers never miss a key while the writer reshapes the
+    // nodes around it
+    rcuShared sh = {.t = t};
+    pthread_t readers[2];
+    for (int i = 0; i < 2; i++) {
+        pthread_create(&readers[i], NULL, rcuReader, &sh);
+    }
+
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 2000; i++) {
+            snprintf(key, sizeof(key), "stab%d", i * 7 + round);
+            artInsert(t, key, strlen(key) + 1, NULL, NULL);
+        }
+        for (int i = 0; i < 2000; i++) {
+            snprintf(key, sizeof(key), "stab%d", i * 7 + round);
+            artDelete(t, key, strlen(key) + 1, NULL);
+        }
+    }
+
+    __atomic_store_n(&sh.stop, true, __ATOMIC_RELAXED);
+    for (int i = 0; i < 2; i++) {
+        pthread_join(readers[i], NULL);
+    }
+
+    fail_unless(sh.misses == 0, "%" PRIu64 " misses in %" PRIu64 " lookups",
+                sh.misses, sh.lookups);
+    fail_unless(artCount(t) == 1000);
+    fail_unless(countersMatchWalk(t));
+
+    // Range deletes would edit nodes in place, so they refuse
+    fail_unless(artDeleteRange(t, NULL, 0, NULL, 0) == 0);
+    fail_unless(artDeletePrefix(t, "stable", 6) == 0);
+    art *right = t;
+    fail_unless(artSplitAt(t, "stable5", 7, &right) == 0 && !right);
+    fail_unless(artCount(t) == 1000);
+    artRcuSynchronize(t);
+    artFree(t);
+}
+END_TEST
+
+static int compareKeyBytes(const void *a, uint32_t aLen, const void *b,
+                           uint32_t bLen) {
+    const int c = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    return c ? c : (aLen > bLen) - (aLen < bLen);
+}
+
+static bool isKey(artLeaf *l, const keyList *list, size_t i) {
+    if (i >= list->count) {
+        return !l;
+    }
+
+    void *key;
+    const size_t len = l ? artLeafKey(l, &key) : 0;
+    return l && len == list->lens[i] && !memcmp(key, list->keys[i], len);
+}
+
+// Checks the seeks for 'probe' against a binary search of the sorted keys
+static bool seeksMatch(const art *t, const keyList *list, const void *probe,
+                       uint32_t probeLen) {
+    size_t lo = 0;
+    size_t hi = list->count;
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (compareKeyBytes(list->keys[mid], list->lens[mid], probe,
+                            probeLen) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    const bool exact =
+        lo < list->count &&
+        !compareKeyBytes(list->keys[lo], list->lens[lo], probe, probeLen);
+    return isKey(artLowerBound(t, probe, probeLen), list, lo) &&
+           isKey(artUpperBound(t, probe, probeLen), list, lo + exact) &&
+           isKey(artPredecessor(t, probe, probeLen), list,
+                 lo ? lo - 1 : SIZE_MAX);
+}
+
+START_TEST(test_artSeek) {
+    art *t = artNew();
+    fail_unless(!artLowerBound(t, "a", 2) && !artPredecessor(t, "a", 2));
+
+    int len;
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+    uintptr_t line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        len = strlen(buf);
+        buf[len - 1] = '\0';
+        artInsert(t, buf, len, (void *)line++, NULL);
+    }
+    fclose(f);
+
+#if ART_BINARY_KEYS
+    // Keys ending at inner nodes, including the empty key
+    const char *ends[] = {"", "a", "ab", "abc", "zy", "\xff"};
+    for (size_t i = 0; i < sizeof(ends) / sizeof(*ends); i++) {
+        artInsert(t, ends[i], strlen(ends[i]), NULL, NULL);
+    }
+#endif
+
+    keyList list = {.keys = malloc(artCount(t) * sizeof(*list.keys)),
+                    .lens = malloc(artCount(t) * sizeof(*list.lens))};
+    artIter(t, collectCb, &list);
+
+    uint8_t probe[512];
+    for (size_t i = 0; i < list.count; i++) {
+        const uint32_t n = list.lens[i];
+        memcpy(probe, list.keys[i], n);
+        fail_unless(seeksMatch(t, &list, probe, n), "Key %zu", i);
+        if (n) {
+            fail_unless(seeksMatch(t, &list, probe, n - 1), "Key %zu", i);
+            probe[n - 1] ^= 0x80;
+            fail_unless(seeksMatch(t, &list, probe, n), "Key %zu", i);
+        }
+
+        probe[n] = 0xff;
+        fail_unless(seeksMatch(t, &list, probe, n + 1), "Key %zu", i);
+    }
+
+    // Keys without a NUL end under the implicit '\0' child instead
+    art *stems = artNew();
+    const char *stemKeys[] = {"ab", "abc", "abd", "b", "bcd", "bc"};
+    for (size_t i = 0; i < sizeof(stemKeys) / sizeof(*stemKeys); i++) {
+        artInsert(stems, stemKeys[i], strlen(stemKeys[i]), NULL, NULL);
+    }
+
+    keyList stemList = {
+        .keys = malloc(artCount(stems) * sizeof(*stemList.keys)),
+        .lens = malloc(artCount(stems) * sizeof(*stemList.lens))};
+    artIter(stems, collectCb, &stemList);
+    for (size_t i = 0; i < stemList.count; i++) {
+        const uint32_t n = stemList.lens[i];
+        memcpy(probe, stemList.keys[i], n);
+        fail_unless(seeksMatch(stems, &stemList, probe, n), "Stem %zu", i);
+        fail_unless(seeksMatch(stems, &stemList, probe, n - 1), "Stem %zu", i);
+    }
+
+    free(stemList.keys);
+    free(stemList.lens);
+    artFree(stems);
+
+    // Leaves come back for in-place values, new ones starting at zero
+    bool inserted;
+    artLeaf *l = artInsertLeaf(t, "A", 2, &inserted);
+    fail_unless(!inserted && artLeafValue(l) == (void *)1);
+    const uint64_t count = artCount(t);
+    l = artInsertLeaf(t, "new key", 8, &inserted);
+    fail_unless(inserted && !artLeafValue(l) && artCount(t) == count + 1);
+    *artLeafValueSlot(l) = (void *)42;
+    void *v;
+    fail_unless(artSearch(t, "new key", 8, &v) && v == (void *)42);
+    fail_unless(artInsertLeaf(t, "new key", 8, &inserted) == l && !inserted);
+
+    free(list.keys);
+    free(list.lens);
+    artFree(t);
+}
+END_TEST
+
+typedef struct blobWalk {
+    const art *t;
+    uint64_t seen;
+} blobWalk;
+
+// Iteration hands out the same bytes the search finds
+static int blobCb(void *data, const void *key, uint32_t keyLen,
+                  void *value) {
+    blobWalk *w = data;
+    const void *stored;
+    if (!artSearchBlob(w->t, key, keyLen, &stored, NULL) || stored != value) {
+        return 1;
+    }
+
+    w->seen++;
+    return 0;
+}
+
+// Fills 'buf' with 'len' bytes derived from 'key' and 'salt'
+static void blobBytes(uint8_t *buf, uint32_t len, const char *key, int salt) {
+    for (uint32_t i = 0; i < len; i++) {
+        buf[i] = key[i % strlen(key)] + salt + i;
+    }
+}
+
+START_TEST(test_artBlob) {
+    art *t = artNew();
+    uint8_t value[300];
+    uint8_t expect[300];
+    char buf[512];
+    const void *stored;
+    uint32_t len;
+    int n = 0;
+
+    FILE *f = fopen("tests/words.txt", "r");
+    while (fgets(buf, sizeof buf, f) && n < 20000) {
+        buf[strlen(buf) - 1] = '\0';
+        blobBytes(value, n % 257, buf, 0);
+        fail_unless(artInsertBlob(t, buf, strlen(buf) + 1, value, n % 257));
+        n++;
+    }
+
+    fail_unless(countersMatchWalk(t));
+
+    // Rewrite every value: same size in place, longer ones move
+    rewind(f);
+    for (int i = 0; i < n && fgets(buf, sizeof buf, f); i++) {
+        buf[strlen(buf) - 1] = '\0';
+        const uint32_t keyLen = strlen(buf) + 1;
+        fail_unless(artSearchBlob(t, buf, keyLen, &stored, &len));
+        blobBytes(expect, len, buf, 0);
+        fail_unless(len == (uint32_t)i % 257 && !memcmp(stored, expect, len));
+
+        const uint32_t newLen = i % 2 ? len : len + 40;
+        blobBytes(value, newLen, buf, 1);
+        fail_unless(!artInsertBlob(t, buf, keyLen, value, newLen));
+
+        const void *now;
+        fail_unless(artSearchBlob(t, buf, keyLen, &now, &len));
+        fail_unless(len == newLen && !memcmp(now, value, len));
+        fail_unless(!(i % 2) || now == stored, "Same size must stay put");
+    }
+
+    fail_unless(artCount(t) == (uint64_t)n);
+    fail_unless(countersMatchWalk(t));
+
+    blobWalk walk = {.t = t};
+    fail_unless(artIter(t, blobCb, &walk) == 0 && walk.seen == (uint64_t)n);
+
+    // Deleting half hands the leaf memory back
+    rewind(f);
+    for (int i = 0; i < n && fgets(buf, sizeof buf, f); i++) {
+        buf[strlen(buf) - 1] = '\0';
+        if (i % 2) {
+            fail_unless(artDelete(t, buf, strlen(buf) + 1, NULL));
+        }
+    }
+    fclose(f);
+
+    fail_unless(countersMatchWalk(t));
+    fail_unless(!artSearchBlob(t, "a", 2, NULL, NULL));
+    fail_unless(artSearchBlob(t, "A", 2, NULL, &len) && len == 40);
+
+    // Copies made in RCU mode point at their own bytes
+    art *r = artNew();
+    artRcuEnable(r);
+    fail_unless(artInsertBlob(r, "key", 4, "first", 6));
+    fail_unless(!artInsertBlob(r, "key", 4, "again", 6));
+    fail_unless(artInsertBlob(r, "kez", 4, "other", 6));
+    fail_unless(artSearchBlob(r, "key", 4, &stored, &len) && len == 6 &&
+                !memcmp(stored, "again", 6));
+    artRcuSynchronize(r);
+    fail_unless(countersMatchWalk(r));
+    artFree(r);
+    artFree(t);
+
+    // Plain writes to a blob key replace the inline value and its length
+    t = artNew();
+    int plain = 7;
+    fail_unless(artInsertBlob(t, "mixed", 6, "inline bytes", 13));
+    fail_unless(!artInsert(t, "mixed", 6, &plain, NULL));
+    fail_unless(artSearchBlob(t, "mixed", 6, &stored, &len));
+    fail_unless(stored == &plain && len == 0);
+    fail_unless(countersMatchWalk(t));
+
+    fail_unless(!artInsertBlob(t, "mixed", 6, "back", 5));
+    fail_unless(artSearchBlob(t, "mixed", 6, &stored, &len));
+    fail_unless(len == 5 && !memcmp(stored, "back", 5));
+    fail_unless(artAdd(t, "mixed", 6, (artValue){.i = 1}, ART_ADD_I64));
+    fail_unless(artSearchBlob(t, "mixed", 6, NULL, &len) && len == 0);
+    fail_unless(countersMatchWalk(t));
+
+    // Empty blobs are never stored inline, in place or not
+    fail_unless(!artInsertBlob(t, "mixed", 6, "", 0));
+    fail_unless(artSearchBlob(t, "mixed", 6, &stored, &len));
+    fail_unless(stored && len == 0);
+    fail_unless(!artInsertBlob(t, "mixed", 6, "x", 1));
+    fail_unless(artSearchBlob(t, "mixed", 6, &stored, &len));
+    fail_unless(len == 1 && *(const char *)stored == 'x');
+    fail_unless(countersMatchWalk(t));
+    artFree(t);
+}
+END_TEST
+
+// Counts calls and answers with 'onFound' or 'onMissing'
+typedef struct upsertCtx {
+    uint64_t calls;
+    artUpsertOp onFound;
+    artUpsertOp onMissing;
+} upsertCtx;
+
+static artUpsertOp upsertCb(void *data, void **value, bool found) {
+    upsertCtx *c = data;
+    c->calls++;
+    if (!found) {
+        fail_unless(*value == NULL);
+        *value = (void *)1;
+        return c->onMissing;
+    }
+
+    *value = (void *)((uintptr_t)*value + 1);
+    return c->onFound;
+}
+
+START_TEST(test_artUpsert) {
+    for (int rcu = 0; rcu < 2; rcu++) {
+        art *t = artNew();
+        if (rcu) {
+            artRcuEnable(t);
+        }
+
+        upsertCtx c = {.onFound = ART_UPSERT_KEEP,
+                       .onMissing = ART_UPSERT_STORE};
+        char buf[512];
+        uint64_t n = 0;
+        FILE *f = fopen("tests/words.txt", "r");
+        while (fgets(buf, sizeof buf, f) && n < 30000) {
+            buf[strlen(buf) - 1] = '\0';
+            fail_unless(artUpsert(t, buf, strlen(buf) + 1, upsertCb, &c) ==
+                        ART_UPSERT_STORE);
+            n++;
+        }
+
+        fail_unless(artCount(t) == n && c.calls == n);
+        fail_unless(countersMatchWalk(t));
+
+        // A declined create leaves no trace
+        c.onMissing = ART_UPSERT_KEEP;
+        fail_unless(artUpsert(t, "not a word", 11, upsertCb, &c) ==
+                    ART_UPSERT_KEEP);
+        fail_unless(!artSearch(t, "not a word", 11, NULL));
+        fail_unless(artCount(t) == n && countersMatchWalk(t));
+
+        // Existing values change in place, every other one is deleted
+        rewind(f);
+        for (uint64_t i = 0; i < n && fgets(buf, sizeof buf, f); i++) {
+            buf[strlen(buf) - 1] = '\0';
+            c.onFound = i % 2 ? ART_UPSERT_DELETE : ART_UPSERT_KEEP;
+            fail_unless(artUpsert(t, buf, strlen(buf) + 1, upsertCb, &c) ==
+                        c.onFound);
+        }
+
+        fail_unless(artCount(t) == n - n / 2);
+        fail_unless(countersMatchWalk(t));
+        fail_unless(c.calls == 2 * n + 1);
+
+        rewind(f);
+        for (uint64_t i = 0; i < n && fgets(buf, sizeof buf, f); i++) {
+            buf[strlen(buf) - 1] = '\0';
+            void *v = NULL;
+            const bool found = artSearch(t, buf, strlen(buf) + 1, &v);
+            fail_unless(i % 2 ? !found : found && v == (void *)2, "%s", buf);
+        }
+
+        // Deleting the rest through upserts collapses the tree to nothing
+        c.onFound = ART_UPSERT_DELETE;
+        rewind(f);
+        for (uint64_t i = 0; i < n && fgets(buf, sizeof buf, f); i++) {
+            buf[strlen(buf) - 1] = '\0';
+            artUpsert(t, buf, strlen(buf) + 1, upsertCb, &c);
+            if (i % 1000 == 0) {
+                fail_unless(countersMatchWalk(t));
+            }
+        }
+        fclose(f);
+
+        fail_unless(artCount(t) == 0 && !artMinimum(t));
+        fail_unless(artBytes(t) == 0 && artNodes(t) == 0);
+
+        artRcuSynchronize(t);
+        artFree(t);
+    }
+}
+END_TEST
+
+static artValue valueOf(const art *t, const char *key) {
+    artValue v = {0};
+    fail_unless(artSearch(t, key, strlen(key) + 1, &v.ptr), "%s", key);
+    return v;
+}
+
+START_TEST(test_artAdd) {
+    art *t = artNew();
+    artInsert(t, "neighbour", 10, NULL, NULL);
+
+    // Whole signed values, starting from zero for a missing key
+    fail_unless(artAdd(t, "n", 2, (artValue){.i = 5}, ART_ADD_I64));
+    fail_unless(artAdd(t, "n", 2, (artValue){.i = -8}, ART_ADD_I64));
+    fail_unless(valueOf(t, "n").i == -3);
+    fail_unless(!artAdd(t, "n", 2, (artValue){.i = 3}, ART_ADD_DELETE_ZERO));
+    fail_unless(!artSearch(t, "n", 2, NULL) && artCount(t) == 1);
+    fail_unless(!artAdd(t, "n", 2, (artValue){.i = 0}, ART_ADD_DELETE_ZERO));
+    fail_unless(artCount(t) == 1);
+
+    artAdd(t, "big", 4, (artValue){.i = INT64_MAX - 1}, ART_ADD_I64);
+    artAdd(t, "big", 4, (artValue){.i = 5}, ART_ADD_SATURATE);
+    fail_unless(valueOf(t, "big").i == INT64_MAX);
+    artAdd(t, "big", 4, (artValue){.i = 1}, ART_ADD_I64);
+    fail_unless(valueOf(t, "big").i == INT64_MIN);
+
+    // Two 32-bit lanes move independently
+    const artValue pair = {.si = {.a = INT32_MAX, .b = -1}};
+    artAdd(t, "pair", 5, pair, ART_ADD_I32X2);
+    artAdd(t, "pair", 5, (artValue){.si = {.a = 1, .b = 2}},
+           ART_ADD_I32X2 | ART_ADD_SATURATE);
+    fail_unless(valueOf(t, "pair").si.a == INT32_MAX);
+    fail_unless(valueOf(t, "pair").si.b == 1);
+    artAdd(t, "pair", 5, (artValue){.si = {.a = 1, .b = -1}}, ART_ADD_I32X2);
+    fail_unless(valueOf(t, "pair").si.a == INT32_MIN);
+    fail_unless(valueOf(t, "pair").si.b == 0);
+
+    // Four 16-bit lanes; the key goes once all of them reach zero
+    const artValue quad = {.i16 = {INT16_MAX, INT16_MIN, 7, 0}};
+    artAdd(t, "quad", 5, quad, ART_ADD_I16X4);
+    artAdd(t, "quad", 5, (artValue){.i16 = {1, -1, -7, 0}}, ART_ADD_I16X4);
+    artValue q = valueOf(t, "quad");
+    fail_unless(q.i16[0] == INT16_MIN && q.i16[1] == INT16_MAX);
+    fail_unless(q.i16[2] == 0 && q.i16[3] == 0);
+    artAdd(t, "quad", 5, (artValue){.i16 = {-1, 1, 0, 0}},
+           ART_ADD_I16X4 | ART_ADD_SATURATE);
+    q = valueOf(t, "quad");
+    fail_unless(q.i16[0] == INT16_MIN && q.i16[1] == INT16_MAX);
+    fail_unless(artAdd(t, "quad", 5, (artValue){.i16 = {1, 0, 0, 0}},
+                       ART_ADD_I16X4 | ART_ADD_DELETE_ZERO));
+    fail_unless(!artAdd(t, "quad", 5,
+                        (artValue){.i16 = {INT16_MAX, -INT16_MAX, 0, 0}},
+                        ART_ADD_I16X4 | ART_ADD_DELETE_ZERO));
+    fail_unless(!artSearch(t, "quad", 5, NULL));
+    fail_unless(countersMatchWalk(t));
+    artFree(t);
+
+    // A batch sums repeated keys and drops the ones that cancel out
+    t = artNew();
+    artRcuEnable(t);
+    const void *keys[] = {"a", "b", "a", "c", "b", "a"};
+    const uint32_t lens[] = {2, 2, 2, 2, 2, 2};
+    const artValue deltas[] = {{.i = 1}, {.i = 2}, {.i = 3},
+                               {.i = 4}, {.i = -2}, {.i = 5}};
+    fail_unless(artAddBatch(t, keys, lens, deltas, 6,
+                            ART_ADD_I64 | ART_ADD_DELETE_ZERO) == 2);
+    fail_unless(artCount(t) == 2);
+    fail_unless(valueOf(t, "a").i == 9 && valueOf(t, "c").i == 4);
+
+    // Repeats still saturate one delta at a time, in the order given
+    const void *satKeys[] = {"s", "a", "s", "s"};
+    const artValue satDeltas[] = {
+        {.i = INT64_MAX}, {.i = 1}, {.i = 1}, {.i = -1}};
+    fail_unless(artAddBatch(t, satKeys, lens, satDeltas, 4,
+                            ART_ADD_I64 | ART_ADD_SATURATE) == 2);
+    fail_unless(valueOf(t, "s").i == INT64_MAX - 1);
+    fail_unless(valueOf(t, "a").i == 10);
+    artRcuSynchronize(t);
+    fail_unless(countersMatchWalk(t));
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artDeleteDecrement_child_leaf) {
+    art *t = artNew();
+    artInsert(t, "other", 6, NULL, NULL);
+
+    // 'counter' hangs off the root node as a leaf child
+    artInsertIncrement(t, "counter", 8, ART_INCREMENT_WHOLE, NULL);
+    artInsertIncrement(t, "counter", 8, ART_INCREMENT_WHOLE, NULL);
+    fail_unless(!artDeleteDecrement(t, "counter", 8, ART_INCREMENT_WHOLE));
+    fail_unless(valueOf(t, "counter").u == 1);
+    fail_unless(artDeleteDecrement(t, "counter", 8, ART_INCREMENT_WHOLE));
+    fail_unless(!artSearch(t, "counter", 8, NULL));
+
+    artInsertIncrement(t, "counter", 8, ART_INCREMENT_B, NULL);
+    artInsertIncrement(t, "counter", 8, ART_INCREMENT_B, NULL);
+    fail_unless(!artDeleteDecrement(t, "counter", 8, ART_INCREMENT_B));
+    fail_unless(valueOf(t, "counter").su.b == 1);
+    fail_unless(artDeleteDecrement(t, "counter", 8, ART_INCREMENT_B));
+    fail_unless(artCount(t) == 1 && countersMatchWalk(t));
+    artFree(t);
+}
+END_TEST
+
+START_TEST(test_artCompact) {
+    art *t = artNew();
+    char buf[512];
+    FILE *f = fopen("tests/words.txt", "r");
+    uintptr_t line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        artInsert(t, buf, len, (void *)line++, NULL);
+    }
+
+    // Thin the tree out so its nodes are left oversized and scattered
+    rewind(f);
+    line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        if (line++ % 4) {
+            artDelete(t, buf, len, NULL);
+        }
+    }
+
+    fail_unless(artInsertBlob(t, "~blob", 6, "inline", 7));
+    const uint64_t count = artCount(t);
+    const size_t bytes = artBytes(t);
+    artCompact(t);
+    fail_unless(artCount(t) == count);
+    fail_unless(artBytes(t) <= bytes);
+    fail_unless(countersMatchWalk(t));
+
+    const void *blob;
+    uint32_t blobLen;
+    fail_unless(artSearchBlob(t, "~blob", 6, &blob, &blobLen));
+    fail_unless(blobLen == 7 && !strcmp(blob, "inline"));
+
+    // Tiny budgets split the pass into many steps, with writes in between
+    char key[16];
+    int steps = 0;
+    while (!artCompactStep(t, 1)) {
+        snprintf(key, sizeof(key), "step%d", steps);
+        artInsert(t, key, strlen(key) + 1, (void *)(uintptr_t)steps, NULL);
+        if (steps % 2) {
+            snprintf(key, sizeof(key), "step%d", steps - 1);
+            fail_unless(artDelete(t, key, strlen(key) + 1, NULL));
+        }
+        steps++;
+    }
+
+    fail_unless(steps > 1);
+    fail_unless(artCount(t) == count + (steps + 1) / 2);
+    fail_unless(countersMatchWalk(t));
+
+    // In RCU mode the steps copy the path they resume along
+    fail_unless(artRcuEnable(t));
+    while (!artCompactStep(t, 1)) {
+    }
+    artRcuSynchronize(t);
+    fail_unless(countersMatchWalk(t));
+
+    rewind(f);
+    line = 1;
+    while (fgets(buf, sizeof buf, f)) {
+        const int len = strlen(buf);
+        buf[len - 1] = '\0';
+        void *v = NULL;
+        const bool found = artSearch(t, buf, len, &v);
+        fail_unless(found == !(line % 4), "%s", buf);
+        fail_unless(!found || (uintptr_t)v == line);
+        line++;
+    }
+
+    for (int i = 1; i < steps; i += 2) {
+        snprintf(key, sizeof(key), "step%d", i);
+        fail_unless(artSearch(t, key, strlen(key) + 1, NULL));
+    }
+
+    fclose(f);
+    artFree(t);
+}
+END_TEST
@@ -0,0 +1,156 @@
+/* Tests of the C++ wrapper in art.hpp. Standalone so it needs no C++
+ * build of check; a failed CHECK() reports its line and fails the run. */
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "../src/art.hpp"
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,        \
+                         __LINE__, #cond);                                     \
+            std::exit(1);                                                      \
+        }                                                                      \
+    } while (0)
+
+// An empty allocator adds nothing to the map
+static_assert(sizeof(art::map<uint64_t, int>) == sizeof(void *));
+
+static void test_emplace_and_erase() {
+    art::map<uint64_t, std::string> m;
+    CHECK(m.empty() && m.begin() == m.end());
+
+    auto [it, inserted] = m.try_emplace(7, 3, 'x');
+    CHECK(inserted && it.key() == 7 && it.value() == "xxx");
+
+    // An existing key leaves both the value and the arguments alone
+    std::string arg = "moved?";
+    auto again = m.try_emplace(7, std::move(arg));
+    CHECK(!again.second && again.first == it && arg == "moved?");
+    CHECK(m.at(7) == "xxx");
+
+    m[9] = "nine";
+    m.insert({8, "eight"});
+    m.insert_or_assign(7, "seven");
+    CHECK(m.size() == 3 && m.at(7) == "seven" && m.contains(8));
+
+    bool threw = false;
+    try {
+        m.at(10);
+    } catch (const std::out_of_range &) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    // Erasing by iterator returns the next key
+    auto next = m.erase(m.find(8));
+    CHECK(next != m.end() && next->first == 9);
+    CHECK(m.erase(8) == 0 && m.erase(7) == 1);
+    CHECK(m.size() == 1 && m.begin()->second == "nine");
+    CHECK(m.erase(m.begin()) == m.end() && m.empty());
+}
+
+static void test_iteration() {
+    art::map<int64_t, int> m;
+    const int64_t keys[] = {-300, -1, 0, 5, 1 << 20, INT64_MIN, INT64_MAX};
+    for (int i = 0; i < 7; i++) {
+        m.try_emplace(keys[i], i);
+    }
+
+    // Signed keys come out in numeric order both ways
+    std::vector<int64_t> forward;
+    for (auto [key, value] : m) {
+        CHECK(keys[value] == key);
+        forward.push_back(key);
+    }
+    CHECK(forward.size() == 7);
+    for (size_t i = 1; i < forward.size(); i++) {
+        CHECK(forward[i - 1] < forward[i]);
+    }
+
+    std::vector<int64_t> backward;
+    for (auto it = m.rbegin(); it != m.rend(); ++it) {
+        backward.push_back(it->first);
+    }
+    CHECK(std::vector<int64_t>(forward.rbegin(), forward.rend()) == backward);
+    CHECK(std::prev(m.end()).key() == INT64_MAX);
+
+    // Values are changed in place through iterators
+    for (auto it = m.begin(); it != m.end(); ++it) {
+        it->second *= 10;
+    }
+    CHECK(m.at(5) == 30);
+
+    // Iterators survive inserts and erases of other keys
+    auto it = m.find(0);
+    m.try_emplace(1, 0);
+    m.erase(5);
+    CHECK((++it).key() == 1 && (++it).key() == 1 << 20);
+
+    // compact() keeps every value
+    m.compact();
+    CHECK(m.size() == 7 && m.at(-300) == 0 && m.at(INT64_MIN) == 50);
+}
+
+static void test_bounds() {
+    art::map<std::string, int> m;
+    for (const char *word : {"apple", "banana", "cherry", "date"}) {
+        m.try_emplace(word, int(std::string(word).size()));
+    }
+
+    CHECK(m.lower_bound("banana").key() == "banana");
+    CHECK(m.lower_bound("blueberry").key() == "cherry");
+    CHECK(m.upper_bound("banana").key() == "cherry");
+    CHECK(m.lower_bound("zebra") == m.end());
+    CHECK(m.upper_bound("a").key() == "apple");
+
+    auto [lo, hi] = m.equal_range("cherry");
+    CHECK(std::distance(lo, hi) == 1 && lo->second == 6);
+    auto [lo2, hi2] = m.equal_range("coconut");
+    CHECK(lo2 == hi2 && lo2.key() == "date");
+
+    const auto &cm = m;
+    art::map<std::string, int>::const_iterator cit = cm.lower_bound("c");
+    CHECK(cit.key() == "cherry" && cm.count("date") == 1);
+}
+
+static void test_moves() {
+    art::map<uint64_t, std::string> a;
+    for (uint64_t i = 0; i < 1000; i++) {
+        a.try_emplace(i * 7, std::to_string(i));
+    }
+
+    art::map<uint64_t, std::string> copy(a);
+    art::map<uint64_t, std::string> b(std::move(a));
+    CHECK(a.empty() && a.native_handle() == nullptr);
+    CHECK(b.size() == 1000 && b.at(700) == "100");
+
+    // A moved-from map takes new keys
+    a.try_emplace(1, "one");
+    CHECK(a.size() == 1);
+
+    a = std::move(b);
+    CHECK(a.size() == 1000 && b.empty() && !a.contains(1));
+    swap(a, b);
+    CHECK(a.empty() && b.size() == 1000);
+
+    // The copy is independent of the original
+    copy.erase(0);
+    copy[7] = "changed";
+    CHECK(copy.size() == 999 && b.at(0) == "0" && b.at(7) == "1");
+    b.clear();
+    CHECK(b.empty() && b.begin() == b.end());
+}
+
+int main() {
+    test_emplace_and_erase();
+    test_iteration();
+    test_bounds();
+    test_moves();
+    return 0;
+}
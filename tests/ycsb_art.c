@@ -0,0 +1,754 @@
+/* YCSB-style mixed workload driver.
+ *
+ *     ycsb_art [-w A-F] [-p read:update:insert:scan:rmw:delete]
+ *              [-k zipfian|uniform|latest] [-z theta] [-t threads]
+ *              [-n records] [-o ops] [-l scanLen] [-y sync] [-s seed]
+ *
+ * The tree is preloaded with -n records, then -t threads share -o
+ * operations drawn from the workload mix:
+ *
+ *     A  50% read, 50% update          D  95% read, 5% insert, latest
+ *     B  95% read, 5% update           E  95% scan, 5% insert
+ *     C  100% read                     F  50% read, 50% read-modify-write
+ *
+ * -p replaces the mix with explicit percentages, and may add deletes,
+ * which YCSB itself never issues. Records are picked Zipfian (scrambled
+ * across the key space, as YCSB does), uniform or latest. Scans start at
+ * the picked key and read up to a uniform 1..scanLen keys in order.
+ *
+ * Keys are 8-byte big-endian hashes of the record number. Every op goes
+ * through a syncOps wrapper chosen by -y, so the same driver measures each
+ * way of sharing a tree between threads; a new strategy is one more entry
+ * in syncTable. Each op is timed and the report gives throughput and
+ * per-op-type latency percentiles. */
+
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/art.h"
+#include "../src/artKey.h"
+#include "../src/artSharded.h"
+
+typedef enum opType {
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_RMW,
+    OP_DELETE,
+    OP_TYPES,
+} opType;
+
+static const char *opNames[OP_TYPES] = {"read", "update", "insert",
+                                        "scan", "rmw",    "delete"};
+
+typedef enum keyDist {
+    DIST_ZIPFIAN,
+    DIST_UNIFORM,
+    DIST_LATEST,
+} keyDist;
+
+/* A way of sharing one tree between threads. create() returns the state
+ * passed to every other call. */
+typedef struct syncOps {
+    const char *name;
+    void *(*create)(void);
+    void (*destroy)(void *s);
+    bool (*search)(void *s, const void *key, uint32_t keyLen, void **value);
+    bool (*insert)(void *s, const void *key, uint32_t keyLen, void *value);
+    bool (*remove)(void *s, const void *key, uint32_t keyLen);
+    int (*scan)(void *s, const void *lo, uint32_t loLen, artCallback cb,
+                void *data);
+} syncOps;
+
+/*
+ * One tree behind a global mutex.
+ */
+
+typedef struct mutexTree {
+    pthread_mutex_t lock;
+    art *t;
+} mutexTree;
+
+static void *mutexCreate(void) {
+    mutexTree *m = malloc(sizeof(*m));
+    pthread_mutex_init(&m->lock, NULL);
+    m->t = artNew();
+    return m;
+}
+
+static void mutexDestroy(void *s) {
+    mutexTree *m = s;
+    artFree(m->t);
+    pthread_mutex_destroy(&m->lock);
+    free(m);
+}
+
+static bool mutexSearch(void *s, const void *key, uint32_t keyLen,
+                        void **value) {
+    mutexTree *m = s;
+    pthread_mutex_lock(&m->lock);
+    const bool found = artSearch(m->t, key, keyLen, value);
+    pthread_mutex_unlock(&m->lock);
+    return found;
+}
+
+static bool mutexInsert(void *s, const void *key, uint32_t keyLen,
+                        void *value) {
+    mutexTree *m = s;
+    pthread_mutex_lock(&m->lock);
+    const bool added = artInsert(m->t, key, keyLen, value, NULL);
+    pthread_mutex_unlock(&m->lock);
+    return added;
+}
+
+static bool mutexRemove(void *s, const void *key, uint32_t keyLen) {
+    mutexTree *m = s;
+    pthread_mutex_lock(&m->lock);
+    const bool removed = artDelete(m->t, key, keyLen, NULL);
+    pthread_mutex_unlock(&m->lock);
+    return removed;
+}
+
+static int mutexScan(void *s, const void *lo, uint32_t loLen, artCallback cb,
+                     void *data) {
+    mutexTree *m = s;
+    pthread_mutex_lock(&m->lock);
+    const int res = artIterRange(m->t, lo, loLen, NULL, 0, cb, data);
+    pthread_mutex_unlock(&m->lock);
+    return res;
+}
+
+/*
+ * One tree behind a reader-writer lock, so reads and scans run together.
+ */
+
+typedef struct rwlockTree {
+    pthread_rwlock_t lock;
+    art *t;
+} rwlockTree;
+
+static void *rwlockCreate(void) {
+    rwlockTree *r = malloc(sizeof(*r));
+    pthread_rwlock_init(&r->lock, NULL);
+    r->t = artNew();
+    return r;
+}
+
+static void rwlockDestroy(void *s) {
+    rwlockTree *r = s;
+    artFree(r->t);
+    pthread_rwlock_destroy(&r->lock);
+    free(r);
+}
+
+static bool rwlockSearch(void *s, const void *key, uint32_t keyLen,
+                         void **value) {
+    rwlockTree *r = s;
+    pthread_rwlock_rdlock(&r->lock);
+    const bool found = artSearch(r->t, key, keyLen, value);
+    pthread_rwlock_unlock(&r->lock);
+    return found;
+}
+
+static bool rwlockInsert(void *s, const void *key, uint32_t keyLen,
+                         void *value) {
+    rwlockTree *r = s;
+    pthread_rwlock_wrlock(&r->lock);
+    const bool added = artInsert(r->t, key, keyLen, value, NULL);
+    pthread_rwlock_unlock(&r->lock);
+    return added;
+}
+
+static bool rwlockRemove(void *s, const void *key, uint32_t keyLen) {
+    rwlockTree *r = s;
+    pthread_rwlock_wrlock(&r->lock);
+    const bool removed = artDelete(r->t, key, keyLen, NULL);
+    pthread_rwlock_unlock(&r->lock);
+    return removed;
+}
+
+static int rwlockScan(void *s, const void *lo, uint32_t loLen,
+                      artCallback cb, void *data) {
+    rwlockTree *r = s;
+    pthread_rwlock_rdlock(&r->lock);
+    const int res = artIterRange(r->t, lo, loLen, NULL, 0, cb, data);
+    pthread_rwlock_unlock(&r->lock);
+    return res;
+}
+
+/*
+ * artSharded: 64 range shards on the first key byte, which is uniform for
+ * the hashed keys used here.
+ */
+
+static void *shardedCreate(void) {
+    return artShardedNew(64, 1, ART_SHARD_RANGE);
+}
+
+static void shardedDestroy(void *s) {
+    artShardedFree(s);
+}
+
+static bool shardedSearch(void *s, const void *key, uint32_t keyLen,
+                          void **value) {
+    return artShardedSearch(s, key, keyLen, value);
+}
+
+static bool shardedInsert(void *s, const void *key, uint32_t keyLen,
+                          void *value) {
+    return artShardedInsert(s, key, keyLen, value, NULL);
+}
+
+static bool shardedRemove(void *s, const void *key, uint32_t keyLen) {
+    return artShardedDelete(s, key, keyLen, NULL);
+}
+
+static int shardedScan(void *s, const void *lo, uint32_t loLen,
+                       artCallback cb, void *data) {
+    return artShardedIterRange(s, lo, loLen, NULL, 0, cb, data);
+}
+
+/*
+ * One tree in RCU mode: writers take a mutex, readers only pin an epoch
+ * through a reader each thread registers on first use.
+ */
+
+typedef struct rcuTree {
+    pthread_mutex_t lock;
+    art *t;
+    artRcuReader **readers;
+    uint32_t readerCount;
+} rcuTree;
+
+static __thread rcuTree *rcuOwner;
+static __thread artRcuReader *rcuSelf;
+
+static void *rcuCreate(void) {
+    rcuTree *r = calloc(1, sizeof(*r));
+    pthread_mutex_init(&r->lock, NULL);
+    r->t = artNew();
+    artRcuEnable(r->t);
+    return r;
+}
+
+static void rcuDestroy(void *s) {
+    rcuTree *r = s;
+    for (uint32_t i = 0; i < r->readerCount; i++) {
+        artRcuUnregister(r->readers[i]);
+    }
+
+    artFree(r->t);
+    pthread_mutex_destroy(&r->lock);
+    free(r->readers);
+    free(r);
+}
+
+static artRcuReader *rcuReader(rcuTree *r) {
+    if (rcuOwner != r) {
+        rcuOwner = r;
+        rcuSelf = artRcuRegister(r->t);
+        pthread_mutex_lock(&r->lock);
+        r->readers = realloc(r->readers,
+                             (r->readerCount + 1) * sizeof(*r->readers));
+        r->readers[r->readerCount++] = rcuSelf;
+        pthread_mutex_unlock(&r->lock);
+    }
+
+    return rcuSelf;
+}
+
+static bool rcuSearch(void *s, const void *key, uint32_t keyLen,
+                      void **value) {
+    rcuTree *r = s;
+    artRcuReader *self = rcuReader(r);
+    artRcuReadLock(self);
+    const bool found = artSearch(r->t, key, keyLen, value);
+    artRcuReadUnlock(self);
+    return found;
+}
+
+static bool rcuInsert(void *s, const void *key, uint32_t keyLen,
+                      void *value) {
+    rcuTree *r = s;
+    pthread_mutex_lock(&r->lock);
+    const bool added = artInsert(r->t, key, keyLen, value, NULL);
+    pthread_mutex_unlock(&r->lock);
+    return added;
+}
+
+static bool rcuRemove(void *s, const void *key, uint32_t keyLen) {
+    rcuTree *r = s;
+    pthread_mutex_lock(&r->lock);
+    const bool removed = artDelete(r->t, key, keyLen, NULL);
+    pthread_mutex_unlock(&r->lock);
+    return removed;
+}
+
+static int rcuScan(void *s, const void *lo, uint32_t loLen, artCallback cb,
+                   void *data) {
+    rcuTree *r = s;
+    artRcuReader *self = rcuReader(r);
+    artRcuReadLock(self);
+    const int res = artIterRange(r->t, lo, loLen, NULL, 0, cb, data);
+    artRcuReadUnlock(self);
+    return res;
+}
+
+static const syncOps syncTable[] = {
+    {"mutex", mutexCreate, mutexDestroy, mutexSearch, mutexInsert,
+     mutexRemove, mutexScan},
+    {"rwlock", rwlockCreate, rwlockDestroy, rwlockSearch, rwlockInsert,
+     rwlockRemove, rwlockScan},
+    {"sharded", shardedCreate, shardedDestroy, shardedSearch, shardedInsert,
+     shardedRemove, shardedScan},
+    {"rcu", rcuCreate, rcuDestroy, rcuSearch, rcuInsert, rcuRemove, rcuScan},
+};
+
+/*
+ * Key choice.
+ */
+
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double nextDouble(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* FNV-1a over the record number's bytes, which both spreads the keys and
+ * scrambles the Zipfian ranks across them. */
+static uint64_t scramble(uint64_t v) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        h = (h ^ (v & 0xFF)) * 0x100000001B3ULL;
+        v >>= 8;
+    }
+    return h;
+}
+
+/* Gray et al.'s Zipfian generator over [0, n), as used by YCSB. */
+typedef struct zipfian {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+} zipfian;
+
+static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+        sum += 1 / pow((double)i, theta);
+    }
+    return sum;
+}
+
+static void zipfianInit(zipfian *z, uint64_t n, double theta) {
+    const double zeta2 = zeta(2, theta);
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1 / (1 - theta);
+    z->zetan = zeta(n, theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static uint64_t zipfianNext(const zipfian *z, uint64_t *state) {
+    const double u = nextDouble(state);
+    const double uz = u * z->zetan;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, z->theta)) {
+        return 1;
+    }
+
+    const uint64_t r =
+        (uint64_t)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+/*
+ * Driver.
+ */
+
+typedef struct config {
+    const syncOps *sync;
+    unsigned mix[OP_TYPES];
+    keyDist dist;
+    double theta;
+    unsigned threads;
+    uint64_t records;
+    uint64_t ops;
+    uint32_t scanLen;
+    uint64_t seed;
+} config;
+
+typedef struct latencies {
+    uint64_t *ns;
+    size_t count;
+} latencies;
+
+typedef struct worker {
+    pthread_t thread;
+    const config *cfg;
+    void *tree;
+    const zipfian *zipf;
+    _Atomic uint64_t *nextRecord;
+    pthread_barrier_t *start;
+    uint64_t ops;
+    uint64_t seed;
+    latencies lat[OP_TYPES];
+} worker;
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void recordKey(uint8_t *key, uint64_t record) {
+    artKeyPutU64(key, scramble(record));
+}
+
+/* Record numbers at or past the insert counter are skipped; an insert
+ * that claimed one may still be in flight, in which case the op misses. */
+static uint64_t pickRecord(worker *w, uint64_t *state) {
+    const uint64_t inserted = atomic_load_explicit(w->nextRecord,
+                                                   memory_order_relaxed);
+    switch (w->cfg->dist) {
+    case DIST_UNIFORM:
+        return nextRandom(state) % inserted;
+    case DIST_LATEST:
+        return inserted - 1 - zipfianNext(w->zipf, state) % inserted;
+    case DIST_ZIPFIAN:
+    default:
+        return scramble(zipfianNext(w->zipf, state)) % inserted;
+    }
+}
+
+static opType pickOp(const config *cfg, uint64_t *state) {
+    unsigned roll = nextRandom(state) % 100;
+    for (int op = 0; op < OP_TYPES; op++) {
+        if (roll < cfg->mix[op]) {
+            return op;
+        }
+        roll -= cfg->mix[op];
+    }
+    return OP_READ;
+}
+
+static int scanCb(void *data, const void *key, uint32_t keyLen,
+                  void *value) {
+    (void)key;
+    (void)keyLen;
+    (void)value;
+    return --*(uint32_t *)data == 0;
+}
+
+static void runOp(worker *w, opType op, uint64_t *state) {
+    const syncOps *sync = w->cfg->sync;
+    uint8_t key[8];
+    void *value;
+
+    if (op == OP_INSERT) {
+        const uint64_t record = atomic_fetch_add_explicit(
+            w->nextRecord, 1, memory_order_relaxed);
+        recordKey(key, record);
+        sync->insert(w->tree, key, sizeof(key), (void *)(uintptr_t)record);
+        return;
+    }
+
+    const uint64_t record = pickRecord(w, state);
+    recordKey(key, record);
+
+    switch (op) {
+    case OP_READ:
+        sync->search(w->tree, key, sizeof(key), &value);
+        break;
+    case OP_UPDATE:
+        sync->insert(w->tree, key, sizeof(key), (void *)(uintptr_t)record);
+        break;
+    case OP_SCAN: {
+        uint32_t left = 1 + nextRandom(state) % w->cfg->scanLen;
+        sync->scan(w->tree, key, sizeof(key), scanCb, &left);
+        break;
+    }
+    case OP_RMW:
+        if (sync->search(w->tree, key, sizeof(key), &value)) {
+            sync->insert(w->tree, key, sizeof(key),
+                         (void *)((uintptr_t)value + 1));
+        }
+        break;
+    case OP_DELETE:
+        sync->remove(w->tree, key, sizeof(key));
+        break;
+    default:
+        break;
+    }
+}
+
+static void *workerMain(void *arg) {
+    worker *w = arg;
+    uint64_t state = w->seed;
+
+    pthread_barrier_wait(w->start);
+    for (uint64_t i = 0; i < w->ops; i++) {
+        const opType op = pickOp(w->cfg, &state);
+        const uint64_t start = nowNs();
+        runOp(w, op, &state);
+        latencies *l = &w->lat[op];
+        l->ns[l->count++] = nowNs() - start;
+    }
+    pthread_barrier_wait(w->start);
+
+    return NULL;
+}
+
+static int compareU64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t n, double pct) {
+    size_t idx = (size_t)(pct / 100.0 * n);
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void report(const config *cfg, worker *workers, uint64_t elapsedNs) {
+    printf("sync %s, %u threads, %" PRIu64 " records, %" PRIu64 " ops: "
+           "%.3f Mops/s\n",
+           cfg->sync->name, cfg->threads, cfg->records, cfg->ops,
+           cfg->ops * 1000.0 / elapsedNs);
+    printf("%-7s %10s %9s %8s %8s %8s %8s %9s\n", "op", "count", "mean",
+           "p50", "p95", "p99", "p99.9", "max");
+
+    for (int op = 0; op < OP_TYPES; op++) {
+        size_t n = 0;
+        for (unsigned i = 0; i < cfg->threads; i++) {
+            n += workers[i].lat[op].count;
+        }
+        if (!n) {
+            continue;
+        }
+
+        uint64_t *all = malloc(n * sizeof(*all));
+        uint64_t total = 0;
+        size_t pos = 0;
+        for (unsigned i = 0; i < cfg->threads; i++) {
+            const latencies *l = &workers[i].lat[op];
+            memcpy(all + pos, l->ns, l->count * sizeof(*all));
+            pos += l->count;
+        }
+        for (size_t i = 0; i < n; i++) {
+            total += all[i];
+        }
+
+        qsort(all, n, sizeof(*all), compareU64);
+        printf("%-7s %10zu %9.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+               " %8" PRIu64 " %9" PRIu64 "\n",
+               opNames[op], n, (double)total / n, percentile(all, n, 50),
+               percentile(all, n, 95), percentile(all, n, 99),
+               percentile(all, n, 99.9), all[n - 1]);
+        free(all);
+    }
+}
+
+static void run(const config *cfg) {
+    void *tree = cfg->sync->create();
+    uint8_t key[8];
+    for (uint64_t r = 0; r < cfg->records; r++) {
+        recordKey(key, r);
+        cfg->sync->insert(tree, key, sizeof(key), (void *)(uintptr_t)r);
+    }
+
+    zipfian zipf;
+    zipfianInit(&zipf, cfg->records, cfg->theta);
+    _Atomic uint64_t nextRecord = cfg->records;
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, cfg->threads + 1);
+
+    worker *workers = calloc(cfg->threads, sizeof(*workers));
+    for (unsigned i = 0; i < cfg->threads; i++) {
+        worker *w = &workers[i];
+        w->cfg = cfg;
+        w->tree = tree;
+        w->zipf = &zipf;
+        w->nextRecord = &nextRecord;
+        w->start = &start;
+        w->ops = cfg->ops / cfg->threads + (i < cfg->ops % cfg->threads);
+        w->seed = cfg->seed + i * 0x9E3779B97F4A7C15ULL;
+        for (int op = 0; op < OP_TYPES; op++) {
+            if (cfg->mix[op]) {
+                w->lat[op].ns = malloc((w->ops + 1) * sizeof(uint64_t));
+            }
+        }
+        pthread_create(&w->thread, NULL, workerMain, w);
+    }
+
+    pthread_barrier_wait(&start);
+    const uint64_t begin = nowNs();
+    pthread_barrier_wait(&start);
+    const uint64_t elapsed = nowNs() - begin;
+
+    for (unsigned i = 0; i < cfg->threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    report(cfg, workers, elapsed);
+
+    for (unsigned i = 0; i < cfg->threads; i++) {
+        for (int op = 0; op < OP_TYPES; op++) {
+            free(workers[i].lat[op].ns);
+        }
+    }
+    free(workers);
+    pthread_barrier_destroy(&start);
+    cfg->sync->destroy(tree);
+}
+
+static bool setWorkload(config *cfg, char w) {
+    static const struct {
+        char name;
+        unsigned mix[OP_TYPES];
+        keyDist dist;
+    } workloads[] = {
+        {'A', {50, 50, 0, 0, 0, 0}, DIST_ZIPFIAN},
+        {'B', {95, 5, 0, 0, 0, 0}, DIST_ZIPFIAN},
+        {'C', {100, 0, 0, 0, 0, 0}, DIST_ZIPFIAN},
+        {'D', {95, 0, 5, 0, 0, 0}, DIST_LATEST},
+        {'E', {0, 0, 5, 95, 0, 0}, DIST_ZIPFIAN},
+        {'F', {50, 0, 0, 0, 50, 0}, DIST_ZIPFIAN},
+    };
+
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        if (workloads[i].name == w || workloads[i].name == w - 'a' + 'A') {
+            memcpy(cfg->mix, workloads[i].mix, sizeof(cfg->mix));
+            cfg->dist = workloads[i].dist;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool setMix(config *cfg, const char *spec) {
+    unsigned total = 0;
+    for (int op = 0; op < OP_TYPES; op++) {
+        char *end;
+        cfg->mix[op] = strtoul(spec, &end, 10);
+        total += cfg->mix[op];
+        if (*end != (op == OP_TYPES - 1 ? '\0' : ':')) {
+            return false;
+        }
+        spec = end + 1;
+    }
+    return total == 100;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-w A-F] [-p read:update:insert:scan:rmw:delete]\n"
+            "       [-k zipfian|uniform|latest] [-z theta] [-t threads]\n"
+            "       [-n records] [-o ops] [-l scanLen] [-y sync] "
+            "[-s seed]\n"
+            "sync:",
+            prog);
+    for (size_t i = 0; i < sizeof(syncTable) / sizeof(syncTable[0]); i++) {
+        fprintf(stderr, " %s", syncTable[i].name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    config cfg = {
+        .sync = &syncTable[0],
+        .theta = 0.99,
+        .threads = 4,
+        .records = 1000000,
+        .ops = 1000000,
+        .scanLen = 100,
+        .seed = 42,
+    };
+    setWorkload(&cfg, 'A');
+    int opt;
+
+    while ((opt = getopt(argc, argv, "w:p:k:z:t:n:o:l:y:s:h")) != -1) {
+        bool ok = true;
+        switch (opt) {
+        case 'w':
+            ok = strlen(optarg) == 1 && setWorkload(&cfg, optarg[0]);
+            break;
+        case 'p':
+            ok = setMix(&cfg, optarg);
+            break;
+        case 'k':
+            if (!strcmp(optarg, "zipfian")) {
+                cfg.dist = DIST_ZIPFIAN;
+            } else if (!strcmp(optarg, "uniform")) {
+                cfg.dist = DIST_UNIFORM;
+            } else if (!strcmp(optarg, "latest")) {
+                cfg.dist = DIST_LATEST;
+            } else {
+                ok = false;
+            }
+            break;
+        case 'z':
+            cfg.theta = strtod(optarg, NULL);
+            ok = cfg.theta > 0 && cfg.theta < 1;
+            break;
+        case 't':
+            cfg.threads = strtoul(optarg, NULL, 10);
+            ok = cfg.threads > 0;
+            break;
+        case 'n':
+            cfg.records = strtoull(optarg, NULL, 10);
+            ok = cfg.records > 1;
+            break;
+        case 'o':
+            cfg.ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            cfg.scanLen = strtoul(optarg, NULL, 10);
+            ok = cfg.scanLen > 0;
+            break;
+        case 'y':
+            ok = false;
+            for (size_t i = 0; i < sizeof(syncTable) / sizeof(syncTable[0]);
+                 i++) {
+                if (!strcmp(optarg, syncTable[i].name)) {
+                    cfg.sync = &syncTable[i];
+                    ok = true;
+                }
+            }
+            break;
+        case 's':
+            cfg.seed = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+
+        if (!ok) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    run(&cfg);
+    return 0;
+}